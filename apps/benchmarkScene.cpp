@@ -0,0 +1,70 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "Window.h"
+#include "Scene.h"
+#include "Config.h"
+#include "FrameArena.h"
+#include "GpuProfiler.h"
+#include "SimulationThread.h"
+
+// Renders a scene for a fixed number of frames without vsync
+// and reports the average frame time.
+// Usage: benchmarkScene [scene file] [number of frames] [threaded]
+// With "threaded", the scene is updated on a SimulationThread while frames are submitted.
+int main(int argc, char* argv[]) {
+    try
+    {
+        Window window(1280, 720, "Benchmark");
+        window.setVSync(false);
+
+        std::string sceneFile = argc > 1 ? argv[1] : "vertexBenchmark.json";
+        int numFrames = argc > 2 ? std::stoi(argv[2]) : 1000;
+        bool threaded = argc > 3 && std::string(argv[3]) == "threaded";
+        auto scene = Scene::loadScene(SCENES_DIR + sceneFile);
+        SimulationThread simulation(*scene);
+
+        // let the driver finish lazy uploads and shader compilation
+        const int warmupFrames = 10;
+        std::chrono::steady_clock::time_point start;
+        for (int frame = 0; frame < warmupFrames + numFrames && !window.shouldClose(); frame++)
+        {
+            if (frame == warmupFrames)
+            {
+                glFinish();
+                start = std::chrono::steady_clock::now();
+            }
+            window.pollEvents();
+            if (threaded)
+            {
+                simulation.startUpdate(window.events());
+                scene->render();
+            }
+            else
+                scene->render(window.events());
+            window.swapBuffers();
+        }
+        simulation.waitForUpdate();
+        glFinish();
+
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << sceneFile << ": " << elapsed.count() / numFrames
+                  << " ms per frame over " << numFrames << " frames\n";
+        std::cout << "frame arena of the main thread: " << FrameArena::local().highWaterMark() / 1024
+                  << " KiB at most, " << FrameArena::local().numBlockAllocations() << " heap blocks\n";
+        if (const GpuProfiler* gpu = scene->gpuProfiler())
+        {
+            std::cout << "GPU time of the last measured frame:\n";
+            for (const GpuScopeTime& scope : gpu->lastFrame())
+                std::cout << std::string(2 * scope.depth + 2, ' ') << scope.name << ": "
+                          << scope.milliseconds() << " ms\n";
+        }
+    }
+    catch (const std::exception& exception)
+    {
+        std::cout << exception.what() << "\n";
+        return -1;
+    }
+}
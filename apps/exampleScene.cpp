@@ -3,9 +3,11 @@
 #include "Window.h"
 #include "Scene.h"
 #include "Config.h"
+#include "Profiler.h"
 #include "Shader.h"
+#include "SimulationThread.h"
 
-int main() {
+int main(int argc, char* argv[]) {
     try
     {
         // Create and initialize an application window with given dimensions and name.
@@ -13,18 +15,48 @@ int main() {
 
         // Scene holds all information about models, textures and lights to render
         // as well as the camera.
-        auto scene = Scene::loadScene(SCENES_DIR + "welcomeToOpenGL_hero.json");
+        // An optional argument selects another scene from the scenes folder.
+        std::string sceneFile = argc > 1 ? argv[1] : "welcomeToOpenGL_hero.json";
+        // With a second argument "trace", the trace is recorded from the start, loading included.
+        bool traceLoading = argc > 2 && std::string(argv[2]) == "trace";
+        if (traceLoading)
+            Profiler::start();
+        auto scene = Scene::loadScene(SCENES_DIR + sceneFile);
+        // Updates the scene on another thread while this thread talks to OpenGL.
+        SimulationThread simulation(*scene);
+        // T starts recording a trace; pressing it again writes trace.json
+        // for chrome://tracing or ui.perfetto.dev
+        StickyButton tracing(traceLoading);
 
         // Loop until the window is closed.
         while (!window.shouldClose())
         {
             // Process and accumulate mouse and keyboard events during this frame.
             window.pollEvents();
+            if (window.events().keyState(GLFW_KEY_T))
+                tracing.push();
+            else
+                tracing.release();
+            if (tracing.state() != Profiler::isRecording())
+            {
+                if (tracing.state())
+                    Profiler::start();
+                else
+                {
+                    Profiler::stop();
+                    Profiler::writeChromeTrace("trace.json");
+                    std::cout << "Wrote trace.json\n";
+                }
+            }
 
-            // Scene makes all the calls to OpenGL that it need to do to render.
-            // Receives input events from the window and extracts whatever is important.
-            // Also gets a time step (dt, delta t) to update camera and animations.
-            scene->render(window.events());
+            // The scene receives input events from the window and extracts whatever is important,
+            // e.g. a time step (dt, delta t) to update camera and animations.
+            // The update of this frame runs in the background...
+            simulation.startUpdate(window.events());
+
+            // ...while the scene makes all the calls to OpenGL that it needs
+            // to render the last state that was updated.
+            scene->render();
 
             // Window has been displaying a buffer from the previous frame.
             // OpenGL has been drawing to a reserve buffer.
@@ -4,6 +4,12 @@ set(SHADERS_DIR ${PROJECT_SOURCE_DIR}/lib/shaders)
 set(SCENES_DIR ${PROJECT_SOURCE_DIR}/scenes)
 set(TEXTURES_DIR ${PROJECT_SOURCE_DIR}/assets/textures)
 set(MODELS_DIR ${PROJECT_SOURCE_DIR}/assets/models)
+# compiled shader programs are cached here; delete the folder to force recompilation
+set(SHADER_CACHE_DIR ${PROJECT_BINARY_DIR}/shaderCache)
+# SPIR-V modules compiled from the shaders, see RENDGL_SPIRV_SHADERS in lib/CMakeLists.txt
+if (RENDGL_SPIRV_SHADERS)
+  set(SPIRV_DIR ${PROJECT_BINARY_DIR}/spirv)
+endif()
 
 configure_file("${PROJECT_SOURCE_DIR}/lib/Config.h.in" "${PROJECT_BINARY_DIR}/include/Config.h")
 
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Heap allocations counted by the AllocationAudit
+struct AllocationStats
+{
+    // calls of operator new and the bytes they asked for
+    uint64_t newCalls{ 0 };
+    uint64_t newBytes{ 0 };
+    // direct calls of malloc, calloc and realloc, e.g. from C libraries and the driver;
+    // only counted where malloc can be replaced (glibc)
+    uint64_t mallocCalls{ 0 };
+    uint64_t mallocBytes{ 0 };
+};
+
+// AllocationAudit counts heap allocations per frame and per named scope,
+// to prove that frames of a steady state do not allocate.
+// Counting needs the library to be built with RENDGL_ALLOCATION_AUDIT, which replaces
+// the global operator new and delete and, with glibc, malloc and free.
+// Otherwise all counts stay zero and scopes cost nothing.
+class AllocationAudit
+{
+public:
+    static constexpr bool isEnabled()
+    {
+#ifdef RENDGL_ALLOCATION_AUDIT
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Allocations of all threads since the start of the program
+    static AllocationStats total();
+    // Allocations of all threads during the current frame and during the last complete frame
+    static AllocationStats currentFrame();
+    static AllocationStats lastFrame();
+    // End the current frame; called by Window::pollEvents
+    static void nextFrame();
+
+    // Allocations made inside AllocationScopes of the name since the start, on any thread
+    static AllocationStats scope(const char* name);
+    // Names of the scopes that were entered so far
+    static std::vector<std::string> scopeNames();
+};
+
+// AllocationScope attributes the allocations of the calling thread to a named scope
+// while it exists, e.g. AllocationScope scope("Scene::render"). Allocations of jobs that
+// run on other threads are not included. Scopes may nest; the innermost one counts.
+// The name must be a string literal or live as long as the program.
+class AllocationScope
+{
+public:
+#ifdef RENDGL_ALLOCATION_AUDIT
+    explicit AllocationScope(const char* name);
+    ~AllocationScope();
+#else
+    explicit AllocationScope(const char*) {}
+#endif
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+#ifdef RENDGL_ALLOCATION_AUDIT
+private:
+    int m_previous;
+#endif
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <utility>
 
 #include <GL/glew.h>
@@ -26,6 +27,20 @@ public:
     glm::vec3 up() const { return m_up; }
     glm::vec3 right() const { return m_right; }
 
+    // compute view matrix from the current position and orientation
+    glm::mat4 viewMatrix() const;
+    // perspective projection for the given image aspect ratio
+    glm::mat4 projectionMatrix(GLfloat aspectRatio) const;
+    // projection * view, computed once per frame instead of once per vertex
+    glm::mat4 viewProjectionMatrix(GLfloat aspectRatio) const;
+    // Planes (normal, distance) of the view frustum in world space: left, right,
+    // bottom, top, near, far. Normals point inwards and have unit length, so a point p
+    // is inside if dot(normal, p) + distance >= 0 for all planes.
+    std::array<glm::vec4, 6> frustumPlanes(GLfloat aspectRatio) const;
+
+    GLfloat nearPlane() const { return m_near; }
+    GLfloat farPlane() const { return m_far; }
+
 private:
     void processKeys(const EventContainer& events);
     void processMouse(const EventContainer& events);
@@ -34,9 +49,6 @@ private:
     // compute new orientation from yaw and pitch
     void updateOrientation();
 
-    // compute view matrix from the current position and orientation
-    glm::mat4 viewMatrix() const;
-
 private:
     struct CameraState
     {
@@ -62,4 +74,8 @@ private:
     GLfloat m_moveSpeed;
     // turning speed used for mouse
     GLfloat m_turnSpeed;
+
+    // clipping planes of the view frustum
+    GLfloat m_near{ 0.1f };
+    GLfloat m_far{ 100.0f };
 };
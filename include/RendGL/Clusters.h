@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "FrameArena.h"
+
+// Sphere of influence of a point light: light contribution
+// outside of the sphere is negligible
+struct LightSphere
+{
+    glm::vec3 position;
+    GLfloat radius;
+};
+
+// Range of the light index list that belongs to a single cluster
+struct ClusterRange
+{
+    GLuint offset;
+    GLuint count;
+};
+
+// LightClusters bins point lights into a 3D grid of froxels (frustum voxels):
+// screen tiles in x and y and exponentially spaced depth slices in z.
+// A fragment only needs to evaluate the lights of the cluster it falls into.
+// Binning runs on the CPU only, so it can be tested without a GPU.
+class LightClusters
+{
+public:
+    LightClusters(int tilesX = 16, int tilesY = 9, int slices = 24);
+
+    // Bin lights into clusters for a camera with the given view and (symmetric)
+    // perspective projection matrices and near/far clipping planes
+    void build(const std::vector<LightSphere>& lights,
+        const glm::mat4& view, const glm::mat4& projection,
+        GLfloat near, GLfloat far);
+
+    int tilesX() const { return m_tilesX; }
+    int tilesY() const { return m_tilesY; }
+    int slices() const { return m_slices; }
+    size_t numClusters() const { return m_clusters.size(); }
+
+    // Cluster index in the flattened grid; x runs fastest
+    size_t clusterIndex(int tileX, int tileY, int slice) const
+    {
+        return (size_t(slice) * m_tilesY + tileY) * m_tilesX + tileX;
+    }
+    // Depth slice for a positive view-space depth
+    int slice(GLfloat depth) const;
+
+    // One range per cluster into lightIndices()
+    const std::vector<ClusterRange>& clusters() const { return m_clusters; }
+    // Light indices of all clusters, one range after another
+    const std::vector<GLuint>& lightIndices() const { return m_lightIndices; }
+
+    // Coefficients to compute the slice in the shader:
+    // slice = log(depth) * depthScale + depthBias
+    GLfloat depthScale() const { return m_depthScale; }
+    GLfloat depthBias() const { return m_depthBias; }
+
+private:
+    // Extents of a light in cluster coordinates (inclusive).
+    // Empty if the light is outside of the frustum.
+    struct LightBounds
+    {
+        int x0, x1, y0, y1, z0, z1;
+        bool empty() const { return z0 > z1; }
+    };
+
+    // View-space bounds of a light in normalized device xy and depth
+    struct LightExtents
+    {
+        GLfloat xMin, xMax, yMin, yMax, depthMin, depthMax;
+    };
+
+    // Compute light bounds, four lights at a time where SIMD is available
+    void computeBounds(const std::vector<LightSphere>& lights, size_t first, size_t last,
+        FrameVector<LightBounds>& lightBounds) const;
+    LightExtents computeExtents(const LightSphere& light) const;
+    LightBounds toClusterBounds(const LightExtents& extents) const;
+
+    // Count and write light indices of the clusters in the given depth slices
+    void countLights(const FrameVector<LightBounds>& lightBounds, int firstSlice, int lastSlice);
+    void fillLights(const FrameVector<LightBounds>& lightBounds, int firstSlice, int lastSlice);
+
+private:
+    int m_tilesX, m_tilesY, m_slices;
+
+    // camera parameters of the last build
+    glm::mat4 m_view;
+    GLfloat m_scaleX, m_scaleY;
+    GLfloat m_near, m_far;
+    GLfloat m_depthScale, m_depthBias;
+    // distance from the camera to the far corners of the frustum; a light that reaches
+    // further than that past the camera covers every cluster, so its radius is capped there
+    GLfloat m_reach;
+
+    std::vector<ClusterRange> m_clusters;
+    std::vector<GLuint> m_lightIndices;
+};
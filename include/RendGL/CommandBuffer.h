@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "FrameArena.h"
+
+class Mesh;
+class LightManager;
+class GpuProfiler;
+
+// CommandBuffer records the draws of a frame without calling OpenGL, so it can be
+// filled on any thread. Commands are packed one after another into a linear block
+// of memory that the buffer keeps between frames; clear only rewinds it.
+// State commands set the draw data, the lights or the occlusion query
+// that the following draws use. A CommandReplayer plays the buffers back in order.
+// GPU scopes measure the time of the draws between them (see GpuProfiler).
+class CommandBuffer
+{
+public:
+    CommandBuffer() = default;
+
+    // Bind the per-draw uniforms at this offset of the draw data buffer
+    void setDrawData(GLintptr offset);
+    // Point lights of the following draws in the per-instance lighting mode
+    void setInstanceLights(const GLint* lights, int numLights);
+    // Draw only if the query passed, 0 to draw unconditionally
+    void setCondition(GLuint query);
+    void draw(const Mesh& mesh);
+    // name must live as long as the program, see Profiler::internName
+    void beginGpuScope(const char* name);
+    void endGpuScope();
+
+    // Forget the commands but keep the memory
+    void clear();
+    bool empty() const { return m_data.empty(); }
+    size_t numCommands() const { return m_numCommands; }
+    // Bytes used by the recorded commands
+    size_t size() const { return m_data.size(); }
+
+private:
+    friend class CommandReplayer;
+
+    enum class Type : uint32_t
+    {
+        DrawData,
+        InstanceLights,
+        Condition,
+        Draw,
+        BeginGpuScope,
+        EndGpuScope
+    };
+
+    // precedes the payload of each command; payloads are padded to a multiple of 8 bytes
+    struct Header
+    {
+        Type type;
+        uint32_t size;
+    };
+
+    void write(Type type, const void* payload, size_t size);
+
+private:
+    std::vector<unsigned char> m_data;
+    size_t m_numCommands{ 0 };
+};
+
+// CommandBackend executes commands; the GL one is the only backend that calls OpenGL
+class CommandBackend
+{
+public:
+    virtual ~CommandBackend() = default;
+
+    virtual void bindDrawData(GLintptr offset) = 0;
+    virtual void setInstanceLights(const GLint* lights, int numLights) = 0;
+    virtual void beginCondition(GLuint query) = 0;
+    virtual void endCondition() = 0;
+    virtual void draw(const Mesh& mesh) = 0;
+    virtual void beginGpuScope(const char* name) = 0;
+    virtual void endGpuScope() = 0;
+};
+
+// Plays the draws back with the bound shader, the DrawData in a uniform buffer
+// and the per-instance lights of a LightManager. GPU scopes are measured
+// if there is a profiler.
+class GLCommandBackend : public CommandBackend
+{
+public:
+    GLCommandBackend(GLuint drawDataBuffer, GLuint drawDataBinding,
+        const LightManager& lights, GLuint shader, GpuProfiler* gpuProfiler = nullptr);
+
+    void bindDrawData(GLintptr offset) override;
+    void setInstanceLights(const GLint* lights, int numLights) override;
+    void beginCondition(GLuint query) override;
+    void endCondition() override;
+    void draw(const Mesh& mesh) override;
+    void beginGpuScope(const char* name) override;
+    void endGpuScope() override;
+
+private:
+    GLuint m_drawDataBuffer;
+    GLuint m_drawDataBinding;
+    const LightManager& m_lights;
+    GLuint m_shader;
+    GpuProfiler* m_gpuProfiler;
+};
+
+// CommandReplayer hands commands of one or more buffers to a backend in order.
+// State is tracked across the buffers, so commands that set the state
+// it already has are dropped, e.g. when neighbouring buffers select the same lights.
+// A replayer lives for a frame at most; its state is kept in the FrameArena of the thread.
+class CommandReplayer
+{
+public:
+    explicit CommandReplayer(CommandBackend& backend) :
+        m_backend(backend),
+        m_lights(FrameArena::local())
+    {}
+
+    void execute(const CommandBuffer& commands);
+    // End an open condition and forget the state; call after the last buffer
+    void finish();
+
+    // Commands that were dropped because they did not change the state
+    size_t numFiltered() const { return m_numFiltered; }
+
+private:
+    CommandBackend& m_backend;
+
+    bool m_hasDrawData{ false };
+    GLintptr m_drawData{ 0 };
+    bool m_hasLights{ false };
+    FrameVector<GLint> m_lights;
+    GLuint m_condition{ 0 };
+
+    size_t m_numFiltered{ 0 };
+};
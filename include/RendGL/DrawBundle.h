@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "CommandBuffer.h"
+#include "UniformRingBuffer.h"
+
+// DrawBundle holds the draws of content that is drawn the same way in every frame,
+// recorded once and replayed each frame, in the spirit of D3D12 bundles.
+// The per-draw uniforms are uploaded once to a static uniform buffer of the bundle.
+// A recorded bundle is immutable; when its inputs change, it is invalidated and recorded again.
+class DrawBundle
+{
+public:
+    DrawBundle() = default;
+    ~DrawBundle();
+    DrawBundle(const DrawBundle&) = delete;
+    DrawBundle& operator=(const DrawBundle&) = delete;
+
+    // Start recording draws with up to numSlots slots of draw data of slotSize bytes.
+    // The slots are filled on the CPU and uploaded by end.
+    UniformSlots begin(size_t numSlots, GLsizeiptr slotSize);
+    CommandBuffer& commands() { return m_commands; }
+    // Upload the draw data; the bundle can then be replayed
+    void end();
+    // Drop the recorded draws, e.g. when the lights they select change
+    void invalidate();
+    bool isRecorded() const { return m_recorded; }
+
+    // Draw with the bound shader; the draw data is bound to drawDataBinding.
+    // GPU scopes recorded into the bundle are measured by the profiler, if there is one.
+    void replay(GLuint drawDataBinding, const LightManager& lights, GLuint shader,
+        GpuProfiler* gpuProfiler = nullptr) const;
+
+    size_t numCommands() const { return m_commands.numCommands(); }
+
+private:
+    CommandBuffer m_commands;
+    // draw data while recording
+    std::vector<char> m_stagingData;
+    GLuint m_buffer{ 0 };
+    bool m_recording{ false };
+    bool m_recorded{ false };
+};
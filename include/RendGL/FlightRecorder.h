@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+
+// FlightRecorder is always on and keeps the last frames in memory: how long each frame
+// took, the time spent in its named phases, e.g. Scene::render or GPU, and events
+// like asset uploads and shader compiles. Its memory is allocated once.
+// When a frame takes longer than the spike threshold, the recorder waits a few more
+// frames and writes a snapshot of the frames and events around the spike to the dump
+// directory, as Chrome trace JSON. The file is written by a job on a worker thread.
+//
+// Window::pollEvents ends each frame. Phases may be timed on any thread; they count
+// for the frame in which they end.
+class FlightRecorder
+{
+public:
+    static constexpr size_t MAX_PHASES = 16;
+    static constexpr size_t EVENT_TEXT_SIZE = 96;
+
+    explicit FlightRecorder(size_t numFrames = 1024, size_t numEvents = 256);
+    ~FlightRecorder();
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    // Recorder of the application, fed by the library
+    static FlightRecorder& shared();
+
+    // End the current frame and start the next one; call on one thread only
+    void nextFrame();
+    // Add time to a phase of the current frame. The name must live as long as the program;
+    // phases beyond MAX_PHASES are not recorded.
+    void addPhaseTime(const char* name, uint64_t nanoseconds);
+    // Record an event that started at the given Profiler::now time; the text is truncated
+    void addEvent(const char* category, const std::string& text, uint64_t start, uint64_t duration);
+
+    // Frames longer than this trigger a snapshot; 0 turns snapshots off
+    void setSpikeThreshold(double milliseconds) { m_spikeThreshold = uint64_t(milliseconds * 1.0e6); }
+    // Frames after a spike that the snapshot includes
+    void setFramesAfterSpike(size_t numFrames) { m_framesAfterSpike = numFrames; }
+    void setDumpDirectory(const std::string& directory) { m_dumpDirectory = directory; }
+
+    // Write the frames and events in memory now; call on the thread that ends the frames
+    void writeSnapshot(const std::string& fileName);
+    // Wait for a snapshot that is being written
+    void waitForDump();
+    // Snapshots that were written after spikes
+    size_t numDumps() const { return m_numDumps.load(); }
+    size_t numFrames() const { return m_numFrames; }
+
+private:
+    struct FrameRecord
+    {
+        uint64_t index;
+        uint64_t start;
+        uint64_t duration;
+        std::array<uint64_t, MAX_PHASES> phases;
+    };
+
+    struct EventRecord
+    {
+        const char* category;
+        uint64_t start;
+        uint64_t duration;
+        char text[EVENT_TEXT_SIZE];
+    };
+
+    // Frames, events and phase names at one point in time
+    struct Snapshot
+    {
+        std::vector<FrameRecord> frames;
+        size_t numFrames{ 0 };
+        std::vector<EventRecord> events;
+        size_t numEvents{ 0 };
+        std::array<const char*, MAX_PHASES> phaseNames{};
+        // threshold when the snapshot was taken; the trace is written on another thread
+        uint64_t spikeThreshold{ 0 };
+        // frame that triggered the snapshot, if any
+        uint64_t spikeFrame{ 0 };
+        bool hasSpike{ false };
+    };
+
+    int phaseIndex(const char* name);
+    // Copy the rings into the snapshot; allocates nothing
+    void takeSnapshot(Snapshot& snapshot);
+    void writeTrace(const Snapshot& snapshot, const std::string& fileName) const;
+    void startDump();
+
+private:
+    // ring of the last frames; written by nextFrame only
+    std::vector<FrameRecord> m_frames;
+    size_t m_numFrames{ 0 };
+    uint64_t m_frameStart{ 0 };
+    bool m_started{ false };
+
+    // phase names and the times of the current frame
+    std::array<std::atomic<const char*>, MAX_PHASES> m_phaseNames{};
+    std::array<std::atomic<uint64_t>, MAX_PHASES> m_phaseTimes{};
+    std::atomic<int> m_numPhases{ 0 };
+    std::mutex m_phaseMutex;
+
+    // ring of the last events, from any thread
+    std::vector<EventRecord> m_events;
+    size_t m_numEvents{ 0 };
+    std::mutex m_eventMutex;
+
+    uint64_t m_spikeThreshold{ 50000000 };
+    size_t m_framesAfterSpike{ 30 };
+    std::string m_dumpDirectory{ "." };
+    // snapshot is taken when the frame count reaches m_dumpFrame
+    bool m_dumpPending{ false };
+    size_t m_dumpFrame{ 0 };
+    uint64_t m_spikeFrame{ 0 };
+    Snapshot m_dump;
+    JobGroup m_dumpGroup;
+    std::atomic<size_t> m_numDumps{ 0 };
+};
+
+// FlightPhase adds the time of a block to a phase of the shared FlightRecorder
+class FlightPhase
+{
+public:
+    explicit FlightPhase(const char* name);
+    ~FlightPhase();
+    FlightPhase(const FlightPhase&) = delete;
+    FlightPhase& operator=(const FlightPhase&) = delete;
+
+private:
+    const char* m_name;
+    uint64_t m_start;
+};
+
+// FlightEvent records a block as an event of the shared FlightRecorder, e.g. an upload
+class FlightEvent
+{
+public:
+    FlightEvent(const char* category, std::string text);
+    ~FlightEvent();
+    FlightEvent(const FlightEvent&) = delete;
+    FlightEvent& operator=(const FlightEvent&) = delete;
+
+private:
+    const char* m_category;
+    std::string m_text;
+    uint64_t m_start;
+};
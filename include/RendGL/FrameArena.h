@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// FrameArena is a linear allocator for data that lives for a single frame,
+// e.g. lists that are built and consumed during the frame. Allocating moves a pointer
+// and nothing is freed on its own; reset releases everything at once.
+// Memory comes in blocks from the heap. When a frame needs more than one block,
+// reset replaces them with a single block of the high-water mark, so that frames
+// of a steady state allocate nothing from the heap.
+//
+// Each thread has its own arena, local(). Window::pollEvents starts a new frame,
+// and the arena of a thread is reset the next time the thread calls local().
+// Memory from local() is thus valid until the end of the frame, also on other threads.
+class FrameArena
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit FrameArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Arena of the calling thread, reset if a frame started since its last use
+    static FrameArena& local();
+    // Start a new frame for the arenas of all threads that follow frames
+    static void nextFrame();
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    template <typename T>
+    T* allocate(size_t count) { return static_cast<T*>(allocate(count * sizeof(T), alignof(T))); }
+    // Release all allocations
+    void reset();
+
+    // A thread whose work spans frames, like the simulation thread, resets its arena itself
+    void setFollowsFrames(bool followsFrames) { m_followsFrames = followsFrames; }
+
+    // Bytes allocated since the last reset, including alignment
+    size_t used() const { return m_usedInFullBlocks + m_offset; }
+    // Most bytes that were ever in use at once
+    size_t highWaterMark() const { return m_highWaterMark; }
+    size_t capacity() const;
+    // Blocks that were taken from the heap so far
+    size_t numBlockAllocations() const { return m_numBlockAllocations; }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    void addBlock(size_t size);
+
+private:
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    // position in the last block and the bytes used in the blocks before it
+    size_t m_offset{ 0 };
+    size_t m_usedInFullBlocks{ 0 };
+    size_t m_highWaterMark{ 0 };
+    size_t m_numBlockAllocations{ 0 };
+
+    bool m_followsFrames{ true };
+    // frame of the last reset by local()
+    uint64_t m_frame{ 0 };
+};
+
+// ArenaAllocator lets standard containers allocate from a FrameArena.
+// Deallocation does nothing; the memory returns to the arena on reset.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    ArenaAllocator(FrameArena& arena) noexcept : m_arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : m_arena(other.arena()) {}
+
+    T* allocate(size_t count) { return m_arena->allocate<T>(count); }
+    void deallocate(T*, size_t) noexcept {}
+
+    FrameArena* arena() const { return m_arena; }
+
+private:
+    FrameArena* m_arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() != b.arena(); }
+
+// Vector for per-frame lists, e.g. FrameVector<GLuint> indices(FrameArena::local());
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
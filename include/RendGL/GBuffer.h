@@ -0,0 +1,41 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// GBuffer is an off-screen framebuffer for deferred shading. The geometry pass
+// stores surface properties of the visible fragments in it, and the lighting pass
+// reads them back to shade every pixel exactly once:
+// - albedo (rgba), 8 bits per channel
+// - normal packed onto an octahedron (xy) + shininess (z), 16-bit floats,
+//   so that the lighting pass shades exactly like the forward shader
+// - depth, used to reconstruct the position
+class GBuffer
+{
+public:
+    GBuffer();
+    ~GBuffer();
+    GBuffer(const GBuffer&) = delete;
+    GBuffer& operator=(const GBuffer&) = delete;
+
+    // (Re)create the attachments if the framebuffer size has changed
+    void resize(int width, int height);
+
+    // Render to the G-buffer
+    void bindFramebuffer() const;
+    // Bind albedo, normal and depth textures to three consecutive texture units
+    void bindTextures(GLuint firstUnit) const;
+
+    // Draw a triangle that covers the whole screen to run the lighting pass
+    void drawFullscreenTriangle() const;
+
+private:
+    void createAttachments();
+    void deleteAttachments();
+
+private:
+    GLuint m_framebuffer{ 0 };
+    GLuint m_albedo{ 0 }, m_normalShininess{ 0 }, m_depth{ 0 };
+    // the fullscreen triangle is generated in the vertex shader, but a VAO must be bound
+    GLuint m_emptyVAO{ 0 };
+    int m_width{ 0 }, m_height{ 0 };
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "Profiler.h"
+
+// Time that the GPU spent in a scope, on the clock of Profiler::now
+struct GpuScopeTime
+{
+    const char* name;
+    // number of enclosing scopes
+    int depth;
+    uint64_t start;
+    uint64_t end;
+
+    double milliseconds() const { return double(end - start) / 1.0e6; }
+};
+
+// GpuProfiler measures how long the GPU works on named scopes of a frame with
+// GL_TIMESTAMP queries at their begin and end; unlike GL_TIME_ELAPSED, these nest.
+// Each frame has its own set of queries in a ring of numFrames frames, and results are
+// only read once the GPU has finished a frame, so measuring never stalls the pipeline.
+// A frame whose queries are still pending when its set comes around again is dropped.
+//
+// The GPU clock is mapped to Profiler::now at the start of each frame, so the scopes
+// join the CPU zones on a "GPU" track of the trace while the Profiler records.
+class GpuProfiler
+{
+public:
+    // scopes beyond this number in a frame are not measured
+    static constexpr size_t MAX_SCOPES_PER_FRAME = 512;
+
+    explicit GpuProfiler(int numFrames = 4);
+    ~GpuProfiler();
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    // Timer queries are core in GL 3.3
+    static bool isSupported();
+
+    // Read the frames that the GPU has finished and start measuring a new one
+    void beginFrame();
+    void endFrame();
+    // Scopes nest and must be ended in reverse order, in the frame they began in
+    void beginScope(const char* name);
+    void endScope();
+
+    // Scopes of the newest frame whose results arrived, in the order they began
+    const std::vector<GpuScopeTime>& lastFrame() const { return m_lastFrame; }
+    // Total time of the scopes of a name in lastFrame, e.g. of all draws of a model
+    double lastFrameMilliseconds(const char* name) const;
+    // Frames whose results were read and frames that were dropped
+    uint64_t numFramesRead() const { return m_numFramesRead; }
+    uint64_t numFramesDropped() const { return m_numFramesDropped; }
+
+private:
+    struct Scope
+    {
+        const char* name;
+        int depth;
+    };
+
+    struct Frame
+    {
+        // Profiler::now minus the GPU time at the start of the frame
+        int64_t clockOffset{ 0 };
+        bool pending{ false };
+        std::vector<Scope> scopes;
+    };
+
+    // the queries at the begin and the end of a scope
+    GLuint beginQuery(size_t frame, size_t scope) const { return m_queries[(frame * MAX_SCOPES_PER_FRAME + scope) * 2]; }
+    GLuint endQuery(size_t frame, size_t scope) const { return m_queries[(frame * MAX_SCOPES_PER_FRAME + scope) * 2 + 1]; }
+    // Read the frame if the GPU has finished it; never waits
+    bool tryRead(size_t frame);
+
+private:
+    std::vector<GLuint> m_queries;
+    std::vector<Frame> m_frames;
+    size_t m_frame{ 0 };
+    // scopes of the current frame that are open; -1 for those beyond the limit
+    std::vector<int> m_open;
+
+    std::vector<GpuScopeTime> m_lastFrame;
+    uint64_t m_numFramesRead{ 0 };
+    uint64_t m_numFramesDropped{ 0 };
+    Profiler::Track* m_track;
+};
+
+// GpuScope measures the GPU time of a block, if there is a profiler
+class GpuScope
+{
+public:
+    GpuScope(GpuProfiler* profiler, const char* name) :
+        m_profiler(profiler)
+    {
+        if (m_profiler)
+            m_profiler->beginScope(name);
+    }
+    ~GpuScope()
+    {
+        if (m_profiler)
+            m_profiler->endScope();
+    }
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+    GpuProfiler* m_profiler;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+
+// Command of glMultiDrawElementsIndirect, as laid out in the indirect buffer
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// IndirectRenderer draws static geometry with GPU-driven culling.
+// All meshes live in one GeometryPool and the per-draw data of all draws in a storage buffer.
+// Each frame, a compute shader tests the bounding sphere of every draw against the view frustum
+// and sets the instance count of its indirect command to 0 or 1. Materials come from
+// the MaterialTable, so the draws of each shader variant (textured or not) are then
+// submitted with one glMultiDrawElementsIndirect, whatever the number of draws.
+// Shaders read their DrawData from the storage buffer when compiled with GPU_DRIVEN 1.
+class IndirectRenderer
+{
+public:
+    // Compute shaders, storage buffers and multi-draw indirect (GL 4.3 or the ARB extensions)
+    static bool isSupported();
+
+    IndirectRenderer();
+    ~IndirectRenderer();
+    IndirectRenderer(const IndirectRenderer&) = delete;
+    IndirectRenderer& operator=(const IndirectRenderer&) = delete;
+
+    // Add a draw of an index range of the geometry. Draws are culled by their world-space bounds.
+    void addDraw(const MeshGeometry& geometry, const SubMesh& range, bool textured,
+        const DrawData& drawData, const BoundingSphere& bounds);
+    // Sort the draws by material kind and copy them to the GPU. Call once, after the last addDraw.
+    void upload();
+
+    // Cull all draws against the frustum planes (see Camera::frustumPlanes)
+    void cull(const std::array<glm::vec4, 6>& frustumPlanes) const;
+    // Draw the visible draws with textured or untextured materials
+    // with the active shader, compiled with GPU_DRIVEN 1
+    void render(bool textured) const;
+    // Draw all visible draws, e.g. with a position-only shader for a depth pre-pass
+    void renderDepth() const;
+
+    size_t numDraws() const { return m_draws.size(); }
+
+private:
+    // Submit a range of the indirect commands
+    void draw(GLsizei firstDraw, GLsizei numDraws) const;
+
+    struct Draw
+    {
+        PooledMesh range;
+        bool textured;
+        DrawData drawData;
+        BoundingSphere bounds;
+    };
+
+private:
+    ShaderProgram m_cullShader;
+    GeometryPool m_geometry;
+    std::vector<Draw> m_draws;
+    // untextured draws come first in the buffers, then the textured ones
+    GLsizei m_numUntexturedDraws{ 0 };
+
+    // DrawData of each draw, read by the vertex shader
+    GLuint m_drawDataBuffer{ 0 };
+    // bounding sphere (center, radius) of each draw, read by the cull shader
+    GLuint m_boundsBuffer{ 0 };
+    // DrawElementsIndirectCommand of each draw; the cull shader writes the instance counts
+    GLuint m_commandBuffer{ 0 };
+    // 0, 1, 2, ...: an instanced attribute, so that the base instance of a command
+    // gives the shaders the index of the draw
+    GLuint m_drawIndexBuffer{ 0 };
+};
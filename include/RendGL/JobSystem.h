@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using Job = std::function<void()>;
+
+// JobGroup counts the jobs that were started with it and are not finished yet.
+// JobSystem::wait blocks until the count drops to zero. The first exception
+// thrown by a job of the group is rethrown by wait.
+class JobGroup
+{
+public:
+    JobGroup() = default;
+    JobGroup(const JobGroup&) = delete;
+    JobGroup& operator=(const JobGroup&) = delete;
+
+    bool isDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<size_t> m_pending{ 0 };
+    std::mutex m_mutex;
+    std::exception_ptr m_exception;
+};
+
+// JobSystem runs jobs on a pool of worker threads with work stealing.
+// Every worker has its own double-ended queue: it pushes and pops its own jobs at the back,
+// and idle workers steal from the front of the others. Threads that wait
+// for a group run jobs in the meantime, so jobs may start and wait for nested jobs.
+// Jobs that call OpenGL must run on the main thread, the thread that owns the
+// OpenGL context; they are queued with runOnMainThread. Threads that wait without
+// finding a job spin briefly, then sleep until a job is queued or their group is done.
+class JobSystem
+{
+public:
+    // Pool shared by all parts of the library, with a worker for each core but one
+    static JobSystem& shared();
+
+    // The calling thread becomes the main thread, until setMainThread is called
+    explicit JobSystem(size_t numWorkers = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    ~JobSystem();
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Start a job on any thread
+    void run(JobGroup& group, Job job);
+    // Start a job on the main thread; it runs in executeMainThreadJobs or while the main thread waits
+    void runOnMainThread(JobGroup& group, Job job);
+    // Run the jobs that were queued for the main thread. Call once per frame on the main thread.
+    void executeMainThreadJobs();
+
+    // Run jobs until all jobs of the group are finished
+    void wait(JobGroup& group);
+
+    // Split [0, count) into chunks of at least minChunk elements, process them
+    // as jobs and wait for them. Chunks are smaller than the share of each thread,
+    // so that threads that finish early can steal the rest.
+    template <typename Function>
+    void parallelFor(size_t count, size_t minChunk, Function function);
+
+    // The calling thread becomes the main thread. The Window calls it on the thread
+    // that creates the OpenGL context, before any main-thread jobs are queued.
+    void setMainThread() { m_mainThread.store(std::this_thread::get_id()); }
+
+    size_t numWorkers() const { return m_workers.size(); }
+    bool isMainThread() const { return std::this_thread::get_id() == m_mainThread.load(); }
+
+private:
+    struct Task
+    {
+        Job job;
+        JobGroup* group{ nullptr };
+    };
+
+    // Ring buffer of tasks that keeps its memory, so that a steady flow of jobs allocates nothing
+    class TaskRing
+    {
+    public:
+        bool empty() const { return m_size == 0; }
+        size_t size() const { return m_size; }
+        Task& front() { return m_tasks[m_first]; }
+        Task& back() { return m_tasks[(m_first + m_size - 1) % m_tasks.size()]; }
+        void push_back(Task task);
+        // the job is released right away, with anything it captured
+        void pop_front() { front() = Task{}; m_first = (m_first + 1) % m_tasks.size(); m_size--; }
+        void pop_back() { back() = Task{}; m_size--; }
+
+    private:
+        std::vector<Task> m_tasks;
+        size_t m_first{ 0 };
+        size_t m_size{ 0 };
+    };
+
+    // Jobs of one worker; a mutex is enough, since jobs are much longer than the lock
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        TaskRing tasks;
+    };
+
+    void workerLoop(size_t worker);
+    // Pop a task of the calling worker, or steal one from another worker
+    bool findTask(Task& task);
+    void execute(Task& task);
+
+private:
+    std::atomic<std::thread::id> m_mainThread;
+    std::vector<std::thread> m_workers;
+    // one queue per worker, plus one at the end for jobs started by other threads
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    WorkQueue m_mainThreadQueue;
+
+    // number of queued tasks; workers sleep while it is zero
+    std::atomic<size_t> m_queued{ 0 };
+    // number of tasks queued for the main thread; it stops sleeping in wait when there are any
+    std::atomic<size_t> m_mainThreadQueued{ 0 };
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+    bool m_stopping{ false };
+};
+
+// Split [0, count) into chunks and process them on the shared JobSystem
+template <typename Function>
+void parallelFor(size_t count, size_t minChunk, Function function)
+{
+    JobSystem::shared().parallelFor(count, minChunk, function);
+}
+
+// TaskGraph runs jobs in the order of their dependencies. Each task starts
+// as soon as all the tasks it depends on are finished, on a worker or, if added
+// as a main-thread task, on the main thread. Dependencies must be added before
+// the tasks that depend on them, so the graph has no cycles.
+class TaskGraph
+{
+public:
+    using TaskId = size_t;
+
+    TaskId add(Job job, const std::vector<TaskId>& dependencies = {});
+    TaskId addOnMainThread(Job job, const std::vector<TaskId>& dependencies = {});
+
+    // Run all tasks and wait for them
+    void run(JobSystem& jobs);
+
+    size_t size() const { return m_tasks.size(); }
+
+private:
+    struct Task
+    {
+        Job job;
+        bool mainThread;
+        size_t numDependencies;
+        std::vector<TaskId> dependents;
+    };
+
+    TaskId add(Job job, const std::vector<TaskId>& dependencies, bool mainThread);
+    void start(JobSystem& jobs, JobGroup& group, TaskId task);
+
+private:
+    std::vector<Task> m_tasks;
+    // dependencies of each task that are not finished yet, during run
+    std::unique_ptr<std::atomic<size_t>[]> m_remaining;
+};
+
+template <typename Function>
+void JobSystem::parallelFor(size_t count, size_t minChunk, Function function)
+{
+    const size_t maxChunks = 4 * (numWorkers() + 1);
+    minChunk = std::max<size_t>(minChunk, 1);
+    const size_t numChunks = std::min(maxChunks, (count + minChunk - 1) / minChunk);
+    if (numChunks <= 1)
+    {
+        if (count > 0)
+            function(size_t(0), count);
+        return;
+    }
+
+    const size_t chunk = (count + numChunks - 1) / numChunks;
+    auto processChunk = [&function, chunk, count](size_t begin) {
+        function(begin, std::min(begin + chunk, count));
+    };
+    JobGroup group;
+    // jobs capture two words only, which std::function stores without a heap allocation
+    for (size_t begin = chunk; begin < count; begin += chunk)
+        run(group, [&processChunk, begin]() { processChunk(begin); });
+    // the calling thread processes the first chunk, then helps with the rest
+    try
+    {
+        processChunk(0);
+    }
+    catch (...)
+    {
+        wait(group);
+        throw;
+    }
+    wait(group);
+}
@@ -4,12 +4,31 @@
 #include <glm/glm.hpp>
 
 #include <vector>
+#include <array>
 
 #include "Utils.h"
+#include "Clusters.h"
+#include "Mesh.h"
+#include "Shader.h"
 
 class EventContainer;
+class Camera;
 
-constexpr size_t MAX_POINT_LIGHTS = 5;
+// Point light contribution below this intensity is neglected
+constexpr GLfloat POINT_LIGHT_CUTOFF = 0.01f;
+// Number of RGBA texels that store a single point light in a texture buffer
+constexpr int POINT_LIGHT_TEXELS = 3;
+// Maximum number of point lights per draw call in the per-instance lighting mode
+constexpr int MAX_INSTANCE_LIGHTS = 8;
+
+// How point lights are matched to the fragments they light
+enum class LightingMode
+{
+    // bin lights into clusters of the view frustum (screen tiles x depth slices)
+    Clustered,
+    // pick the most relevant lights for each model instance
+    PerInstance
+};
 
 class AmbientLight
 {
@@ -32,11 +51,13 @@ public:
         GLfloat intensity);
 
     void talkToShader(GLuint shader) const;
+    bool isOn() const { return m_intensity > 0.0f; }
 
 private:
     glm::vec3 m_color;
     glm::vec3 m_direction;
-    GLfloat m_intensity;
+    // no directional light unless set
+    GLfloat m_intensity{ 0.0f };
 };
 
 class PointLight
@@ -46,7 +67,15 @@ public:
     PointLight(glm::vec3 color, glm::vec3 position,
         glm::vec3 attenuation, GLfloat intensity);
 
-    void talkToShader(GLuint shader, int number) const;
+    glm::vec3 position() const { return m_position; }
+    // Light intensity at a given distance
+    GLfloat intensityAt(GLfloat distance) const;
+    // Distance beyond which the light contribution drops below the cutoff
+    GLfloat radius(GLfloat cutoff = POINT_LIGHT_CUTOFF) const;
+
+    // Light data as stored in the light texture buffer:
+    // (position, radius), (color, intensity), (attenuation, 0)
+    std::array<glm::vec4, POINT_LIGHT_TEXELS> shaderData(GLfloat cutoff = POINT_LIGHT_CUTOFF) const;
 
 private:
     glm::vec3 m_color;
@@ -64,8 +93,10 @@ public:
         GLfloat intensity, GLfloat halfAngle, GLfloat verticalOffset,
         bool isOn);
 
-    void talkToShader(GLuint shader) const;
+    // isOn is the state of the frame being drawn, which may lag behind isOn()
+    void talkToShader(GLuint shader, bool isOn) const;
     void switchOnOff(bool signal);
+    bool isOn() const { return m_isOn.state(); }
 
 private:
     glm::vec3 m_color;
@@ -78,22 +109,112 @@ private:
 };
 
 
+// Pick up to MAX_INSTANCE_LIGHTS point lights that contribute the most to an object
+// inside the bounding sphere. Lights whose sphere of influence does not reach
+// the object are skipped. Returns the number of selected lights.
+int selectPointLights(const std::vector<PointLight>& lights,
+    const std::vector<LightSphere>& lightSpheres, const BoundingSphere& bounds,
+    std::array<GLint, MAX_INSTANCE_LIGHTS>& selection);
+
+// TextureBuffer holds a GPU buffer that shaders read
+// through a buffer texture (samplerBuffer) with texelFetch
+class TextureBuffer
+{
+public:
+    // format of the buffer texels, e.g. GL_RGBA32F
+    TextureBuffer(GLenum format);
+    ~TextureBuffer();
+    TextureBuffer(const TextureBuffer&) = delete;
+    TextureBuffer& operator=(const TextureBuffer&) = delete;
+
+    // Replace buffer content
+    void update(const void* data, size_t size);
+    // Bind the buffer texture to a texture unit
+    void bind(GLuint unit) const;
+
+private:
+    GLuint m_buffer{ 0 }, m_texture{ 0 };
+};
+
+// LightManager holds all lights of a scene and passes them to the shader.
+// Point lights are binned into clusters, so that the shader evaluates
+// only the point lights that can affect a fragment.
 class LightManager
 {
 public:
+    LightManager();
+
     void setAmbientLight(const AmbientLight& ambientLight);
     void setDirectionalLight(const DirectionalLight& directionalLight);
     void addPointLight(const PointLight& pointLight);
     void setSpotLight(const SpotLight& spotLight);
 
-    void talkToShader(GLuint shader) const;
+    void setLightingMode(LightingMode mode);
+    LightingMode lightingMode() const { return m_lightingMode; }
+    // Point light contribution below the cutoff is neglected
+    void setLightCutoff(GLfloat cutoff);
+
+    // In the clustered mode, bin the point lights into clusters of the camera frustum.
+    // Only reads the lights and makes no GL calls, so it may run on another thread
+    // than the rest of the LightManager.
+    void buildClusters(LightClusters& clusters, const Camera& camera, GLfloat aspectRatio) const;
+    // Upload changed point lights and, in the clustered mode, the clusters of this frame
+    void uploadClusters(const LightClusters& clusters);
+
+    // Pass the lights to a shader, with the spot light switched as in the frame being drawn
+    void talkToShader(GLuint shader, bool spotLightOn) const;
+    // Shader features required by the current lights:
+    // DIRECTIONAL_LIGHT, SPOT_LIGHT, POINT_LIGHTS, CLUSTERED_LIGHTING and MAX_INSTANCE_LIGHTS.
+    // Changes when the spot light is switched on or off.
+    const ShaderDefines& shaderDefines() const { return shaderDefines(spotLightOn()); }
+    // The same for the spot light switched on or off, e.g. as in the frame being drawn
+    const ShaderDefines& shaderDefines(bool spotLightOn) const { return m_shaderDefines[spotLightOn]; }
+    // shaderDefines() of every state the lights can be switched to at runtime,
+    // i.e. with the spot light on and off, so that all of them can be precompiled
+    std::vector<ShaderDefines> shaderDefineVariants() const;
+    // In the per-instance mode, pick the most relevant point lights for an object
+    // inside the bounding sphere. Makes no GL calls, so it may run on any thread.
+    // Returns the number of selected lights, 0 in the clustered mode.
+    int selectInstanceLights(const BoundingSphere& bounds,
+        std::array<GLint, MAX_INSTANCE_LIGHTS>& selection) const;
+    // Pass the selected lights of an object. Call before each draw.
+    void talkAboutInstanceLights(GLuint shader, const GLint* lights, int numLights) const;
+    // Changes whenever a change of the lights may change their selection,
+    // e.g. to know when recorded selections are out of date
+    unsigned selectionVersion() const { return m_selectionVersion; }
+    // Switch the spot light with the F key. Only changes spotLightOn(), so it may run
+    // on another thread than the rendering, which then passes the state of its frame.
     void processEvents(const EventContainer& events);
+    bool spotLightOn() const { return m_spotLight.isOn(); }
 
 private:
     void talkAboutPointLights(GLuint shader) const;
+    // the defines are kept for the spot light off and on, so that a frame does not build them again
+    void updateShaderDefines();
 private:
     AmbientLight m_ambientLight;
     DirectionalLight m_directionalLight;
     std::vector<PointLight> m_pointLights;
     SpotLight m_spotLight;
+
+    LightingMode m_lightingMode;
+    GLfloat m_lightCutoff;
+
+    // spheres of influence of the point lights, used for binning and selection
+    std::vector<LightSphere> m_lightSpheres;
+    // grid and depth mapping of the uploaded clusters
+    struct ClusterGrid
+    {
+        int tilesX, tilesY, slices;
+        GLfloat depthScale, depthBias;
+    };
+    ClusterGrid m_clusterGrid;
+    // light data needs uploading only when lights change
+    bool m_pointLightsChanged;
+    unsigned m_selectionVersion{ 0 };
+    std::array<ShaderDefines, 2> m_shaderDefines;
+
+    TextureBuffer m_pointLightData;
+    TextureBuffer m_clusterRanges;
+    TextureBuffer m_clusterLightIndices;
 };
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+class Model;
+struct Material;
+
+// Number of texture arrays of the table, one for each size class of textures:
+// up to 256, 512, 1024 and 2048 texels on the longer side.
+// As MATERIAL_TEXTURE_ARRAYS in materials.glsl.
+constexpr GLuint MATERIAL_TEXTURE_ARRAYS = 4;
+
+// Material parameters, laid out like an element of the Materials block
+// (std140 and std430 agree on it)
+struct MaterialData
+{
+    glm::vec3 diffuseColor;
+    GLfloat shininess;
+    // layer in its texture array, -1 for untextured materials
+    GLint textureLayer;
+    // texture array, i.e. size class, of the texture
+    GLint textureArray;
+    GLint pad[2];
+};
+static_assert(sizeof(MaterialData) == 32, "MaterialData must match the std140 layout");
+
+// MaterialTable packs the materials of all loaded Models into one buffer
+// and copies their textures into the layers of a few texture arrays, one for each size class,
+// so that small textures are not stored at the size of the largest one.
+// Draws then only pass the index of their material, so draws with different materials
+// need no state changes in between and can share one multi-draw.
+// The table is a uniform block as long as it fits in one, and a storage block
+// (GL 4.3 or ARB_shader_storage_buffer_object) beyond that.
+class MaterialTable
+{
+public:
+    MaterialTable() = default;
+    ~MaterialTable();
+    MaterialTable(const MaterialTable&) = delete;
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    // Add all materials of the Model, which must outlive the table
+    void add(const Model& model);
+    // Copy the materials and textures to the GPU. Call once, after the last add.
+    void upload();
+    // Defines that size the shaders' Materials block for the uploaded table:
+    // MAX_MATERIALS and MATERIALS_IN_STORAGE
+    const ShaderDefines& shaderDefines() const { return m_shaderDefines; }
+
+    // Index of an added material in the table
+    GLuint index(const Material& material) const { return m_indices.at(&material); }
+    size_t size() const { return m_materials.size(); }
+
+    // Bind the table and the texture arrays, and point the shader's block and samplers to them
+    void talkToShader(GLuint shader) const;
+
+private:
+    // Create the texture arrays and copy (and scale) each texture into its layer
+    void uploadTextures(std::vector<MaterialData>& materials);
+
+private:
+    std::vector<const Material*> m_materials;
+    std::unordered_map<const Material*, GLuint> m_indices;
+
+    GLuint m_buffer{ 0 };
+    // the table is larger than a uniform block
+    bool m_inStorage{ false };
+    ShaderDefines m_shaderDefines;
+    std::array<GLuint, MATERIAL_TEXTURE_ARRAYS> m_textureArrays{};
+};
@@ -1,8 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 
 #include <GL/glew.h>
+#include <glm/glm.hpp>
 
 using namespace std;
 
@@ -19,6 +26,7 @@ public:
 
 	constexpr VertexData(Value value) : m_value(value) {}
 
+	constexpr Value value() const { return m_value; }
 	constexpr bool has(Value value) const { return (m_value & value) == value; }
 	constexpr int stride() const { return 3*has(POSITION) + 2*has(UV) + 3*has(NORMAL); }
 	constexpr int positionOffset() const { return 0; }
@@ -39,6 +47,40 @@ inline VertexData::Value operator&(VertexData::Value a, VertexData::Value b) {
 	return static_cast<VertexData::Value>(char_result);
 }
 
+// Vertex and index data of a Mesh kept on the CPU side,
+// e.g. to merge several meshes into a single batch.
+struct MeshGeometry
+{
+	vector<GLfloat> vertices;
+	vector<GLuint> indices;
+};
+
+// A range of a (merged) index buffer that came from a single source mesh.
+// Keeps its own bounding box (xmin, xmax, ymin, ymax, zmin, zmax),
+// so that each range can still be culled separately.
+struct SubMesh
+{
+	GLuint firstIndex;
+	GLuint numIndices;
+	array<GLfloat, 6> boundingBox;
+};
+
+// Sphere that encloses an object
+struct BoundingSphere
+{
+	glm::vec3 center;
+	GLfloat radius;
+};
+
+// Sphere around a bounding box (xmin, xmax, ymin, ymax, zmin, zmax) after a transformation
+BoundingSphere boundingSphere(const array<GLfloat, 6>& boundingBox,
+	const glm::mat4& transform = glm::mat4(1.0f));
+
+// Append source geometry to the target geometry, transforming positions and normals.
+// Both must have the POSITION | UV | NORMAL layout. Returns the appended range.
+SubMesh appendGeometry(MeshGeometry& target, const MeshGeometry& source,
+	const glm::mat4& transform = glm::mat4(1.0f));
+
 // Mesh represents a single 3D object. It holds pointers to vertex data on the GPU.
 // The format of vertex data is POSITION -> UV (optional) -> NORMALs (optional).
 class Mesh
@@ -46,17 +88,113 @@ class Mesh
 public:
 	Mesh(const vector<GLfloat>& vertices,
 		const vector<GLuint>& indices, VertexData vertexData);
+	Mesh(const MeshGeometry& geometry, VertexData vertexData);
 	~Mesh();
 	// Copy constructor is needed for std::vector
 	Mesh(Mesh&& other) noexcept;
 	Mesh& operator=(Mesh&& other) & noexcept = delete;
 
 	void render() const;
+	// Render a range of the index buffer
+	void render(GLuint firstIndex, GLuint numIndices) const;
+	// Render with positions only (location = 0), e.g. for a depth pre-pass
+	void renderPositions() const;
 
 private:
 	// Vertex Array, Vertex Buffer and Element Buffer Objects
 	// hold reference numbers to data objects on GPU
 	GLuint m_VAO{ 0 }, m_VBO{ 0 }, m_EBO{ 0 };
+	// Tightly packed copy of the positions and a VAO that only reads them.
+	// Position-only passes then fetch a third of the interleaved data.
+	GLuint m_positionVAO{ 0 }, m_positionVBO{ 0 };
 	// total number of indices to draw = num of elements * 3
 	GLuint m_numIndices{ 0 };
 };
+
+// Location of a mesh in a GeometryPool. Its indices are relative to baseVertex.
+struct PooledMesh
+{
+	GLuint firstIndex;
+	GLuint numIndices;
+	GLint baseVertex;
+};
+
+// GeometryPool packs many meshes into one vertex and one index buffer behind a single VAO,
+// so that draws of different meshes need no state changes in between,
+// e.g. to submit them all with one glMultiDrawElementsIndirect.
+// Geometry must have the POSITION | UV | NORMAL layout.
+class GeometryPool
+{
+public:
+	GeometryPool() = default;
+	~GeometryPool();
+	GeometryPool(const GeometryPool&) = delete;
+	GeometryPool& operator=(const GeometryPool&) = delete;
+
+	// Append the geometry unless the same object was added before.
+	// The geometry must stay alive until upload().
+	PooledMesh add(const MeshGeometry& geometry);
+	// Copy all added geometry to the GPU and free the CPU copy
+	void upload();
+
+	// VAO with locations 0-2 set up like for a Mesh
+	GLuint vao() const { return m_VAO; }
+	size_t numMeshes() const { return m_meshes.size(); }
+
+private:
+	MeshGeometry m_geometry;
+	// added geometry -> its location in the pool
+	unordered_map<const MeshGeometry*, PooledMesh> m_meshes;
+	GLuint m_VAO{ 0 }, m_VBO{ 0 }, m_EBO{ 0 };
+};
+
+// Mesh shared between Models through the GeometryRegistry
+struct SharedMesh
+{
+	SharedMesh(const MeshGeometry& geometry, VertexData meshVertexData);
+
+	VertexData vertexData;
+	Mesh mesh;
+};
+
+// Ref-counted handle to a shared Mesh. GPU memory is freed with the last handle.
+using MeshHandle = shared_ptr<const SharedMesh>;
+
+// 64-bit FNV-1a hash of the vertex and index data
+uint64_t hashGeometry(const MeshGeometry& geometry);
+
+// GeometryRegistry deduplicates meshes by content. Meshes with byte-identical
+// vertex and index data share one GPU allocation, even across Models and Scenes.
+class GeometryRegistry
+{
+public:
+	// Registry shared by all Models and Scenes
+	static GeometryRegistry& shared();
+
+	// Get a Mesh with the given geometry. Uploads the geometry to the GPU
+	// only if no live Mesh with identical data exists. Meshes are compared
+	// with a CPU copy of their geometry, never read back from the GPU.
+	MeshHandle acquire(const MeshGeometry& geometry, VertexData vertexData);
+	// Free the CPU copies once the scene is set up, like Model::releaseGeometry.
+	// Meshes acquired afterwards are not shared with the Meshes of before.
+	void releaseGeometry();
+
+	// Number of bytes that were not uploaded thanks to deduplication
+	size_t bytesSaved() const;
+	// Number of unique Meshes that are still in use
+	size_t numMeshes() const;
+
+private:
+	struct Entry
+	{
+		// weak, so that unused Meshes are freed
+		weak_ptr<const SharedMesh> mesh;
+		// geometry of the Mesh to compare with; none after releaseGeometry
+		optional<MeshGeometry> geometry;
+	};
+
+	mutable mutex m_mutex;
+	// geometry hash -> Meshes with this hash
+	unordered_multimap<uint64_t, Entry> m_meshes;
+	size_t m_bytesSaved{ 0 };
+};
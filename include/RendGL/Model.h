@@ -10,6 +10,9 @@
 #include <glm/glm.hpp>
 
 #include "Mesh.h"
+#include "CommandBuffer.h"
+#include "MaterialTable.h"
+#include "UniformRingBuffer.h"
 
 using namespace std;
 
@@ -32,6 +35,7 @@ public:
 
 	// Activates texture. Any object rendered by the GPU will use this texture
 	void activate() const;
+	GLuint id() const { return m_textureID; }
 
 private:
 	// load from file to GPU
@@ -49,24 +53,65 @@ struct Material
 	Texture m_texture;
 	glm::vec3 m_diffuseColor;
 	GLfloat m_shininess;
+	// false if the Material uses the plain white default texture
+	bool m_textured;
+};
 
-	void activate(GLuint shader) const;
+// Per-draw uniforms, laid out like the std140 DrawData block of the shaders
+struct DrawData
+{
+	glm::mat4 model;
+	// columns of the normal matrix, padded to vec4
+	glm::vec4 normalMatrix[3];
+	// index in the MaterialTable
+	GLuint materialIndex;
+	GLuint pad[3];
 };
+static_assert(sizeof(DrawData) == 128, "DrawData must match the std140 layout");
+
+DrawData makeDrawData(const glm::mat4& modelMatrix, const glm::mat3& normalMatrix, GLuint materialIndex);
 
 // Model represent a 3D model stored in a file.
 // It can contain several Meshes, one for each part of the Model.
 // For each Mesh, there is a Texture and a Material.
+// If batchMeshes is set, Meshes that share a Material are merged into one Mesh.
 class Model
 {
 public:
 	Model() = default;
-	Model(const string& modelName);
-
-	void render(GLuint shader) const;
+	Model(const string& modelName, bool batchMeshes = false);
+
+	// Record a draw for each Mesh with a textured or an untextured Material,
+	// e.g. to use a shader variant for each kind. The DrawData of the draws
+	// is written to the reserved slots, starting at the given slot, which is advanced.
+	// Makes no GL calls, so it may run on any thread.
+	void recordDraws(const UniformSlots& drawData, size_t& slot, const MaterialTable& materials,
+		const glm::mat4& modelMatrix, const glm::mat3& normalMatrix, bool textured,
+		CommandBuffer& commands) const;
+	bool hasMeshes(bool textured) const;
+	// Number of Meshes with textured or untextured Materials
+	size_t numMeshes(bool textured) const;
+	// Render positions only, without materials (depth pre-pass)
+	void renderDepth() const;
 
 	const array<GLfloat, 6>& boundingBox() const { return m_boundingBox; }
 	string boundingBoxAsString() const;
 
+	size_t numMeshes() const { return m_meshes.size(); }
+	// CPU copy of the Mesh geometry in model space; only until releaseGeometry
+	const MeshGeometry& geometry(size_t mesh) const { return m_geometry[mesh]; }
+	// Free the CPU copy of the geometry once the scene is set up; the Meshes stay on the GPU
+	void releaseGeometry() { vector<MeshGeometry>().swap(m_geometry); }
+	// Drop the Meshes when another copy of the geometry is drawn instead, e.g. by an
+	// IndirectRenderer; a shared Mesh is freed with its last handle. Materials and
+	// ranges stay, but nothing may be rendered or recorded from the Model afterwards.
+	void releaseMeshes() { for (auto& mesh : m_meshes) mesh.reset(); }
+	// Ranges of the original meshes inside a (merged) Mesh
+	const vector<SubMesh>& subMeshes(size_t mesh) const { return m_subMeshes[mesh]; }
+	const Material& material(size_t mesh) const { return m_materials[m_meshToMaterial[mesh]]; }
+	GLuint materialIndex(size_t mesh) const { return m_meshToMaterial[mesh]; }
+	const vector<Material>& materials() const { return m_materials; }
+
 private:
 	// open model file and start loading nodes
 	void loadModel();
@@ -74,9 +119,14 @@ private:
 	void loadNode(aiNode* node, const aiScene* scene);
 	// Load a mesh
 	void loadMesh(aiMesh* mesh, const aiScene* scene);
+	// Merge the geometry of meshes that share a material
+	void batchMeshesByMaterial();
+	// Get Meshes for the loaded geometry from the GeometryRegistry
+	void uploadMeshes();
 	// Load all materials and textures stored in the model.
 	void loadMaterials(const aiScene* scene);
-	Texture loadTexture(aiMaterial* material) const;
+	// Load the diffuse texture of the material, or the default texture if there is none
+	Texture loadTexture(aiMaterial* material, bool& textured) const;
 
 	void resetBoundingBox();
 	void updateBoundingBox(GLfloat x, int dim);
@@ -84,8 +134,13 @@ private:
 private:
 	// name of the folder where the model files are stored
 	string m_name;
-	// List of Meshes (parts) that form the Model
-	vector<Mesh> m_meshes;
+	// List of Meshes (parts) that form the Model.
+	// Identical Meshes are shared with other Models.
+	vector<MeshHandle> m_meshes;
+	// Geometry loaded from file, kept for setting up the scene, e.g. static batches
+	vector<MeshGeometry> m_geometry;
+	// Ranges of the original meshes in each Mesh
+	vector<vector<SubMesh>> m_subMeshes;
 	// List of Materials for different meshes
 	vector<Material> m_materials;
 	// Mapping between Mesh and Material indices
@@ -105,13 +160,62 @@ public:
 		GLfloat posX = 0.0f, GLfloat posY = 0.0f, GLfloat posZ = 0.0f,
 		GLfloat scale = 1.0f);
 
-	void render(GLuint shader) const;
+	// Record the draws of the Meshes with textured or untextured Materials
+	void recordDraws(const UniformSlots& drawData, size_t& slot, const MaterialTable& materials,
+		bool textured, CommandBuffer& commands) const;
+	// Render positions only; the model matrix goes to the given uniform location
+	void renderDepth(GLint modelLocation) const;
+
+	const Model& model() const { return m_model; }
+	const glm::mat4& modelMatrix() const { return m_modelMatrix; }
+	const glm::mat3& normalMatrix() const { return m_normalMatrix; }
+	const BoundingSphere& boundingSphere() const { return m_boundingSphere; }
 
 private:
 	// a non-owning pointer to the Model
 	const Model& m_model;
 	// model matrix (translation + scale)
 	glm::mat4 m_modelMatrix;
+	// transforms normals: inverse transpose of the upper 3x3 of the model matrix
+	glm::mat3 m_normalMatrix;
+	// world-space bounds of the instance
+	BoundingSphere m_boundingSphere;
+};
+
+// StaticBatch pre-transforms static instances of a Model to world space
+// and merges them into one Mesh per Model Mesh (i.e. per material if the Model is batched).
+// All instances are then rendered with a single draw call per Mesh.
+class StaticBatch
+{
+public:
+	StaticBatch(const Model& model, const vector<glm::mat4>& modelMatrices);
+
+	// Record the draws of the Meshes with textured or untextured Materials
+	void recordDraws(const UniformSlots& drawData, size_t& slot, const MaterialTable& materials,
+		bool textured, CommandBuffer& commands) const;
+	// Render positions only; the model matrix goes to the given uniform location
+	void renderDepth(GLint modelLocation) const;
+
+	const Model& model() const { return m_model; }
+	size_t numMeshes() const { return m_meshes.size(); }
+	// CPU copy of the merged geometry in world space; only until releaseGeometry
+	const MeshGeometry& geometry(size_t mesh) const { return m_geometry[mesh]; }
+	void releaseGeometry() { vector<MeshGeometry>().swap(m_geometry); }
+	// Drop the merged Meshes, as Model::releaseMeshes
+	void releaseMeshes() { for (auto& mesh : m_meshes) mesh.reset(); }
+	// Ranges of individual instances inside a merged Mesh
+	const vector<SubMesh>& subMeshes(size_t mesh) const { return m_subMeshes[mesh]; }
+	// world-space bounds of all instances
+	const BoundingSphere& boundingSphere() const { return m_boundingSphere; }
+
+private:
+	// a non-owning pointer to the Model that provides materials
+	const Model& m_model;
+	// one merged Mesh for each Mesh of the Model
+	vector<MeshHandle> m_meshes;
+	vector<MeshGeometry> m_geometry;
+	vector<vector<SubMesh>> m_subMeshes;
+	BoundingSphere m_boundingSphere;
 };
 
 
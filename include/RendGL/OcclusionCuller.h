@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// OcclusionCuller rasterizes occluder triangles into a low-resolution depth buffer
+// on the CPU and tests the screen-space bounds of objects against it.
+// The buffer stores 1/w, which is linear in screen space; 0 means empty.
+// A coarse level keeps the farthest depth of each 8x8 tile, so most tests
+// are decided per tile. Rows of tiles are rasterized on several threads,
+// four pixels at a time where SIMD is available. The test is conservative:
+// an object is only reported as occluded if it is hidden at every pixel it may cover.
+// Occluders crossing the near plane are clipped against it, so e.g. a floor
+// reaching behind the camera still hides what is below it.
+class OcclusionCuller
+{
+public:
+    // width must be a multiple of 4; width and height are rounded up to whole tiles
+    OcclusionCuller(int width = 256, int height = 128);
+
+    // Add world-space occluder triangles, e.g. of a low-poly proxy of a large static object
+    void addOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices);
+    void clearOccluders();
+    size_t numOccluderTriangles() const { return m_triangles.size() / 3; }
+
+    // Rasterize all occluders for the camera
+    void render(const glm::mat4& viewProjection);
+
+    // True if the world-space box is hidden behind the occluders
+    bool isOccluded(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+    bool isOccluded(const BoundingSphere& sphere) const;
+
+    static constexpr int TILE_SIZE = 8;
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    // 1/w at a pixel, 0 if no occluder covers it
+    GLfloat depth(int x, int y) const { return m_depth[size_t(y) * m_width + x]; }
+
+private:
+    // Occluder vertex after projection: pixel coordinates and 1/w
+    struct ScreenVertex
+    {
+        GLfloat x, y, invW;
+    };
+
+    // Clip an occluder triangle against the near plane and project the 0-2 resulting triangles
+    void clipTriangle(size_t triangle);
+    ScreenVertex toScreen(const glm::vec4& clip) const;
+    void rasterizeTileRows(int firstTileRow, int lastTileRow);
+    void rasterizeTriangle(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2,
+        int rowBegin, int rowEnd);
+    void updateTiles(int firstTileRow, int lastTileRow);
+
+private:
+    int m_width, m_height;
+    int m_tilesX, m_tilesY;
+
+    // world-space occluder triangles, three vertices each
+    std::vector<glm::vec3> m_triangles;
+    // room for two clipped triangles for each occluder triangle
+    std::vector<ScreenVertex> m_screenVertices;
+    // number of clipped triangles of each occluder triangle
+    std::vector<uint8_t> m_numClipped;
+
+    glm::mat4 m_viewProjection;
+    std::vector<GLfloat> m_depth;
+    // farthest (smallest) 1/w of each tile
+    std::vector<GLfloat> m_tileDepth;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// OcclusionQueries asks the GPU whether any pixel of an object's bounding box
+// passes the depth test, so that expensive objects hidden behind others can be skipped.
+// Each object has a ring of queries, one per frame in flight. The results are consumed
+// a frame or more later, in one of two ways: readResults polls them without waiting
+// and updates isVisible on the CPU, or the previous frame's query is handed to
+// glBeginConditionalRender, so the GPU skips the draws without any readback.
+class OcclusionQueries
+{
+public:
+    // numFrames is the number of frames whose queries may be in flight at a time
+    OcclusionQueries(size_t numObjects, int numFrames = 3);
+    ~OcclusionQueries();
+    OcclusionQueries(const OcclusionQueries&) = delete;
+    OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+    // Take the newest available result of every object; never waits for the GPU
+    void readResults();
+
+    // Draw the world-space box of the object as a query, with the bound position-only shader.
+    // Color and depth writes should be off.
+    void query(size_t object, const glm::vec3& boxMin, const glm::vec3& boxMax, GLint modelLocation);
+    // Treat the object as visible without a query, e.g. when the camera is inside its box
+    void markVisible(size_t object);
+    // Queries after this call belong to the next frame
+    void endFrame();
+
+    // Result of the newest finished query; objects are visible until a query says otherwise
+    bool isVisible(size_t object) const { return m_visible[object] != 0; }
+    // Query issued for the object in the previous frame, 0 if there is none
+    GLuint lastQuery(size_t object) const { return m_lastQuery[object]; }
+    size_t size() const { return m_visible.size(); }
+
+private:
+    GLuint& queryAt(size_t object, size_t frame) { return m_queries[object * m_numFrames + frame % m_numFrames]; }
+
+private:
+    size_t m_numFrames;
+    size_t m_frame{ 0 };
+
+    // numFrames queries per object
+    std::vector<GLuint> m_queries;
+    // for each query, whether it was issued and its result is not read yet
+    std::vector<char> m_pending;
+    std::vector<char> m_visible;
+    std::vector<GLuint> m_lastQuery;
+
+    // cube from -1 to 1, scaled to the boxes
+    Mesh m_box;
+};
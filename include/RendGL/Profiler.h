@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Profiler records named zones of code, i.e. when they started and how long they took,
+// on all threads, and writes them as a Chrome trace for chrome://tracing or ui.perfetto.dev.
+// Zones are marked with PROFILE_ZONE("Class::method") at the start of a block.
+//
+// Each thread writes its zones to its own ring buffer without locks; the ring keeps the
+// last ZONES_PER_THREAD zones of the thread. Time is taken from std::chrono::steady_clock.
+// Recording is off until start(), so an instrumented build costs a flag test per zone.
+// Building without RENDGL_PROFILER removes the zones altogether.
+class Profiler
+{
+public:
+    static constexpr size_t ZONES_PER_THREAD = size_t(1) << 16;
+
+    // Record the zones that start from now on, on all threads
+    static void start();
+    static void stop();
+    static bool isRecording() { return s_recording.load(std::memory_order_relaxed); }
+
+    // Name that the trace shows for the calling thread, e.g. "Main"
+    static void setThreadName(const std::string& name);
+
+    // Write the zones recorded since the last start() that are still in the rings
+    // as Chrome trace JSON. Zones may be recorded meanwhile; those are left out.
+    static void writeChromeTrace(const std::string& fileName);
+
+    // Nanoseconds since the start of the program
+    static uint64_t now();
+    // Add a zone of the calling thread; name must live as long as the program
+    static void record(const char* name, uint64_t start, uint64_t end);
+
+    // A track shows zones that belong to no thread, e.g. work of the GPU.
+    // Only one thread at a time may record to a track. Tracks live as long as the program.
+    struct Track;
+    static Track* addTrack(const std::string& name);
+    static void record(Track* track, const char* name, uint64_t start, uint64_t end);
+
+    // Copy of a name made at run time that lives as long as the program
+    static const char* internName(const std::string& name);
+
+private:
+    inline static std::atomic<bool> s_recording{ false };
+};
+
+// ProfileZone records the time from its construction to its destruction
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char* name) :
+        m_name(Profiler::isRecording() ? name : nullptr),
+        m_start(m_name ? Profiler::now() : 0)
+    {}
+    ~ProfileZone()
+    {
+        if (m_name)
+            Profiler::record(m_name, m_start, Profiler::now());
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* m_name;
+    uint64_t m_start;
+};
+
+#ifdef RENDGL_PROFILER
+#define PROFILE_ZONE_CONCAT_(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#endif
@@ -4,16 +4,28 @@
 #include <string>
 
 class EventContainer;
+class GpuProfiler;
 
 using namespace std;
 
+// Scene is updated and rendered in two phases. update advances the simulation
+// and publishes a snapshot of the scene state; render draws the newest snapshot.
+// update makes no OpenGL calls, so it may run on another thread (see SimulationThread)
+// while render submits the previous frame.
 class Scene
 {
 public:
-	// Get fresh events and render the scene
-	virtual void render(const EventContainer & events) = 0;
+	// Process the events of a frame and publish the resulting scene state
+	virtual void update(const EventContainer& events) = 0;
+	// Draw the newest published state. Call on the thread of the OpenGL context.
+	virtual void render() = 0;
+	// Update and render one frame on the calling thread
+	void render(const EventContainer& events) { update(events); render(); }
 	virtual ~Scene() = 0;
 
+	// GPU times of the render passes of recent frames, nullptr if the scene does not measure them
+	virtual const GpuProfiler* gpuProfiler() const { return nullptr; }
+
 	// Factory that loads a scene from a file
 	static std::unique_ptr<Scene> loadScene(const std::string& fileName);
 };
@@ -1,35 +1,156 @@
 #pragma once
 
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <GL/glew.h>
 
+// Preprocessor definitions that specialize a shader, e.g. {"SPOT_LIGHT", "1"}.
+// Ordered, so that equal sets of defines always give the same key.
+using ShaderDefines = std::map<std::string, std::string>;
+
+// GLSL code of a vertex and a fragment shader
+struct ShaderSource
+{
+    std::string vertex;
+    std::string fragment;
+};
+
+// Read a pair of shader files. An #include "file" line is replaced with the code
+// of that file, relative to the including one, e.g. for code that several shaders share.
+ShaderSource readShaderSource(const std::string& vertexShaderFile,
+    const std::string& fragmentShaderFile);
+
+// SPIR-V modules of a vertex and a fragment shader
+struct SpirvSource
+{
+    std::vector<char> vertex;
+    std::vector<char> fragment;
+};
+
+// Check if the driver accepts SPIR-V modules (GL 4.6 or ARB_gl_spirv)
+bool spirvSupported();
+
+// Read the SPIR-V modules that the offline build step compiled from a pair of shader files
+// (see RENDGL_SPIRV_SHADERS). Returns false if a module is missing.
+bool readSpirvSource(const std::string& vertexShaderFile,
+    const std::string& fragmentShaderFile, SpirvSource& source);
+
+// Insert "#define NAME VALUE" lines after the #version line of the shader code
+std::string specializeShaderCode(const std::string& shaderCode, const ShaderDefines& defines);
+
+// Unique string for a set of defines, e.g. "SPOT_LIGHT=1;TEXTURED=0"
+std::string shaderDefinesKey(const ShaderDefines& defines);
+
+// File name of a cached program binary: a hash of the (specialized) shader code
+// and of the driver that compiled it, e.g. vendor, renderer and GL version
+std::string programBinaryName(const ShaderSource& source, const std::string& driver);
 
 // ShaderProgram loads shader glsl code and compiles it on the GPU.
 // It then serves as a handle for the shader variables.
+// Where the driver supports it, linked programs are cached as binaries in SHADER_CACHE_DIR
+// and reloaded on the next start instead of being compiled again.
 class ShaderProgram
 {
 public:
-    ShaderProgram(const std::string& vertexShaderFile, const std::string& fragmentShaderFile);
+    // Immediate: the constructor waits for the compiler and throws on errors.
+    // Deferred: the constructor only submits the code. The driver may compile it
+    // in the background (KHR_parallel_shader_compile) until finish() is called.
+    enum class CompileMode { Immediate, Deferred };
+
+    ShaderProgram(const std::string& vertexShaderFile, const std::string& fragmentShaderFile,
+        const ShaderDefines& defines = {});
+    ShaderProgram(const ShaderSource& source, const ShaderDefines& defines = {},
+        CompileMode mode = CompileMode::Immediate);
+    // Skip GLSL compilation: specialize precompiled modules and link them.
+    // Uniforms of such programs have no names, only the locations set in the shader.
+    explicit ShaderProgram(const SpirvSource& source);
+    // Compute shader program (GL 4.3 or ARB_compute_shader)
+    explicit ShaderProgram(const std::string& computeShaderFile);
     ~ShaderProgram();
 
     void activateShader() const { glUseProgram(m_programID); }
     GLuint id() const { return m_programID; }
+    bool isSpirv() const { return m_spirv; }
+
+    // A deferred program must be finished before it is used
+    bool isPending() const { return m_pending; }
+    // Check without blocking if finish() would return right away
+    bool isReady() const;
+    // Wait for a deferred program and check it for errors
+    void finish();
     
 private:
-    std::string readShaderCode(const std::string& filename);
-
-    void createProgram(const std::string & vShader,
+    // compile and link shader code on GPU without waiting for the result
+    void submitProgram(const std::string & vShader,
                       const std::string & fShader);
-    // compile shader code on GPU
     void compileShader(const std::string & shaderCode, GLenum shaderType);
+    void specializeShader(const std::vector<char>& module, GLenum shaderType);
 
-    void linkProgram();
     void validateProgram();
+
+    // Returns false if there is no cached binary or the driver rejects it
+    bool loadProgramBinary(const std::string& fileName);
+    void saveProgramBinary(const std::string& fileName) const;
     
     // free memory on GPU
+    void deleteShaders();
     void deleteProgram();
    
 private:
     GLuint m_programID{0};
+    // shaders of a program that is not finished yet
+    std::vector<GLuint> m_shaders;
+    bool m_pending{false};
+    bool m_spirv{false};
+    // where to save the program binary once linked; empty if binaries are not supported
+    std::string m_binaryFile;
+};
+
+// Load a shader program from precompiled SPIR-V if the driver supports it
+// and the modules exist; otherwise compile the GLSL shader files in the given mode.
+// Only shaders without #define variants can be precompiled (see SPIRV_SHADERS_LIST).
+// Depth written by such a program may differ in the last bits from the depth of
+// the same position computed by a GLSL program, even with invariant gl_Position.
+std::unique_ptr<ShaderProgram> loadShaderProgram(const std::string& vertexShaderFile,
+    const std::string& fragmentShaderFile,
+    ShaderProgram::CompileMode mode = ShaderProgram::CompileMode::Immediate);
+
+// ShaderLibrary holds specialized variants of one shader source.
+// The source branches on #if FEATURE instead of uniforms; each set of defines
+// is compiled on first use and cached, so every variant is branch-free.
+class ShaderLibrary
+{
+public:
+    ShaderLibrary(const std::string& vertexShaderFile, const std::string& fragmentShaderFile);
+
+    // Submit all variants to the compiler before waiting for any of them,
+    // so that the driver can compile them in parallel.
+    // In the async mode, don't wait at all.
+    void precompile(const std::vector<ShaderDefines>& variants);
+
+    // In the async mode, variant() never waits for the compiler: until a variant is ready,
+    // it returns the fallback program. The fallback must use the same uniforms
+    // as the variants or a subset of them.
+    void enableAsyncCompilation(const std::string& fallbackVertexShaderFile,
+        const std::string& fallbackFragmentShaderFile, const ShaderDefines& fallbackDefines = {});
+
+    // Get the variant for the given defines, compile it if it is not cached yet
+    const ShaderProgram& variant(const ShaderDefines& defines);
+    size_t numVariants() const { return m_variants.size(); }
+
+private:
+    ShaderProgram& submit(const ShaderDefines& defines);
+
+private:
+    ShaderSource m_source;
+    // compiled right away; only set in the async mode
+    std::unique_ptr<ShaderProgram> m_fallback;
+    // defines key -> compiled variant
+    std::unordered_map<std::string, std::unique_ptr<ShaderProgram>> m_variants;
+    // variants by their defines, so that a lookup does not build the key
+    std::map<ShaderDefines, ShaderProgram*> m_variantsByDefines;
 };
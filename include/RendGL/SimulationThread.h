@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "Scene.h"
+#include "Utils.h"
+
+// SimulationThread runs Scene::update on its own thread, so that the update
+// of the next frame overlaps the submission of the current one:
+//     window.pollEvents();
+//     simulation.startUpdate(window.events());
+//     scene->render();
+// render draws whichever state was published last, which adds up to a frame of latency.
+// The first startUpdate waits for its update, so the first frame has a state to draw.
+class SimulationThread
+{
+public:
+    explicit SimulationThread(Scene& scene);
+    ~SimulationThread();
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // Wait for the previous update, then start the next one with a copy of the events.
+    // The first update is finished when this returns.
+    void startUpdate(const EventContainer& events);
+    // Wait until the last update is finished; rethrows an exception thrown by it
+    void waitForUpdate();
+
+private:
+    void loop();
+
+private:
+    Scene& m_scene;
+    // events of the pending update; only written while no update is running
+    EventContainer m_events;
+    bool m_pending{ false };
+    bool m_stopping{ false };
+    // an update was started before, so a state has been or is being published
+    bool m_started{ false };
+    std::exception_ptr m_exception;
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    // started last, once the other members are initialized
+    std::thread m_thread;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+// TripleBuffer hands values from one writer thread to one reader thread without locks.
+// The writer fills writeBuffer() and publishes it; the reader always gets the newest
+// published value. Each side owns one of the three buffers and the third is
+// swapped between them, so neither side ever waits for the other, and a value
+// stays unchanged while the reader uses it.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Buffer that the writer fills; it may hold an older value
+    T& writeBuffer() { return m_buffers[m_write]; }
+    // Hand the write buffer to the reader
+    void publish()
+    {
+        m_write = m_shared.exchange(m_write | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // True if a value was published since the last read
+    bool hasFresh() const { return (m_shared.load(std::memory_order_acquire) & FRESH) != 0; }
+    // Newest published value; stays valid and unchanged until the next call
+    const T& read()
+    {
+        if (hasFresh())
+            m_read = m_shared.exchange(m_read, std::memory_order_acq_rel) & INDEX;
+        return m_buffers[m_read];
+    }
+
+private:
+    static constexpr int INDEX = 3;
+    // set while the shared buffer holds a value that the reader has not seen
+    static constexpr int FRESH = 4;
+
+    std::array<T, 3> m_buffers{};
+    int m_write{ 0 };
+    int m_read{ 1 };
+    std::atomic<int> m_shared{ 2 };
+};
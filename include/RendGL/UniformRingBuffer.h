@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Slots of a frame's region, reserved with UniformRingBuffer::reserve.
+// Each slot starts at an offset that can be bound with glBindBufferRange.
+// Different threads may fill different slots, until the next flush of the buffer.
+struct UniformSlots
+{
+    char* data;
+    // offset of the first slot in the buffer
+    GLintptr offset;
+    GLsizeiptr slotSize;
+    size_t numSlots;
+
+    // Copy data to a slot and return its offset in the buffer
+    GLintptr write(size_t slot, const void* source, GLsizeiptr size) const;
+};
+
+// UniformRingBuffer streams per-draw uniforms to the GPU. It is one large uniform buffer
+// split into a region per frame in flight. During a frame, draw data is appended
+// to the frame's region and bound for each draw with glBindBufferRange.
+// A fence after the frame's last draw guards the region until the GPU has read it.
+// The buffer is mapped persistently with ARB_buffer_storage (GL 4.4),
+// otherwise the free part of the region is mapped unsynchronized until flush().
+class UniformRingBuffer
+{
+public:
+    // Up to maxFrameSize bytes (including alignment) can be appended per frame
+    UniformRingBuffer(GLsizeiptr maxFrameSize, int numFrames = 3);
+    ~UniformRingBuffer();
+    UniformRingBuffer(const UniformRingBuffer&) = delete;
+    UniformRingBuffer& operator=(const UniformRingBuffer&) = delete;
+
+    // Required alignment of the offsets bound with glBindBufferRange
+    static GLint offsetAlignment();
+
+    // Wait until the GPU is done with the next region and start writing to it
+    void beginFrame();
+    // Copy data to the frame's region and return its offset in the buffer
+    GLintptr append(const void* data, GLsizeiptr size);
+    // Reserve numSlots slots of at least slotSize bytes, to be filled by the caller
+    UniformSlots reserve(size_t numSlots, GLsizeiptr slotSize);
+    // Make the appended data visible to draws issued from now on.
+    // Appending after a flush is fine; another flush is then needed.
+    void flush();
+    // Fence the frame's region after its last draw
+    void endFrame();
+
+    // Bind appended data to a uniform block binding point
+    void bindRange(GLuint binding, GLintptr offset, GLsizeiptr size) const;
+
+    bool isPersistent() const { return m_persistentData != nullptr; }
+    GLuint id() const { return m_buffer; }
+
+private:
+    // map the free part of the frame's region (non-persistent mode)
+    void mapFreeRange();
+
+private:
+    GLuint m_buffer{ 0 };
+    GLsizeiptr m_frameSize;
+    int m_numFrames;
+    GLint m_alignment;
+
+    // current region and the offset of its free part
+    int m_frame{ 0 };
+    GLintptr m_head{ 0 };
+
+    // persistent mode: the whole buffer, mapped once
+    char* m_persistentData{ nullptr };
+    // non-persistent mode: mapped part of the frame's region and its offset in the region
+    char* m_mappedData{ nullptr };
+    GLintptr m_mappedOffset{ 0 };
+
+    // one fence per region, 0 if the region is free
+    std::vector<GLsync> m_fences;
+};
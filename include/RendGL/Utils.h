@@ -82,6 +82,11 @@ public:
     GLfloat aspectRatio() const { return m_aspectRatio; }
     void setAspectRatio(GLfloat aRatio) { m_aspectRatio = aRatio; }
 
+    // Size of the framebuffer in pixels; also updates the aspect ratio
+    void setBufferSize(int width, int height);
+    int bufferWidth() const { return m_bufferWidth; }
+    int bufferHeight() const { return m_bufferHeight; }
+
 private:
     // Tracks time elapsed between frames
     TimeTracker m_timeTracker;
@@ -94,6 +99,9 @@ private:
 
     // Current image aspect ratio
     GLfloat m_aspectRatio;
+
+    // Current framebuffer size
+    int m_bufferWidth, m_bufferHeight;
 };
 
 // TODO: prints a message to the console in the debug build only
@@ -1,16 +1,22 @@
 #pragma once
 
+#include "FlightRecorder.h"
+#include "Profiler.h"
 #include "Utils.h"
 
 // Window is a class that creates an actual application window and manages GLFW
 class Window
 {
 public:
+    // A window that is not visible still renders, e.g. for tests
     Window(int windowWidth = 600, int windowHeight = 800,
-        const std::string& windowName = "MyApp");
+        const std::string& windowName = "MyApp", bool visible = true);
     ~Window();
 
-    // Process GLFW input. Should be called at the start of the loop
+    // Start a new frame: process GLFW input, run the jobs queued for the main thread
+    // let the FrameArenas of the threads release the previous frame
+    // and end the frame of the AllocationAudit and the FlightRecorder.
+    // Should be called at the start of the loop
     void pollEvents();
 
     // Give access to all GLFW events processed during this frame,
@@ -18,7 +24,16 @@ public:
     const EventContainer& events() const { return m_events; }
 
     // Swap OpenGL buffers to update the window image
-    void swapBuffers() { glfwSwapBuffers(m_window); }
+    void swapBuffers()
+    {
+        PROFILE_ZONE("Window::swapBuffers");
+        FlightPhase phase("Window::swapBuffers");
+        glfwSwapBuffers(m_window);
+    }
+
+    // Wait for the display refresh on swap (on by default for most drivers).
+    // Turn off to measure how fast frames can actually be rendered.
+    void setVSync(bool enabled) { glfwSwapInterval(enabled ? 1 : 0); }
 
     // Check if the should close (e.g. "close" button was clicked)
     bool shouldClose() const { return glfwWindowShouldClose(m_window); }
@@ -44,6 +59,7 @@ private:
     GLFWwindow *m_window;
     int m_width, m_height;
     std::string m_name;
+    bool m_visible;
     
     // GLFW events processed during this frame,
     // e.g. key pressed, mouse moved, time elapsed.
@@ -0,0 +1,279 @@
+#include "AllocationAudit.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+namespace
+{
+    // Counters that the allocation hooks update. They are constant-initialized atomics,
+    // so they work before main and counting never allocates.
+    struct Counters
+    {
+        std::atomic<uint64_t> newCalls{ 0 };
+        std::atomic<uint64_t> newBytes{ 0 };
+        std::atomic<uint64_t> mallocCalls{ 0 };
+        std::atomic<uint64_t> mallocBytes{ 0 };
+
+        void add(bool isNew, size_t size)
+        {
+            (isNew ? newCalls : mallocCalls).fetch_add(1, std::memory_order_relaxed);
+            (isNew ? newBytes : mallocBytes).fetch_add(size, std::memory_order_relaxed);
+        }
+
+        AllocationStats load() const
+        {
+            return { newCalls.load(std::memory_order_relaxed), newBytes.load(std::memory_order_relaxed),
+                mallocCalls.load(std::memory_order_relaxed), mallocBytes.load(std::memory_order_relaxed) };
+        }
+    };
+
+    AllocationStats difference(const AllocationStats& a, const AllocationStats& b)
+    {
+        return { a.newCalls - b.newCalls, a.newBytes - b.newBytes,
+            a.mallocCalls - b.mallocCalls, a.mallocBytes - b.mallocBytes };
+    }
+
+    Counters totalCounters;
+
+    // totals at the start of the current frame, and the counts of the last frame
+    std::mutex frameMutex;
+    AllocationStats frameStart;
+    AllocationStats lastFrameStats;
+
+    // scopes live in a fixed table, so that entering one never allocates
+    constexpr int MAX_SCOPES = 64;
+    struct Scope
+    {
+        std::atomic<const char*> name{ nullptr };
+        Counters counters;
+    };
+    Scope scopes[MAX_SCOPES];
+    std::atomic<int> numScopes{ 0 };
+    std::mutex scopesMutex;
+
+    // innermost scope of the thread, -1 for none; a plain int needs no TLS initialization
+    thread_local int currentScope = -1;
+
+    int findScope(const char* name, bool create)
+    {
+        const int count = numScopes.load(std::memory_order_acquire);
+        for (int i = 0; i < count; i++)
+            if (std::strcmp(scopes[i].name.load(std::memory_order_relaxed), name) == 0)
+                return i;
+        if (!create)
+            return -1;
+
+        std::lock_guard<std::mutex> lock(scopesMutex);
+        // another thread may have added it in the meantime
+        const int locked = numScopes.load(std::memory_order_relaxed);
+        for (int i = count; i < locked; i++)
+            if (std::strcmp(scopes[i].name.load(std::memory_order_relaxed), name) == 0)
+                return i;
+        // scopes beyond the table are not counted separately
+        if (locked == MAX_SCOPES)
+            return -1;
+        scopes[locked].name.store(name, std::memory_order_relaxed);
+        numScopes.store(locked + 1, std::memory_order_release);
+        return locked;
+    }
+
+#ifdef RENDGL_ALLOCATION_AUDIT
+    void record(bool isNew, size_t size)
+    {
+        totalCounters.add(isNew, size);
+        const int scope = currentScope;
+        if (scope >= 0)
+            scopes[scope].counters.add(isNew, size);
+    }
+#endif
+}
+
+AllocationStats AllocationAudit::total()
+{
+    return totalCounters.load();
+}
+
+AllocationStats AllocationAudit::currentFrame()
+{
+    std::lock_guard<std::mutex> lock(frameMutex);
+    return difference(totalCounters.load(), frameStart);
+}
+
+AllocationStats AllocationAudit::lastFrame()
+{
+    std::lock_guard<std::mutex> lock(frameMutex);
+    return lastFrameStats;
+}
+
+void AllocationAudit::nextFrame()
+{
+    std::lock_guard<std::mutex> lock(frameMutex);
+    const AllocationStats now = totalCounters.load();
+    lastFrameStats = difference(now, frameStart);
+    frameStart = now;
+}
+
+AllocationStats AllocationAudit::scope(const char* name)
+{
+    const int scope = findScope(name, false);
+    return scope >= 0 ? scopes[scope].counters.load() : AllocationStats{};
+}
+
+std::vector<std::string> AllocationAudit::scopeNames()
+{
+    std::vector<std::string> names;
+    const int count = numScopes.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+        names.push_back(scopes[i].name.load(std::memory_order_relaxed));
+    return names;
+}
+
+#ifdef RENDGL_ALLOCATION_AUDIT
+
+AllocationScope::AllocationScope(const char* name) :
+    m_previous(currentScope)
+{
+    currentScope = findScope(name, true);
+}
+
+AllocationScope::~AllocationScope()
+{
+    currentScope = m_previous;
+}
+
+// ==============================================================================
+// ==============          ALLOCATION HOOKS          ============================
+// ==============================================================================
+
+#if defined(__GLIBC__)
+// glibc lets a program replace malloc and forward to its own implementation
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* pointer, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void* pointer);
+
+    void* malloc(size_t size) noexcept
+    {
+        record(false, size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) noexcept
+    {
+        record(false, count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* pointer, size_t size) noexcept
+    {
+        record(false, size);
+        return __libc_realloc(pointer, size);
+    }
+
+    void free(void* pointer) noexcept
+    {
+        __libc_free(pointer);
+    }
+}
+
+namespace
+{
+    // operator new bypasses the malloc hook, so that it is counted once
+    void* rawAllocate(size_t size) { return __libc_malloc(size); }
+    void* rawAllocateAligned(size_t size, size_t alignment) { return __libc_memalign(alignment, size); }
+    void rawFree(void* pointer) { __libc_free(pointer); }
+    void rawFreeAligned(void* pointer) { __libc_free(pointer); }
+}
+#elif defined(_WIN32)
+#include <malloc.h>
+namespace
+{
+    void* rawAllocate(size_t size) { return std::malloc(size); }
+    void* rawAllocateAligned(size_t size, size_t alignment) { return _aligned_malloc(size, alignment); }
+    void rawFree(void* pointer) { std::free(pointer); }
+    void rawFreeAligned(void* pointer) { _aligned_free(pointer); }
+}
+#else
+namespace
+{
+    void* rawAllocate(size_t size) { return std::malloc(size); }
+    void* rawAllocateAligned(size_t size, size_t alignment)
+    {
+        // aligned_alloc wants a multiple of the alignment
+        return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    }
+    void rawFree(void* pointer) { std::free(pointer); }
+    void rawFreeAligned(void* pointer) { std::free(pointer); }
+}
+#endif
+
+namespace
+{
+    void* countedNew(size_t size)
+    {
+        record(true, size);
+        void* pointer = rawAllocate(size > 0 ? size : 1);
+        if (!pointer)
+            throw std::bad_alloc();
+        return pointer;
+    }
+
+    void* countedNew(size_t size, std::align_val_t alignment)
+    {
+        record(true, size);
+        void* pointer = rawAllocateAligned(size > 0 ? size : 1, static_cast<size_t>(alignment));
+        if (!pointer)
+            throw std::bad_alloc();
+        return pointer;
+    }
+}
+
+void* operator new(size_t size) { return countedNew(size); }
+void* operator new[](size_t size) { return countedNew(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return countedNew(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return countedNew(size, alignment); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    record(true, size);
+    return rawAllocate(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    record(true, size);
+    return rawAllocate(size > 0 ? size : 1);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    record(true, size);
+    return rawAllocateAligned(size > 0 ? size : 1, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    record(true, size);
+    return rawAllocateAligned(size > 0 ? size : 1, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept { rawFree(pointer); }
+void operator delete[](void* pointer) noexcept { rawFree(pointer); }
+void operator delete(void* pointer, size_t) noexcept { rawFree(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { rawFree(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { rawFree(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { rawFree(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { rawFreeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { rawFreeAligned(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { rawFreeAligned(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { rawFreeAligned(pointer); }
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept { rawFreeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t&) noexcept { rawFreeAligned(pointer); }
+
+#endif
@@ -31,6 +31,29 @@ glm::mat4 Camera::viewMatrix() const
     return glm::lookAt(m_state.pos, m_state.pos + m_front, m_up); 
 }
 
+glm::mat4 Camera::projectionMatrix(GLfloat aspectRatio) const
+{
+    return glm::perspective(45.0f, aspectRatio, m_near, m_far);
+}
+
+glm::mat4 Camera::viewProjectionMatrix(GLfloat aspectRatio) const
+{
+    return projectionMatrix(aspectRatio) * viewMatrix();
+}
+
+std::array<glm::vec4, 6> Camera::frustumPlanes(GLfloat aspectRatio) const
+{
+    // Gribb-Hartmann: each plane is the 4th row of the matrix +- one of the other rows
+    glm::mat4 rows = glm::transpose(viewProjectionMatrix(aspectRatio));
+    std::array<glm::vec4, 6> planes = {
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[3] + rows[2], rows[3] - rows[2] };
+    for (auto& plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+    return planes;
+}
+
 
 void Camera::updatePosition(const glm::vec3& direction, GLfloat timeStep)
 {
@@ -0,0 +1,207 @@
+#include "Clusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RENDGL_USE_SSE
+#endif
+
+#include "JobSystem.h"
+
+LightClusters::LightClusters(int tilesX, int tilesY, int slices) :
+    m_tilesX(tilesX),
+    m_tilesY(tilesY),
+    m_slices(slices),
+    m_view(1.0f),
+    m_scaleX(1.0f),
+    m_scaleY(1.0f),
+    m_near(0.1f),
+    m_far(100.0f),
+    m_depthScale(0.0f),
+    m_depthBias(0.0f),
+    m_reach(0.0f),
+    m_clusters(size_t(tilesX) * tilesY * slices, ClusterRange{ 0, 0 })
+{}
+
+void LightClusters::build(const std::vector<LightSphere>& lights,
+    const glm::mat4& view, const glm::mat4& projection,
+    GLfloat near, GLfloat far)
+{
+    m_view = view;
+    m_scaleX = projection[0][0];
+    m_scaleY = projection[1][1];
+    m_near = near;
+    m_far = far;
+    m_depthScale = m_slices / std::log(far / near);
+    m_depthBias = -m_depthScale * std::log(near);
+    m_reach = far * std::sqrt(1.0f + 1.0f / (m_scaleX * m_scaleX) + 1.0f / (m_scaleY * m_scaleY));
+
+    // only needed during the build, so they live in the frame arena of the building thread
+    FrameVector<LightBounds> lightBounds(lights.size(), LightBounds{}, FrameArena::local());
+    parallelFor(lights.size(), 1024, [&](size_t first, size_t last) {
+        computeBounds(lights, first, last, lightBounds);
+    });
+
+    // every thread works on its own depth slices, so clusters are never shared
+    parallelFor(m_slices, 4, [&](size_t first, size_t last) {
+        countLights(lightBounds, int(first), int(last));
+    });
+
+    GLuint offset = 0;
+    for (auto& cluster : m_clusters)
+    {
+        cluster.offset = offset;
+        offset += cluster.count;
+    }
+    m_lightIndices.resize(offset);
+
+    parallelFor(m_slices, 4, [&](size_t first, size_t last) {
+        fillLights(lightBounds, int(first), int(last));
+    });
+}
+
+int LightClusters::slice(GLfloat depth) const
+{
+    if (depth <= m_near)
+        return 0;
+    int result = int(std::floor(std::log(depth) * m_depthScale + m_depthBias));
+    return std::clamp(result, 0, m_slices - 1);
+}
+
+LightClusters::LightExtents LightClusters::computeExtents(const LightSphere& light) const
+{
+    glm::vec4 center = m_view * glm::vec4(light.position, 1.0f);
+    // lights without attenuation have an infinite radius
+    const GLfloat radius = std::min(light.radius, glm::length(glm::vec3(center)) + m_reach);
+    GLfloat depth = -center.z;
+    GLfloat depthMin = std::max(m_near, depth - radius);
+    GLfloat depthMax = depth + radius;
+
+    // The view-space box around the sphere projects to its corners,
+    // so the extremes are reached at the nearest or the farthest depth
+    GLfloat xLow = center.x - radius, xHigh = center.x + radius;
+    GLfloat yLow = center.y - radius, yHigh = center.y + radius;
+    return LightExtents{
+        m_scaleX * std::min(xLow / depthMin, xLow / depthMax),
+        m_scaleX * std::max(xHigh / depthMin, xHigh / depthMax),
+        m_scaleY * std::min(yLow / depthMin, yLow / depthMax),
+        m_scaleY * std::max(yHigh / depthMin, yHigh / depthMax),
+        depthMin,
+        depthMax };
+}
+
+void LightClusters::computeBounds(const std::vector<LightSphere>& lights, size_t first, size_t last,
+    FrameVector<LightBounds>& lightBounds) const
+{
+    size_t i = first;
+#ifdef RENDGL_USE_SSE
+    // Same computation as in computeExtents, but for four lights at once
+    const __m128 nearPlane = _mm_set1_ps(m_near);
+    const __m128 scaleX = _mm_set1_ps(m_scaleX);
+    const __m128 scaleY = _mm_set1_ps(m_scaleY);
+    const __m128 reach = _mm_set1_ps(m_reach);
+    // rows of the view matrix, each element broadcast to all four lanes
+    __m128 viewRows[3][4];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            viewRows[r][c] = _mm_set1_ps(m_view[c][r]);
+    auto transform = [](const __m128* row, __m128 x, __m128 y, __m128 z) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[0], x), _mm_mul_ps(row[1], y)),
+            _mm_add_ps(_mm_mul_ps(row[2], z), row[3]));
+    };
+
+    for (; i + 4 <= last; i += 4)
+    {
+        const LightSphere* l = &lights[i];
+        __m128 x = _mm_setr_ps(l[0].position.x, l[1].position.x, l[2].position.x, l[3].position.x);
+        __m128 y = _mm_setr_ps(l[0].position.y, l[1].position.y, l[2].position.y, l[3].position.y);
+        __m128 z = _mm_setr_ps(l[0].position.z, l[1].position.z, l[2].position.z, l[3].position.z);
+        __m128 radius = _mm_setr_ps(l[0].radius, l[1].radius, l[2].radius, l[3].radius);
+
+        __m128 centerX = transform(viewRows[0], x, y, z);
+        __m128 centerY = transform(viewRows[1], x, y, z);
+        __m128 depth = _mm_sub_ps(_mm_setzero_ps(), transform(viewRows[2], x, y, z));
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, centerX),
+            _mm_mul_ps(centerY, centerY)), _mm_mul_ps(depth, depth)));
+        radius = _mm_min_ps(radius, _mm_add_ps(distance, reach));
+        __m128 depthMin = _mm_max_ps(nearPlane, _mm_sub_ps(depth, radius));
+        __m128 depthMax = _mm_add_ps(depth, radius);
+
+        __m128 xLow = _mm_sub_ps(centerX, radius), xHigh = _mm_add_ps(centerX, radius);
+        __m128 yLow = _mm_sub_ps(centerY, radius), yHigh = _mm_add_ps(centerY, radius);
+
+        alignas(16) float result[6][4];
+        _mm_store_ps(result[0], _mm_mul_ps(scaleX,
+            _mm_min_ps(_mm_div_ps(xLow, depthMin), _mm_div_ps(xLow, depthMax))));
+        _mm_store_ps(result[1], _mm_mul_ps(scaleX,
+            _mm_max_ps(_mm_div_ps(xHigh, depthMin), _mm_div_ps(xHigh, depthMax))));
+        _mm_store_ps(result[2], _mm_mul_ps(scaleY,
+            _mm_min_ps(_mm_div_ps(yLow, depthMin), _mm_div_ps(yLow, depthMax))));
+        _mm_store_ps(result[3], _mm_mul_ps(scaleY,
+            _mm_max_ps(_mm_div_ps(yHigh, depthMin), _mm_div_ps(yHigh, depthMax))));
+        _mm_store_ps(result[4], depthMin);
+        _mm_store_ps(result[5], depthMax);
+
+        for (int k = 0; k < 4; k++)
+            lightBounds[i + k] = toClusterBounds(LightExtents{ result[0][k], result[1][k],
+                result[2][k], result[3][k], result[4][k], result[5][k] });
+    }
+#endif
+    for (; i < last; i++)
+        lightBounds[i] = toClusterBounds(computeExtents(lights[i]));
+}
+
+LightClusters::LightBounds LightClusters::toClusterBounds(const LightExtents& extents) const
+{
+    const LightBounds empty{ 0, -1, 0, -1, 0, -1 };
+    // behind the camera, beyond the far plane or outside of the side planes
+    if (extents.depthMax < m_near || extents.depthMin > m_far ||
+        extents.xMax < -1.0f || extents.xMin > 1.0f ||
+        extents.yMax < -1.0f || extents.yMin > 1.0f)
+        return empty;
+
+    // extents of lights that reach close to the eye are far outside of the screen
+    auto tile = [](GLfloat ndc, int numTiles) {
+        ndc = std::clamp(ndc, -1.0f, 1.0f);
+        int result = int(std::floor((ndc + 1.0f) * 0.5f * numTiles));
+        return std::clamp(result, 0, numTiles - 1);
+    };
+
+    return LightBounds{
+        tile(extents.xMin, m_tilesX), tile(extents.xMax, m_tilesX),
+        tile(extents.yMin, m_tilesY), tile(extents.yMax, m_tilesY),
+        slice(extents.depthMin), slice(std::min(extents.depthMax, m_far)) };
+}
+
+void LightClusters::countLights(const FrameVector<LightBounds>& lightBounds, int firstSlice, int lastSlice)
+{
+    for (size_t c = clusterIndex(0, 0, firstSlice); c < clusterIndex(0, 0, lastSlice); c++)
+        m_clusters[c].count = 0;
+
+    for (const auto& bounds : lightBounds)
+        for (int z = std::max(bounds.z0, firstSlice); z <= std::min(bounds.z1, lastSlice - 1); z++)
+            for (int y = bounds.y0; y <= bounds.y1; y++)
+                for (int x = bounds.x0; x <= bounds.x1; x++)
+                    m_clusters[clusterIndex(x, y, z)].count++;
+}
+
+void LightClusters::fillLights(const FrameVector<LightBounds>& lightBounds, int firstSlice, int lastSlice)
+{
+    // count is used as a write cursor and ends up with its previous value
+    for (size_t c = clusterIndex(0, 0, firstSlice); c < clusterIndex(0, 0, lastSlice); c++)
+        m_clusters[c].count = 0;
+
+    for (GLuint i = 0; i < lightBounds.size(); i++)
+    {
+        const auto& bounds = lightBounds[i];
+        for (int z = std::max(bounds.z0, firstSlice); z <= std::min(bounds.z1, lastSlice - 1); z++)
+            for (int y = bounds.y0; y <= bounds.y1; y++)
+                for (int x = bounds.x0; x <= bounds.x1; x++)
+                {
+                    auto& cluster = m_clusters[clusterIndex(x, y, z)];
+                    m_lightIndices[cluster.offset + cluster.count++] = i;
+                }
+    }
+}
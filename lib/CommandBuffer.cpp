@@ -0,0 +1,218 @@
+#include "CommandBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "GpuProfiler.h"
+#include "Light.h"
+#include "Model.h"
+
+namespace
+{
+    constexpr size_t COMMAND_ALIGNMENT = 8;
+
+    size_t paddedSize(size_t size)
+    {
+        return (size + COMMAND_ALIGNMENT - 1) / COMMAND_ALIGNMENT * COMMAND_ALIGNMENT;
+    }
+}
+
+// ==============================================================================
+// ==============          COMMAND BUFFER CLASS     =============================
+// ==============================================================================
+
+void CommandBuffer::setDrawData(GLintptr offset)
+{
+    write(Type::DrawData, &offset, sizeof(offset));
+}
+
+void CommandBuffer::setInstanceLights(const GLint* lights, int numLights)
+{
+    if (numLights < 0)
+        throw std::runtime_error("CommandBuffer: negative number of lights");
+    write(Type::InstanceLights, lights, numLights * sizeof(GLint));
+}
+
+void CommandBuffer::setCondition(GLuint query)
+{
+    write(Type::Condition, &query, sizeof(query));
+}
+
+void CommandBuffer::draw(const Mesh& mesh)
+{
+    const Mesh* pointer = &mesh;
+    write(Type::Draw, &pointer, sizeof(pointer));
+}
+
+void CommandBuffer::beginGpuScope(const char* name)
+{
+    write(Type::BeginGpuScope, &name, sizeof(name));
+}
+
+void CommandBuffer::endGpuScope()
+{
+    write(Type::EndGpuScope, nullptr, 0);
+}
+
+void CommandBuffer::clear()
+{
+    m_data.clear();
+    m_numCommands = 0;
+}
+
+void CommandBuffer::write(Type type, const void* payload, size_t size)
+{
+    const Header header{ type, uint32_t(size) };
+    const size_t offset = m_data.size();
+    // the vector grows geometrically, so a buffer that is reused stops allocating
+    m_data.resize(offset + sizeof(Header) + paddedSize(size));
+    std::memcpy(&m_data[offset], &header, sizeof(Header));
+    if (size > 0)
+        std::memcpy(&m_data[offset + sizeof(Header)], payload, size);
+    m_numCommands++;
+}
+
+// ==============================================================================
+// ==============          GL COMMAND BACKEND CLASS     =========================
+// ==============================================================================
+
+GLCommandBackend::GLCommandBackend(GLuint drawDataBuffer, GLuint drawDataBinding,
+    const LightManager& lights, GLuint shader, GpuProfiler* gpuProfiler) :
+    m_drawDataBuffer(drawDataBuffer),
+    m_drawDataBinding(drawDataBinding),
+    m_lights(lights),
+    m_shader(shader),
+    m_gpuProfiler(gpuProfiler)
+{
+}
+
+void GLCommandBackend::bindDrawData(GLintptr offset)
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, m_drawDataBinding, m_drawDataBuffer, offset, sizeof(DrawData));
+}
+
+void GLCommandBackend::setInstanceLights(const GLint* lights, int numLights)
+{
+    m_lights.talkAboutInstanceLights(m_shader, lights, numLights);
+}
+
+void GLCommandBackend::beginCondition(GLuint query)
+{
+    // without a result yet, the draws go ahead
+    glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+}
+
+void GLCommandBackend::endCondition()
+{
+    glEndConditionalRender();
+}
+
+void GLCommandBackend::draw(const Mesh& mesh)
+{
+    mesh.render();
+}
+
+void GLCommandBackend::beginGpuScope(const char* name)
+{
+    if (m_gpuProfiler)
+        m_gpuProfiler->beginScope(name);
+}
+
+void GLCommandBackend::endGpuScope()
+{
+    if (m_gpuProfiler)
+        m_gpuProfiler->endScope();
+}
+
+// ==============================================================================
+// ==============          COMMAND REPLAYER CLASS     ===========================
+// ==============================================================================
+
+void CommandReplayer::execute(const CommandBuffer& commands)
+{
+    const unsigned char* data = commands.m_data.data();
+    const unsigned char* end = data + commands.m_data.size();
+    while (data < end)
+    {
+        CommandBuffer::Header header;
+        std::memcpy(&header, data, sizeof(header));
+        const unsigned char* payload = data + sizeof(header);
+        data = payload + paddedSize(header.size);
+
+        switch (header.type)
+        {
+        case CommandBuffer::Type::DrawData:
+        {
+            GLintptr offset;
+            std::memcpy(&offset, payload, sizeof(offset));
+            if (m_hasDrawData && offset == m_drawData)
+            {
+                m_numFiltered++;
+                break;
+            }
+            m_hasDrawData = true;
+            m_drawData = offset;
+            m_backend.bindDrawData(offset);
+            break;
+        }
+        case CommandBuffer::Type::InstanceLights:
+        {
+            const size_t numLights = header.size / sizeof(GLint);
+            const GLint* lights = reinterpret_cast<const GLint*>(payload);
+            if (m_hasLights && m_lights.size() == numLights &&
+                std::equal(m_lights.begin(), m_lights.end(), lights))
+            {
+                m_numFiltered++;
+                break;
+            }
+            m_hasLights = true;
+            m_lights.assign(lights, lights + numLights);
+            m_backend.setInstanceLights(m_lights.data(), int(numLights));
+            break;
+        }
+        case CommandBuffer::Type::Condition:
+        {
+            GLuint query;
+            std::memcpy(&query, payload, sizeof(query));
+            if (query == m_condition)
+            {
+                m_numFiltered++;
+                break;
+            }
+            if (m_condition != 0)
+                m_backend.endCondition();
+            m_condition = query;
+            if (m_condition != 0)
+                m_backend.beginCondition(m_condition);
+            break;
+        }
+        case CommandBuffer::Type::Draw:
+        {
+            const Mesh* mesh;
+            std::memcpy(&mesh, payload, sizeof(mesh));
+            m_backend.draw(*mesh);
+            break;
+        }
+        case CommandBuffer::Type::BeginGpuScope:
+        {
+            const char* name;
+            std::memcpy(&name, payload, sizeof(name));
+            m_backend.beginGpuScope(name);
+            break;
+        }
+        case CommandBuffer::Type::EndGpuScope:
+            m_backend.endGpuScope();
+            break;
+        }
+    }
+}
+
+void CommandReplayer::finish()
+{
+    if (m_condition != 0)
+        m_backend.endCondition();
+    m_condition = 0;
+    m_hasDrawData = false;
+    m_hasLights = false;
+}
@@ -0,0 +1,61 @@
+#include "DrawBundle.h"
+
+#include <stdexcept>
+
+#include "FlightRecorder.h"
+
+DrawBundle::~DrawBundle()
+{
+    if (m_buffer != 0)
+        glDeleteBuffers(1, &m_buffer);
+}
+
+UniformSlots DrawBundle::begin(size_t numSlots, GLsizeiptr slotSize)
+{
+    if (m_recording)
+        throw std::runtime_error("DrawBundle: already recording");
+    invalidate();
+    m_recording = true;
+
+    const GLint alignment = UniformRingBuffer::offsetAlignment();
+    slotSize = (slotSize + alignment - 1) / alignment * alignment;
+    m_stagingData.assign(numSlots * slotSize, 0);
+    return { m_stagingData.data(), 0, slotSize, numSlots };
+}
+
+void DrawBundle::end()
+{
+    if (!m_recording)
+        throw std::runtime_error("DrawBundle: end without begin");
+    m_recording = false;
+    FlightEvent event("upload", "draw bundle");
+
+    if (!m_stagingData.empty())
+    {
+        if (m_buffer == 0)
+            glGenBuffers(1, &m_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, m_stagingData.size(), m_stagingData.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    // the GPU copy is all that is needed from now on
+    std::vector<char>().swap(m_stagingData);
+    m_recorded = true;
+}
+
+void DrawBundle::invalidate()
+{
+    m_commands.clear();
+    m_recorded = false;
+}
+
+void DrawBundle::replay(GLuint drawDataBinding, const LightManager& lights, GLuint shader,
+    GpuProfiler* gpuProfiler) const
+{
+    if (!m_recorded)
+        throw std::runtime_error("DrawBundle: replay before the bundle was recorded");
+    GLCommandBackend backend(m_buffer, drawDataBinding, lights, shader, gpuProfiler);
+    CommandReplayer replayer(backend);
+    replayer.execute(m_commands);
+    replayer.finish();
+}
@@ -0,0 +1,256 @@
+#include "FlightRecorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "Profiler.h"
+#include "Utils.h"
+
+namespace
+{
+    void writeEscaped(std::ostream& output, const char* text)
+    {
+        for (; *text; text++)
+        {
+            if (*text == '"' || *text == '\\')
+                output << '\\';
+            // control characters are not valid in JSON strings
+            output << (static_cast<unsigned char>(*text) < 0x20 ? ' ' : *text);
+        }
+    }
+
+    double milliseconds(uint64_t nanoseconds)
+    {
+        return double(nanoseconds) / 1.0e6;
+    }
+}
+
+FlightRecorder::FlightRecorder(size_t numFrames, size_t numEvents) :
+    m_frames(numFrames),
+    m_events(numEvents)
+{
+    if (numFrames == 0 || numEvents == 0)
+        throw std::runtime_error("FlightRecorder: needs room for frames and events");
+    m_dump.frames.resize(numFrames);
+    m_dump.events.resize(numEvents);
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    waitForDump();
+}
+
+FlightRecorder& FlightRecorder::shared()
+{
+    // the recorder waits for its dump job, so the job system has to outlive it
+    JobSystem::shared();
+    static FlightRecorder recorder;
+    return recorder;
+}
+
+void FlightRecorder::nextFrame()
+{
+    const uint64_t now = Profiler::now();
+    if (m_started)
+    {
+        FrameRecord& frame = m_frames[m_numFrames % m_frames.size()];
+        frame.index = m_numFrames;
+        frame.start = m_frameStart;
+        frame.duration = now - m_frameStart;
+        for (size_t phase = 0; phase < MAX_PHASES; phase++)
+            frame.phases[phase] = m_phaseTimes[phase].exchange(0, std::memory_order_relaxed);
+        m_numFrames++;
+
+        if (m_spikeThreshold > 0 && frame.duration > m_spikeThreshold && !m_dumpPending)
+        {
+            m_dumpPending = true;
+            m_spikeFrame = frame.index;
+            m_dumpFrame = m_numFrames + m_framesAfterSpike;
+        }
+        // a snapshot that is still being written delays the next one
+        if (m_dumpPending && m_numFrames >= m_dumpFrame && m_dumpGroup.isDone())
+            startDump();
+    }
+    m_started = true;
+    m_frameStart = now;
+}
+
+void FlightRecorder::addPhaseTime(const char* name, uint64_t nanoseconds)
+{
+    const int phase = phaseIndex(name);
+    if (phase >= 0)
+        m_phaseTimes[phase].fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+void FlightRecorder::addEvent(const char* category, const std::string& text, uint64_t start, uint64_t duration)
+{
+    std::lock_guard<std::mutex> lock(m_eventMutex);
+    EventRecord& event = m_events[m_numEvents % m_events.size()];
+    event.category = category;
+    event.start = start;
+    event.duration = duration;
+    const size_t length = std::min(text.size(), EVENT_TEXT_SIZE - 1);
+    std::memcpy(event.text, text.data(), length);
+    event.text[length] = '\0';
+    m_numEvents++;
+}
+
+void FlightRecorder::writeSnapshot(const std::string& fileName)
+{
+    Snapshot snapshot;
+    snapshot.frames.resize(m_frames.size());
+    snapshot.events.resize(m_events.size());
+    takeSnapshot(snapshot);
+    writeTrace(snapshot, fileName);
+}
+
+void FlightRecorder::waitForDump()
+{
+    JobSystem::shared().wait(m_dumpGroup);
+}
+
+int FlightRecorder::phaseIndex(const char* name)
+{
+    const int count = m_numPhases.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+        if (std::strcmp(m_phaseNames[i].load(std::memory_order_relaxed), name) == 0)
+            return i;
+
+    std::lock_guard<std::mutex> lock(m_phaseMutex);
+    const int locked = m_numPhases.load(std::memory_order_relaxed);
+    for (int i = count; i < locked; i++)
+        if (std::strcmp(m_phaseNames[i].load(std::memory_order_relaxed), name) == 0)
+            return i;
+    if (locked == int(MAX_PHASES))
+        return -1;
+    m_phaseNames[locked].store(name, std::memory_order_relaxed);
+    m_numPhases.store(locked + 1, std::memory_order_release);
+    return locked;
+}
+
+void FlightRecorder::takeSnapshot(Snapshot& snapshot)
+{
+    // oldest first
+    snapshot.numFrames = std::min(m_numFrames, m_frames.size());
+    for (size_t i = 0; i < snapshot.numFrames; i++)
+        snapshot.frames[i] = m_frames[(m_numFrames - snapshot.numFrames + i) % m_frames.size()];
+
+    {
+        std::lock_guard<std::mutex> lock(m_eventMutex);
+        snapshot.numEvents = std::min(m_numEvents, m_events.size());
+        for (size_t i = 0; i < snapshot.numEvents; i++)
+            snapshot.events[i] = m_events[(m_numEvents - snapshot.numEvents + i) % m_events.size()];
+    }
+
+    const int numPhases = m_numPhases.load(std::memory_order_acquire);
+    for (int i = 0; i < int(MAX_PHASES); i++)
+        snapshot.phaseNames[i] = i < numPhases ? m_phaseNames[i].load(std::memory_order_relaxed) : nullptr;
+    snapshot.spikeThreshold = m_spikeThreshold;
+}
+
+void FlightRecorder::startDump()
+{
+    m_dumpPending = false;
+    takeSnapshot(m_dump);
+    m_dump.hasSpike = true;
+    m_dump.spikeFrame = m_spikeFrame;
+    const std::string fileName = m_dumpDirectory + "/flightRecorder_" + std::to_string(m_spikeFrame) + ".json";
+    JobSystem::shared().run(m_dumpGroup, [this, fileName]() {
+        try
+        {
+            writeTrace(m_dump, fileName);
+            m_numDumps++;
+            debugOutput("Frame time spike, wrote " + fileName);
+        }
+        catch (const std::exception& exception)
+        {
+            debugOutput(exception.what());
+        }
+    });
+}
+
+void FlightRecorder::writeTrace(const Snapshot& snapshot, const std::string& fileName) const
+{
+    std::ofstream output(fileName);
+    if (!output.is_open())
+        throw std::runtime_error("FlightRecorder: failed to open " + fileName);
+    output << std::fixed << std::setprecision(3);
+
+    // frames and events on their own tracks; Chrome traces count in microseconds
+    output << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"spikeThresholdMs\":"
+           << milliseconds(snapshot.spikeThreshold);
+    if (snapshot.hasSpike)
+        output << ",\"spikeFrame\":" << snapshot.spikeFrame;
+    output << "},\"traceEvents\":[\n"
+           << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Frames\"}},\n"
+           << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"Events\"}}";
+
+    for (size_t i = 0; i < snapshot.numFrames; i++)
+    {
+        const FrameRecord& frame = snapshot.frames[i];
+        std::ostringstream phases;
+        phases << std::fixed << std::setprecision(3);
+        for (size_t phase = 0; phase < MAX_PHASES && snapshot.phaseNames[phase]; phase++)
+        {
+            phases << (phase == 0 ? "" : ",") << "\"";
+            writeEscaped(phases, snapshot.phaseNames[phase]);
+            phases << "\":" << milliseconds(frame.phases[phase]);
+        }
+
+        output << ",\n{\"name\":\"Frame " << frame.index << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+               << frame.start / 1000.0 << ",\"dur\":" << frame.duration / 1000.0
+               << ",\"args\":{\"frameMs\":" << milliseconds(frame.duration)
+               << (phases.str().empty() ? "" : ",") << phases.str() << "}}";
+        // counters draw the phases as graphs
+        output << ",\n{\"name\":\"Phases (ms)\",\"ph\":\"C\",\"pid\":1,\"ts\":" << frame.start / 1000.0
+               << ",\"args\":{" << phases.str() << "}}";
+        if (snapshot.hasSpike && frame.index == snapshot.spikeFrame)
+            output << ",\n{\"name\":\"Spike\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":"
+                   << frame.start / 1000.0 << "}";
+    }
+
+    for (size_t i = 0; i < snapshot.numEvents; i++)
+    {
+        const EventRecord& event = snapshot.events[i];
+        output << ",\n{\"name\":\"";
+        writeEscaped(output, event.text);
+        output << "\",\"cat\":\"";
+        writeEscaped(output, event.category);
+        output << "\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":" << event.start / 1000.0
+               << ",\"dur\":" << event.duration / 1000.0 << "}";
+    }
+    output << "\n]}\n";
+}
+
+// ==============================================================================
+// ==============          FLIGHT PHASE CLASS          ==========================
+// ==============================================================================
+
+FlightPhase::FlightPhase(const char* name) :
+    m_name(name),
+    m_start(Profiler::now())
+{}
+
+FlightPhase::~FlightPhase()
+{
+    FlightRecorder::shared().addPhaseTime(m_name, Profiler::now() - m_start);
+}
+
+// ==============================================================================
+// ==============          FLIGHT EVENT CLASS          ==========================
+// ==============================================================================
+
+FlightEvent::FlightEvent(const char* category, std::string text) :
+    m_category(category),
+    m_text(std::move(text)),
+    m_start(Profiler::now())
+{}
+
+FlightEvent::~FlightEvent()
+{
+    FlightRecorder::shared().addEvent(m_category, m_text, m_start, Profiler::now() - m_start);
+}
@@ -0,0 +1,87 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+namespace
+{
+    // frame of the whole application, advanced by nextFrame
+    std::atomic<uint64_t> currentFrame{ 0 };
+}
+
+FrameArena::FrameArena(size_t blockSize) :
+    m_blockSize(blockSize)
+{
+    if (blockSize == 0)
+        throw std::runtime_error("FrameArena: block size must be positive");
+}
+
+FrameArena& FrameArena::local()
+{
+    thread_local FrameArena arena;
+    const uint64_t frame = currentFrame.load(std::memory_order_relaxed);
+    if (arena.m_followsFrames && arena.m_frame != frame)
+    {
+        arena.reset();
+        arena.m_frame = frame;
+    }
+    return arena;
+}
+
+void FrameArena::nextFrame()
+{
+    currentFrame.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        throw std::runtime_error("FrameArena: alignment must be a power of two");
+
+    if (!m_blocks.empty())
+    {
+        Block& block = m_blocks.back();
+        const uintptr_t address = reinterpret_cast<uintptr_t>(block.data.get()) + m_offset;
+        const size_t padding = (alignment - address % alignment) % alignment;
+        if (m_offset + padding + size <= block.size)
+        {
+            m_offset += padding + size;
+            m_highWaterMark = std::max(m_highWaterMark, used());
+            return block.data.get() + m_offset - size;
+        }
+        m_usedInFullBlocks += m_offset;
+    }
+
+    // blocks are aligned for any type, larger alignments may need padding
+    addBlock(std::max(m_blockSize, size + alignment));
+    return allocate(size, alignment);
+}
+
+void FrameArena::reset()
+{
+    // a frame that did not fit into one block gets a block that fits it,
+    // with some slack for alignment that may pad differently
+    if (m_blocks.size() > 1)
+    {
+        m_blocks.clear();
+        addBlock(std::max(m_blockSize, m_highWaterMark + m_highWaterMark / 4));
+    }
+    m_offset = 0;
+    m_usedInFullBlocks = 0;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t capacity = 0;
+    for (const Block& block : m_blocks)
+        capacity += block.size;
+    return capacity;
+}
+
+void FrameArena::addBlock(size_t size)
+{
+    m_blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+    m_offset = 0;
+    m_numBlockAllocations++;
+}
@@ -0,0 +1,106 @@
+#include "GBuffer.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "FlightRecorder.h"
+
+namespace
+{
+    GLuint createTexture(GLint internalFormat, GLenum format, GLenum type,
+        int width, int height)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+        // G-buffer is read pixel by pixel, no filtering
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+}
+
+GBuffer::GBuffer()
+{
+    glGenFramebuffers(1, &m_framebuffer);
+    glGenVertexArrays(1, &m_emptyVAO);
+}
+
+GBuffer::~GBuffer()
+{
+    deleteAttachments();
+    if (m_framebuffer != 0)
+        glDeleteFramebuffers(1, &m_framebuffer);
+    if (m_emptyVAO != 0)
+        glDeleteVertexArrays(1, &m_emptyVAO);
+}
+
+void GBuffer::resize(int width, int height)
+{
+    if (width == m_width && height == m_height)
+        return;
+
+    FlightEvent event("upload", "G-buffer " + std::to_string(width) + "x" + std::to_string(height));
+    m_width = width;
+    m_height = height;
+    deleteAttachments();
+    createAttachments();
+}
+
+void GBuffer::createAttachments()
+{
+    m_albedo = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, m_width, m_height);
+    // RGB16F is not required to be renderable, so the fourth channel is unused
+    m_normalShininess = createTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, m_width, m_height);
+    m_depth = createTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, m_width, m_height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_albedo, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_normalShininess, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
+    // fragment shader outputs 0 and 1 go to the two color attachments
+    const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("G-buffer framebuffer is incomplete");
+}
+
+void GBuffer::deleteAttachments()
+{
+    for (GLuint* texture : { &m_albedo, &m_normalShininess, &m_depth })
+        if (*texture != 0)
+        {
+            glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+}
+
+void GBuffer::bindFramebuffer() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+}
+
+void GBuffer::bindTextures(GLuint firstUnit) const
+{
+    const GLuint textures[] = { m_albedo, m_normalShininess, m_depth };
+    for (GLuint i = 0; i < 3; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void GBuffer::drawFullscreenTriangle() const
+{
+    glBindVertexArray(m_emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+}
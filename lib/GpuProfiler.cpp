@@ -0,0 +1,137 @@
+#include "GpuProfiler.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    // checked before anything is sized from it
+    size_t validNumFrames(int numFrames)
+    {
+        if (numFrames < 1)
+            throw std::runtime_error("GpuProfiler: needs at least one frame");
+        return size_t(numFrames);
+    }
+}
+
+GpuProfiler::GpuProfiler(int numFrames) :
+    m_queries(validNumFrames(numFrames) * MAX_SCOPES_PER_FRAME * 2, 0),
+    m_frames(size_t(numFrames)),
+    m_track(Profiler::addTrack("GPU"))
+{
+    glGenQueries(GLsizei(m_queries.size()), m_queries.data());
+    // measuring a frame does not allocate
+    for (Frame& frame : m_frames)
+        frame.scopes.reserve(MAX_SCOPES_PER_FRAME);
+    m_open.reserve(MAX_SCOPES_PER_FRAME);
+    m_lastFrame.reserve(MAX_SCOPES_PER_FRAME);
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+bool GpuProfiler::isSupported()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+void GpuProfiler::beginFrame()
+{
+    // oldest first, so that lastFrame ends up with the newest results
+    for (size_t i = 0; i < m_frames.size(); i++)
+    {
+        const size_t frame = (m_frame + i) % m_frames.size();
+        // the GPU finishes frames in order
+        if (m_frames[frame].pending && !tryRead(frame))
+            break;
+    }
+
+    Frame& frame = m_frames[m_frame % m_frames.size()];
+    if (frame.pending)
+    {
+        // the GPU is more than the whole ring behind; reusing the queries discards the frame
+        m_numFramesDropped++;
+        frame.pending = false;
+    }
+    frame.scopes.clear();
+    m_open.clear();
+
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    frame.clockOffset = int64_t(Profiler::now()) - gpuTime;
+}
+
+void GpuProfiler::endFrame()
+{
+    if (!m_open.empty())
+        throw std::runtime_error("GpuProfiler: a scope is still open at the end of the frame");
+    Frame& frame = m_frames[m_frame % m_frames.size()];
+    frame.pending = !frame.scopes.empty();
+    m_frame++;
+}
+
+void GpuProfiler::beginScope(const char* name)
+{
+    const size_t frame = m_frame % m_frames.size();
+    std::vector<Scope>& scopes = m_frames[frame].scopes;
+    if (scopes.size() == MAX_SCOPES_PER_FRAME)
+    {
+        m_open.push_back(-1);
+        return;
+    }
+    glQueryCounter(beginQuery(frame, scopes.size()), GL_TIMESTAMP);
+    m_open.push_back(int(scopes.size()));
+    scopes.push_back({ name, int(m_open.size()) - 1 });
+}
+
+void GpuProfiler::endScope()
+{
+    if (m_open.empty())
+        throw std::runtime_error("GpuProfiler: endScope without beginScope");
+    const int scope = m_open.back();
+    m_open.pop_back();
+    if (scope >= 0)
+        glQueryCounter(endQuery(m_frame % m_frames.size(), size_t(scope)), GL_TIMESTAMP);
+}
+
+double GpuProfiler::lastFrameMilliseconds(const char* name) const
+{
+    double milliseconds = 0.0;
+    for (const GpuScopeTime& scope : m_lastFrame)
+        if (std::strcmp(scope.name, name) == 0)
+            milliseconds += scope.milliseconds();
+    return milliseconds;
+}
+
+bool GpuProfiler::tryRead(size_t frameIndex)
+{
+    Frame& frame = m_frames[frameIndex];
+    // queries usually finish in order, but check all of them rather than rely on it
+    for (size_t scope = 0; scope < frame.scopes.size(); scope++)
+        for (GLuint query : { beginQuery(frameIndex, scope), endQuery(frameIndex, scope) })
+        {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return false;
+        }
+
+    const bool recording = Profiler::isRecording();
+    m_lastFrame.clear();
+    for (size_t scope = 0; scope < frame.scopes.size(); scope++)
+    {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(beginQuery(frameIndex, scope), GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(endQuery(frameIndex, scope), GL_QUERY_RESULT, &end);
+        const GpuScopeTime time{ frame.scopes[scope].name, frame.scopes[scope].depth,
+            uint64_t(int64_t(begin) + frame.clockOffset), uint64_t(int64_t(end) + frame.clockOffset) };
+        m_lastFrame.push_back(time);
+        if (recording)
+            Profiler::record(m_track, time.name, time.start, time.end);
+    }
+    frame.pending = false;
+    m_numFramesRead++;
+    return true;
+}
@@ -0,0 +1,140 @@
+#include "IndirectRenderer.h"
+
+#include <algorithm>
+
+#include "Config.h"
+
+namespace
+{
+    // binding points of the cull shader's storage buffers
+    constexpr GLuint BOUNDS_BINDING = 0;
+    constexpr GLuint COMMANDS_BINDING = 1;
+    // binding point of the DrawData storage buffer of the render shaders,
+    // set in gpuDrivenDrawData.glsl
+    constexpr GLuint DRAW_DATA_BINDING = 2;
+    // vertex attribute with the index of the draw
+    constexpr GLuint DRAW_INDEX_LOCATION = 3;
+    // local_size_x of the cull shader
+    constexpr GLuint CULL_GROUP_SIZE = 64;
+
+    GLuint createBuffer(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+        glBufferData(target, size, data, usage);
+        glBindBuffer(target, 0);
+        return buffer;
+    }
+}
+
+bool IndirectRenderer::isSupported()
+{
+    return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object &&
+        GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance && GLEW_ARB_shading_language_420pack);
+}
+
+IndirectRenderer::IndirectRenderer() :
+    m_cullShader(SHADERS_DIR + "cullDrawsCompute.glsl")
+{}
+
+IndirectRenderer::~IndirectRenderer()
+{
+    for (GLuint buffer : { m_drawDataBuffer, m_boundsBuffer, m_commandBuffer, m_drawIndexBuffer })
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+}
+
+void IndirectRenderer::addDraw(const MeshGeometry& geometry, const SubMesh& range,
+    bool textured, const DrawData& drawData, const BoundingSphere& bounds)
+{
+    PooledMesh pooled = m_geometry.add(geometry);
+    pooled.firstIndex += range.firstIndex;
+    pooled.numIndices = range.numIndices;
+    m_draws.push_back({ pooled, textured, drawData, bounds });
+}
+
+void IndirectRenderer::upload()
+{
+    // the draws of a shader variant must be adjacent to share a multi-draw
+    auto textured = std::stable_partition(m_draws.begin(), m_draws.end(),
+        [](const Draw& draw) { return !draw.textured; });
+    m_numUntexturedDraws = GLsizei(textured - m_draws.begin());
+
+    std::vector<DrawData> drawData;
+    std::vector<glm::vec4> bounds;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<GLuint> drawIndices;
+    for (size_t i = 0; i < m_draws.size(); i++)
+    {
+        const Draw& draw = m_draws[i];
+        drawData.push_back(draw.drawData);
+        bounds.emplace_back(draw.bounds.center, draw.bounds.radius);
+        // the base instance selects the draw index, and with it the DrawData
+        commands.push_back({ draw.range.numIndices, 1, draw.range.firstIndex, draw.range.baseVertex, GLuint(i) });
+        drawIndices.push_back(GLuint(i));
+    }
+
+    m_geometry.upload();
+    m_drawDataBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, sizeof(DrawData) * drawData.size(),
+        drawData.data(), GL_STATIC_DRAW);
+    m_boundsBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * bounds.size(),
+        bounds.data(), GL_STATIC_DRAW);
+    m_commandBuffer = createBuffer(GL_DRAW_INDIRECT_BUFFER,
+        sizeof(DrawElementsIndirectCommand) * commands.size(), commands.data(), GL_DYNAMIC_DRAW);
+    m_drawIndexBuffer = createBuffer(GL_ARRAY_BUFFER, sizeof(GLuint) * drawIndices.size(),
+        drawIndices.data(), GL_STATIC_DRAW);
+
+    // one draw index per instance, starting at the base instance of the command
+    glBindVertexArray(m_geometry.vao());
+    glBindBuffer(GL_ARRAY_BUFFER, m_drawIndexBuffer);
+    glEnableVertexAttribArray(DRAW_INDEX_LOCATION);
+    glVertexAttribIPointer(DRAW_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0, (void*)0);
+    glVertexAttribDivisor(DRAW_INDEX_LOCATION, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void IndirectRenderer::cull(const std::array<glm::vec4, 6>& frustumPlanes) const
+{
+    if (m_draws.empty())
+        return;
+
+    m_cullShader.activateShader();
+    glUniform4fv(glGetUniformLocation(m_cullShader.id(), "frustumPlanes"), 6, &frustumPlanes[0].x);
+    glUniform1ui(glGetUniformLocation(m_cullShader.id(), "numDraws"), GLuint(m_draws.size()));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BOUNDS_BINDING, m_boundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMANDS_BINDING, m_commandBuffer);
+    glDispatchCompute((GLuint(m_draws.size()) + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // the draws read the instance counts as indirect commands
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void IndirectRenderer::render(bool textured) const
+{
+    if (textured)
+        draw(m_numUntexturedDraws, GLsizei(m_draws.size()) - m_numUntexturedDraws);
+    else
+        draw(0, m_numUntexturedDraws);
+}
+
+void IndirectRenderer::renderDepth() const
+{
+    draw(0, GLsizei(m_draws.size()));
+}
+
+void IndirectRenderer::draw(GLsizei firstDraw, GLsizei numDraws) const
+{
+    if (numDraws == 0)
+        return;
+
+    // the shaders read the block at this binding point
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, m_drawDataBuffer);
+    glBindVertexArray(m_geometry.vao());
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+        (void*)(sizeof(DrawElementsIndirectCommand) * firstDraw), numDraws, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
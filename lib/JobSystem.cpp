@@ -0,0 +1,298 @@
+#include "JobSystem.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "Profiler.h"
+
+namespace
+{
+    // JobSystem and queue index of the calling thread, if it is a worker
+    thread_local const JobSystem* t_system = nullptr;
+    thread_local size_t t_worker = 0;
+
+    // times a waiting thread looks for a job before it sleeps;
+    // the jobs of a frame are short, so most waits end while spinning
+    constexpr int WAIT_SPINS = 64;
+}
+
+// ==============================================================================
+// ==============          JOB SYSTEM CLASS     =================================
+// ==============================================================================
+
+JobSystem& JobSystem::shared()
+{
+    static JobSystem jobs;
+    return jobs;
+}
+
+JobSystem::JobSystem(size_t numWorkers) :
+    m_mainThread(std::this_thread::get_id())
+{
+    for (size_t i = 0; i <= numWorkers; i++)
+        m_queues.push_back(std::make_unique<WorkQueue>());
+    for (size_t i = 0; i < numWorkers; i++)
+        m_workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+void JobSystem::run(JobGroup& group, Job job)
+{
+    group.m_pending.fetch_add(1, std::memory_order_relaxed);
+    // workers keep their jobs close; other threads share the last queue
+    WorkQueue& queue = t_system == this ? *m_queues[t_worker] : *m_queues.back();
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ std::move(job), &group });
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_queued.fetch_add(1);
+    }
+    m_wakeUp.notify_one();
+}
+
+void JobSystem::runOnMainThread(JobGroup& group, Job job)
+{
+    group.m_pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(m_mainThreadQueue.mutex);
+        m_mainThreadQueue.tasks.push_back({ std::move(job), &group });
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_mainThreadQueued.fetch_add(1);
+    }
+    // the main thread may be sleeping in wait
+    m_wakeUp.notify_all();
+}
+
+void JobSystem::executeMainThreadJobs()
+{
+    if (!isMainThread())
+        throw std::runtime_error("JobSystem: main-thread jobs must run on the main thread");
+
+    // jobs queued from now on wait for the next call
+    size_t numTasks;
+    {
+        std::lock_guard<std::mutex> lock(m_mainThreadQueue.mutex);
+        numTasks = m_mainThreadQueue.tasks.size();
+    }
+    for (size_t i = 0; i < numTasks; i++)
+    {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(m_mainThreadQueue.mutex);
+            // wait may have run some of them in the meantime
+            if (m_mainThreadQueue.tasks.empty())
+                return;
+            task = std::move(m_mainThreadQueue.tasks.front());
+            m_mainThreadQueue.tasks.pop_front();
+            m_mainThreadQueued.fetch_sub(1);
+        }
+        execute(task);
+    }
+}
+
+void JobSystem::wait(JobGroup& group)
+{
+    const bool mainThread = isMainThread();
+    int spins = 0;
+    while (!group.isDone())
+    {
+        Task task;
+        if (mainThread)
+        {
+            std::unique_lock<std::mutex> lock(m_mainThreadQueue.mutex);
+            if (!m_mainThreadQueue.tasks.empty())
+            {
+                task = std::move(m_mainThreadQueue.tasks.front());
+                m_mainThreadQueue.tasks.pop_front();
+                m_mainThreadQueued.fetch_sub(1);
+                lock.unlock();
+                execute(task);
+                spins = 0;
+                continue;
+            }
+        }
+        if (findTask(task))
+        {
+            execute(task);
+            spins = 0;
+            continue;
+        }
+        if (++spins < WAIT_SPINS)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // the jobs of the group run elsewhere: sleep until one of them finishes the group
+        // or there is something to help with
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wakeUp.wait(lock, [&]() {
+            return group.isDone() || m_queued.load() > 0 || (mainThread && m_mainThreadQueued.load() > 0);
+        });
+        spins = 0;
+    }
+
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(group.m_mutex);
+        std::swap(exception, group.m_exception);
+    }
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+void JobSystem::workerLoop(size_t worker)
+{
+    t_system = this;
+    t_worker = worker;
+    Profiler::setThreadName("Worker " + std::to_string(worker));
+    while (true)
+    {
+        Task task;
+        if (findTask(task))
+        {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wakeUp.wait(lock, [this]() { return m_stopping || m_queued.load() > 0; });
+        if (m_stopping && m_queued.load() == 0)
+            return;
+    }
+}
+
+bool JobSystem::findTask(Task& task)
+{
+    const size_t own = t_system == this ? t_worker : m_queues.size() - 1;
+    {
+        // newest first: its data is most likely still in the cache
+        WorkQueue& queue = *m_queues[own];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            m_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    // steal the oldest job of another queue, which tends to be the largest piece of work
+    for (size_t i = 1; i < m_queues.size(); i++)
+    {
+        WorkQueue& queue = *m_queues[(own + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            m_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::TaskRing::push_back(Task task)
+{
+    if (m_size == m_tasks.size())
+    {
+        std::vector<Task> tasks(std::max<size_t>(16, 2 * m_tasks.size()));
+        for (size_t i = 0; i < m_size; i++)
+            tasks[i] = std::move(m_tasks[(m_first + i) % m_tasks.size()]);
+        m_tasks.swap(tasks);
+        m_first = 0;
+    }
+    m_tasks[(m_first + m_size) % m_tasks.size()] = std::move(task);
+    m_size++;
+}
+
+void JobSystem::execute(Task& task)
+{
+    try
+    {
+        task.job();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(task.group->m_mutex);
+        if (!task.group->m_exception)
+            task.group->m_exception = std::current_exception();
+    }
+    // the group may be gone as soon as its last job is done, so it is not touched after that
+    if (task.group->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        // wake the threads waiting for the group
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_wakeUp.notify_all();
+    }
+}
+
+// ==============================================================================
+// ==============          TASK GRAPH CLASS     =================================
+// ==============================================================================
+
+TaskGraph::TaskId TaskGraph::add(Job job, const std::vector<TaskId>& dependencies)
+{
+    return add(std::move(job), dependencies, false);
+}
+
+TaskGraph::TaskId TaskGraph::addOnMainThread(Job job, const std::vector<TaskId>& dependencies)
+{
+    return add(std::move(job), dependencies, true);
+}
+
+TaskGraph::TaskId TaskGraph::add(Job job, const std::vector<TaskId>& dependencies, bool mainThread)
+{
+    const TaskId id = m_tasks.size();
+    for (TaskId dependency : dependencies)
+    {
+        if (dependency >= id)
+            throw std::runtime_error("TaskGraph: tasks can only depend on tasks added before them");
+        m_tasks[dependency].dependents.push_back(id);
+    }
+    m_tasks.push_back({ std::move(job), mainThread, dependencies.size(), {} });
+    return id;
+}
+
+void TaskGraph::run(JobSystem& jobs)
+{
+    m_remaining = std::make_unique<std::atomic<size_t>[]>(m_tasks.size());
+    for (size_t i = 0; i < m_tasks.size(); i++)
+        m_remaining[i].store(m_tasks[i].numDependencies);
+
+    JobGroup group;
+    for (TaskId task = 0; task < m_tasks.size(); task++)
+        if (m_tasks[task].numDependencies == 0)
+            start(jobs, group, task);
+    // a task that throws never starts its dependents; wait rethrows its exception
+    jobs.wait(group);
+}
+
+void TaskGraph::start(JobSystem& jobs, JobGroup& group, TaskId task)
+{
+    Job job = [this, &jobs, &group, task]() {
+        m_tasks[task].job();
+        for (TaskId dependent : m_tasks[task].dependents)
+            if (m_remaining[dependent].fetch_sub(1) == 1)
+                start(jobs, group, dependent);
+    };
+    if (m_tasks[task].mainThread)
+        jobs.runOnMainThread(group, std::move(job));
+    else
+        jobs.run(group, std::move(job));
+}
@@ -1,7 +1,20 @@
 #include "Light.h"
 
 #include "Utils.h"
+#include "Camera.h"
+#include "FrameArena.h"
+#include "Profiler.h"
 #include <algorithm> 
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    // texture units of the light and cluster buffers; unit 0 is for material textures
+    constexpr GLuint POINT_LIGHT_DATA_UNIT = 1;
+    constexpr GLuint CLUSTER_RANGES_UNIT = 2;
+    constexpr GLuint CLUSTER_LIGHT_INDICES_UNIT = 3;
+}
 
 AmbientLight::AmbientLight(glm::vec3 color, GLfloat intensity) :
     m_color(color),
@@ -24,11 +37,11 @@ DirectionalLight::DirectionalLight(glm::vec3 color, glm::vec3 direction,
 
 void DirectionalLight::talkToShader(GLuint shader) const
 {
-    glUniform3f(glGetUniformLocation(shader, "diffuseLight.color"),
+    glUniform3f(glGetUniformLocation(shader, "directionalLight.color"),
         m_color.x, m_color.y, m_color.z);
-    glUniform3f(glGetUniformLocation(shader, "diffuseLight.direction"),
+    glUniform3f(glGetUniformLocation(shader, "directionalLight.direction"),
         m_direction.x, m_direction.y, m_direction.z);
-    glUniform1f(glGetUniformLocation(shader, "diffuseLight.intensity"), m_intensity);
+    glUniform1f(glGetUniformLocation(shader, "directionalLight.intensity"), m_intensity);
 }
 
 PointLight::PointLight(glm::vec3 color, glm::vec3 position,
@@ -39,24 +52,33 @@ PointLight::PointLight(glm::vec3 color, glm::vec3 position,
     m_intensity(intensity)
 {}
 
-void PointLight::talkToShader(GLuint shader, int number) const
+GLfloat PointLight::intensityAt(GLfloat distance) const
 {
-    char locBuff[100] = { '\0' };
-
-    snprintf(locBuff, sizeof(locBuff), "pointLights[%d].color", number);    
-    glUniform3f(glGetUniformLocation(shader, locBuff),
-        m_color.x, m_color.y, m_color.z);
-
-    snprintf(locBuff, sizeof(locBuff), "pointLights[%d].position", number);
-    glUniform3f(glGetUniformLocation(shader, locBuff),
-        m_position.x, m_position.y, m_position.z);
+    return m_intensity /
+        ((m_attenuation.x * distance + m_attenuation.y) * distance + m_attenuation.z);
+}
 
-    snprintf(locBuff, sizeof(locBuff), "pointLights[%d].attenuation", number);    
-    glUniform3f(glGetUniformLocation(shader, locBuff),
-        m_attenuation.x, m_attenuation.y, m_attenuation.z);
+GLfloat PointLight::radius(GLfloat cutoff) const
+{
+    // Solve intensity / (a*D^2 + b*D + c) = cutoff for D
+    const GLfloat a = m_attenuation.x, b = m_attenuation.y;
+    const GLfloat k = m_intensity / cutoff - m_attenuation.z;
+    if (k <= 0.0f)
+        return 0.0f;
+    if (a > 0.0f)
+        return (-b + sqrt(b * b + 4.0f * a * k)) / (2.0f * a);
+    if (b > 0.0f)
+        return k / b;
+    // no attenuation, the light reaches everywhere
+    return std::numeric_limits<GLfloat>::max();
+}
 
-    snprintf(locBuff, sizeof(locBuff), "pointLights[%d].intensity", number); 
-    glUniform1f(glGetUniformLocation(shader, locBuff), m_intensity);
+std::array<glm::vec4, POINT_LIGHT_TEXELS> PointLight::shaderData(GLfloat cutoff) const
+{
+    return {
+        glm::vec4(m_position, radius(cutoff)),
+        glm::vec4(m_color, m_intensity),
+        glm::vec4(m_attenuation, 0.0f) };
 }
 
 SpotLight::SpotLight(glm::vec3 color, glm::vec3 attenuation,
@@ -70,7 +92,7 @@ SpotLight::SpotLight(glm::vec3 color, glm::vec3 attenuation,
     m_isOn(isOn)
 {}
 
-void SpotLight::talkToShader(GLuint shader) const
+void SpotLight::talkToShader(GLuint shader, bool isOn) const
 {
     glUniform3f(glGetUniformLocation(shader, "spotLight.color"),
         m_color.x, m_color.y, m_color.z);
@@ -79,7 +101,7 @@ void SpotLight::talkToShader(GLuint shader) const
     glUniform1f(glGetUniformLocation(shader, "spotLight.intensity"), m_intensity);
     glUniform1f(glGetUniformLocation(shader, "spotLight.halfAngleCos"), m_halfAngleCos);
     glUniform1f(glGetUniformLocation(shader, "spotLight.verticalOffset"), m_verticalOffset);
-    glUniform1i(glGetUniformLocation(shader, "spotLight.isOn"), m_isOn.state());
+    glUniform1i(glGetUniformLocation(shader, "spotLight.isOn"), isOn);
 }
 
 void SpotLight::switchOnOff(bool signal)
@@ -90,6 +112,90 @@ void SpotLight::switchOnOff(bool signal)
         m_isOn.release();
 }
 
+int selectPointLights(const std::vector<PointLight>& lights,
+    const std::vector<LightSphere>& lightSpheres, const BoundingSphere& bounds,
+    std::array<GLint, MAX_INSTANCE_LIGHTS>& selection)
+{
+    // intensity of the selected lights at the closest point of the bounds, descending
+    std::array<GLfloat, MAX_INSTANCE_LIGHTS> intensities;
+    int numSelected = 0;
+
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        GLfloat distance = std::max(
+            glm::length(lightSpheres[i].position - bounds.center) - bounds.radius, 0.0f);
+        if (distance > lightSpheres[i].radius)
+            continue;
+
+        GLfloat intensity = lights[i].intensityAt(distance);
+        if (numSelected == MAX_INSTANCE_LIGHTS && intensity <= intensities[numSelected - 1])
+            continue;
+
+        // insertion into the sorted selection, dropping the weakest light if full
+        int slot = std::min(numSelected, MAX_INSTANCE_LIGHTS - 1);
+        while (slot > 0 && intensities[slot - 1] < intensity)
+        {
+            intensities[slot] = intensities[slot - 1];
+            selection[slot] = selection[slot - 1];
+            slot--;
+        }
+        intensities[slot] = intensity;
+        selection[slot] = GLint(i);
+        numSelected = std::min(numSelected + 1, MAX_INSTANCE_LIGHTS);
+    }
+
+    return numSelected;
+}
+
+TextureBuffer::TextureBuffer(GLenum format)
+{
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 0, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+    // the texture only references the buffer, so it sees any later updates
+    glTexBuffer(GL_TEXTURE_BUFFER, format, m_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+TextureBuffer::~TextureBuffer()
+{
+    if (m_texture != 0)
+        glDeleteTextures(1, &m_texture);
+    if (m_buffer != 0)
+        glDeleteBuffers(1, &m_buffer);
+}
+
+void TextureBuffer::update(const void* data, size_t size)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+    // orphan the old storage so that we don't wait for the GPU to finish reading it
+    glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void TextureBuffer::bind(GLuint unit) const
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+LightManager::LightManager() :
+    m_lightingMode(LightingMode::Clustered),
+    m_lightCutoff(POINT_LIGHT_CUTOFF),
+    m_clusterGrid{ 0, 0, 0, 0.0f, 0.0f },
+    m_pointLightsChanged(true),
+    m_pointLightData(GL_RGBA32F),
+    m_clusterRanges(GL_RG32UI),
+    m_clusterLightIndices(GL_R32UI)
+{
+    updateShaderDefines();
+}
+
 void LightManager::setAmbientLight(const AmbientLight& ambientLight)
 {
     m_ambientLight = ambientLight;
@@ -98,42 +204,139 @@ void LightManager::setAmbientLight(const AmbientLight& ambientLight)
 void LightManager::setDirectionalLight(const DirectionalLight& directionalLight)
 {
     m_directionalLight = directionalLight;
+    updateShaderDefines();
 }
 
 void LightManager::addPointLight(const PointLight& pointLight)
 {
     m_pointLights.push_back(pointLight);
+    m_lightSpheres.push_back(LightSphere{ pointLight.position(), pointLight.radius(m_lightCutoff) });
+    m_pointLightsChanged = true;
+    m_selectionVersion++;
+    updateShaderDefines();
+}
+
+void LightManager::setLightingMode(LightingMode mode)
+{
+    m_lightingMode = mode;
+    m_selectionVersion++;
+    updateShaderDefines();
+}
+
+void LightManager::setLightCutoff(GLfloat cutoff)
+{
+    m_lightCutoff = cutoff;
+    for (size_t i = 0; i < m_pointLights.size(); i++)
+        m_lightSpheres[i].radius = m_pointLights[i].radius(cutoff);
+    m_pointLightsChanged = true;
+    m_selectionVersion++;
 }
 
 void LightManager::setSpotLight(const SpotLight& spotLight)
 {
     m_spotLight = spotLight;
+    updateShaderDefines();
 }
 
 
-void LightManager::talkToShader(GLuint shader) const
+void LightManager::talkToShader(GLuint shader, bool spotLightOn) const
 {
+    PROFILE_ZONE("LightManager::talkToShader");
     m_ambientLight.talkToShader(shader);
     m_directionalLight.talkToShader(shader);
 
     talkAboutPointLights(shader);
 
-    m_spotLight.talkToShader(shader);
+    m_spotLight.talkToShader(shader, spotLightOn);
+}
+
+void LightManager::buildClusters(LightClusters& clusters, const Camera& camera, GLfloat aspectRatio) const
+{
+    PROFILE_ZONE("LightManager::buildClusters");
+    if (m_lightingMode == LightingMode::Clustered)
+        clusters.build(m_lightSpheres, camera.viewMatrix(),
+            camera.projectionMatrix(aspectRatio), camera.nearPlane(), camera.farPlane());
+}
+
+void LightManager::uploadClusters(const LightClusters& clusters)
+{
+    PROFILE_ZONE("LightManager::uploadClusters");
+    if (m_pointLightsChanged)
+    {
+        FrameVector<glm::vec4> lightData(FrameArena::local());
+        lightData.reserve(POINT_LIGHT_TEXELS * m_pointLights.size());
+        for (const auto& light : m_pointLights)
+            for (const auto& texel : light.shaderData(m_lightCutoff))
+                lightData.push_back(texel);
+        m_pointLightData.update(lightData.data(), sizeof(glm::vec4) * lightData.size());
+        m_pointLightsChanged = false;
+    }
+
+    if (m_lightingMode != LightingMode::Clustered)
+        return;
+
+    const auto& ranges = clusters.clusters();
+    m_clusterRanges.update(ranges.data(), sizeof(ClusterRange) * ranges.size());
+    const auto& indices = clusters.lightIndices();
+    m_clusterLightIndices.update(indices.data(), sizeof(GLuint) * indices.size());
+    m_clusterGrid = { clusters.tilesX(), clusters.tilesY(), clusters.slices(),
+        clusters.depthScale(), clusters.depthBias() };
 }
 
 void LightManager::talkAboutPointLights(GLuint shader) const
 {
-    size_t cappedNumberOfLights = std::min(m_pointLights.size(), MAX_POINT_LIGHTS);
-    glUniform1i(glGetUniformLocation(shader, "numPointLights"), cappedNumberOfLights);
-    for (int i = 0; i < cappedNumberOfLights; i++)
-        m_pointLights[i].talkToShader(shader, i);
+    m_pointLightData.bind(POINT_LIGHT_DATA_UNIT);
+    m_clusterRanges.bind(CLUSTER_RANGES_UNIT);
+    m_clusterLightIndices.bind(CLUSTER_LIGHT_INDICES_UNIT);
+
+    glUniform1i(glGetUniformLocation(shader, "pointLightData"), POINT_LIGHT_DATA_UNIT);
+    glUniform1i(glGetUniformLocation(shader, "clusterRanges"), CLUSTER_RANGES_UNIT);
+    glUniform1i(glGetUniformLocation(shader, "clusterLightIndices"), CLUSTER_LIGHT_INDICES_UNIT);
+
+    glUniform3i(glGetUniformLocation(shader, "clusterGridSize"),
+        m_clusterGrid.tilesX, m_clusterGrid.tilesY, m_clusterGrid.slices);
+    glUniform1f(glGetUniformLocation(shader, "clusterDepthScale"), m_clusterGrid.depthScale);
+    glUniform1f(glGetUniformLocation(shader, "clusterDepthBias"), m_clusterGrid.depthBias);
+}
+
+void LightManager::updateShaderDefines()
+{
+    for (bool spotLightOn : { false, true })
+        m_shaderDefines[spotLightOn] = ShaderDefines{
+            { "DIRECTIONAL_LIGHT", m_directionalLight.isOn() ? "1" : "0" },
+            { "SPOT_LIGHT", spotLightOn ? "1" : "0" },
+            { "POINT_LIGHTS", m_pointLights.empty() ? "0" : "1" },
+            { "CLUSTERED_LIGHTING", m_lightingMode == LightingMode::Clustered ? "1" : "0" },
+            { "MAX_INSTANCE_LIGHTS", std::to_string(MAX_INSTANCE_LIGHTS) } };
+}
+
+std::vector<ShaderDefines> LightManager::shaderDefineVariants() const
+{
+    return { m_shaderDefines[false], m_shaderDefines[true] };
+}
+
+int LightManager::selectInstanceLights(const BoundingSphere& bounds,
+    std::array<GLint, MAX_INSTANCE_LIGHTS>& selection) const
+{
+    if (m_lightingMode != LightingMode::PerInstance)
+        return 0;
+    return selectPointLights(m_pointLights, m_lightSpheres, bounds, selection);
+}
+
+void LightManager::talkAboutInstanceLights(GLuint shader, const GLint* lights, int numLights) const
+{
+    if (m_lightingMode != LightingMode::PerInstance)
+        return;
+
+    glUniform1i(glGetUniformLocation(shader, "numInstanceLights"), numLights);
+    glUniform1iv(glGetUniformLocation(shader, "instanceLights"), numLights, lights);
 }
 
 void LightManager::processEvents(const EventContainer& events)
 {
+    // the defines of both states are ready, see updateShaderDefines
     if (events.keyState(GLFW_KEY_F))
         m_spotLight.switchOnOff(true);
     else
         m_spotLight.switchOnOff(false);
-
 }
\ No newline at end of file
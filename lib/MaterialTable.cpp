@@ -0,0 +1,198 @@
+#include "MaterialTable.h"
+
+#include <algorithm>
+#include <string>
+
+#include "Model.h"
+#include "Utils.h"
+
+namespace
+{
+    // uniform block binding point of the table; 0 is for the per-draw data
+    constexpr GLuint MATERIALS_BINDING = 1;
+    // storage block binding point of a table that is too large for a uniform block;
+    // 0-2 are for the IndirectRenderer, set in materials.glsl
+    constexpr GLuint MATERIALS_STORAGE_BINDING = 3;
+    // first of the texture units of the texture arrays;
+    // 1-3 are for light buffers and 4-6 for the G-buffer
+    constexpr GLuint MATERIAL_TEXTURE_UNIT = 7;
+    // textures of the smallest size class are up to this size
+    constexpr GLint MIN_CLASS_SIZE = 256;
+    // larger textures are scaled down to this size in the arrays
+    constexpr GLint MAX_LAYER_SIZE = MIN_CLASS_SIZE << (MATERIAL_TEXTURE_ARRAYS - 1);
+
+    bool storageBlocksSupported()
+    {
+        return GLEW_VERSION_4_3 || (GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_shading_language_420pack);
+    }
+
+    // Size class of a texture: the smallest whose size holds its longer side
+    GLuint sizeClass(GLint width, GLint height)
+    {
+        GLuint textureClass = 0;
+        while (textureClass + 1 < MATERIAL_TEXTURE_ARRAYS && std::max(width, height) > MIN_CLASS_SIZE << textureClass)
+            textureClass++;
+        return textureClass;
+    }
+}
+
+MaterialTable::~MaterialTable()
+{
+    if (m_buffer != 0)
+        glDeleteBuffers(1, &m_buffer);
+    for (GLuint textureArray : m_textureArrays)
+        if (textureArray != 0)
+            glDeleteTextures(1, &textureArray);
+}
+
+void MaterialTable::add(const Model& model)
+{
+    for (const Material& material : model.materials())
+    {
+        if (m_indices.count(&material))
+            continue;
+        m_indices[&material] = GLuint(m_materials.size());
+        m_materials.push_back(&material);
+    }
+}
+
+void MaterialTable::upload()
+{
+    std::vector<MaterialData> materials;
+    for (const Material* material : m_materials)
+    {
+        MaterialData data{};
+        data.diffuseColor = material->m_diffuseColor;
+        data.shininess = material->m_shininess;
+        data.textureLayer = -1;
+        materials.push_back(data);
+    }
+    uploadTextures(materials);
+
+    // a uniform block is the fastest to read, as long as the table fits
+    GLint maxBlockSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+    const size_t maxUniformMaterials = size_t(maxBlockSize) / sizeof(MaterialData);
+    if (materials.size() > maxUniformMaterials)
+    {
+        if (storageBlocksSupported())
+            m_inStorage = true;
+        else
+        {
+            // without storage blocks, keep drawing: the last materials share one entry
+            debugOutput("MaterialTable: " + std::to_string(materials.size()) + " materials, " +
+                std::to_string(maxUniformMaterials) + " fit in a uniform block; the rest share the last one");
+            for (auto& [material, index] : m_indices)
+                index = std::min<GLuint>(index, GLuint(maxUniformMaterials - 1));
+            materials.resize(maxUniformMaterials);
+        }
+    }
+    // the block has exactly as many entries as the table
+    const size_t numEntries = std::max<size_t>(materials.size(), 1);
+    materials.resize(numEntries);
+    m_shaderDefines = ShaderDefines{
+        { "MAX_MATERIALS", std::to_string(numEntries) },
+        { "MATERIALS_IN_STORAGE", m_inStorage ? "1" : "0" } };
+
+    const GLenum target = m_inStorage ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER;
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(target, m_buffer);
+    glBufferData(target, sizeof(MaterialData) * materials.size(), materials.data(), GL_STATIC_DRAW);
+    glBindBuffer(target, 0);
+}
+
+void MaterialTable::uploadTextures(std::vector<MaterialData>& materials)
+{
+    // each textured material gets a layer in the array of its size class,
+    // which is as large as the largest texture of the class
+    std::array<std::vector<GLuint>, MATERIAL_TEXTURE_ARRAYS> layerTextures;
+    std::array<GLint, MATERIAL_TEXTURE_ARRAYS> layerWidths, layerHeights;
+    layerWidths.fill(1);
+    layerHeights.fill(1);
+    for (size_t i = 0; i < m_materials.size(); i++)
+    {
+        if (!m_materials[i]->m_textured)
+            continue;
+        const GLuint texture = m_materials[i]->m_texture.id();
+        GLint width, height;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+        width = std::min(width, MAX_LAYER_SIZE);
+        height = std::min(height, MAX_LAYER_SIZE);
+
+        const GLuint textureClass = sizeClass(width, height);
+        materials[i].textureArray = GLint(textureClass);
+        materials[i].textureLayer = GLint(layerTextures[textureClass].size());
+        layerTextures[textureClass].push_back(texture);
+        layerWidths[textureClass] = std::max(layerWidths[textureClass], width);
+        layerHeights[textureClass] = std::max(layerHeights[textureClass], height);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLuint framebuffers[2];
+    glGenFramebuffers(2, framebuffers);
+    glGenTextures(GLsizei(m_textureArrays.size()), m_textureArrays.data());
+    for (GLuint textureClass = 0; textureClass < MATERIAL_TEXTURE_ARRAYS; textureClass++)
+    {
+        // same sampling parameters as a Texture, with trilinear filtering of the mipmaps
+        const GLint layerWidth = layerWidths[textureClass], layerHeight = layerHeights[textureClass];
+        const GLsizei numLayers = std::max<GLsizei>(GLsizei(layerTextures[textureClass].size()), 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArrays[textureClass]);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, layerWidth, layerHeight, numLayers,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        // copy (and scale) each texture into its layer on the GPU
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+        for (size_t layer = 0; layer < layerTextures[textureClass].size(); layer++)
+        {
+            const GLuint texture = layerTextures[textureClass][layer];
+            GLint width, height;
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                m_textureArrays[textureClass], 0, GLint(layer));
+            glBlitFramebuffer(0, 0, width, height, 0, 0, layerWidth, layerHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // the mipmaps of each layer are built from the scaled copy
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArrays[textureClass]);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    glDeleteFramebuffers(2, framebuffers);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void MaterialTable::talkToShader(GLuint shader) const
+{
+    // the storage block is bound to its binding point in the shader
+    if (m_inStorage)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIALS_STORAGE_BINDING, m_buffer);
+    else
+    {
+        GLuint blockIndex = glGetUniformBlockIndex(shader, "Materials");
+        if (blockIndex == GL_INVALID_INDEX)
+            return;
+        glUniformBlockBinding(shader, blockIndex, MATERIALS_BINDING);
+        glBindBufferBase(GL_UNIFORM_BUFFER, MATERIALS_BINDING, m_buffer);
+    }
+
+    std::array<GLint, MATERIAL_TEXTURE_ARRAYS> units;
+    for (GLuint i = 0; i < MATERIAL_TEXTURE_ARRAYS; i++)
+    {
+        units[i] = GLint(MATERIAL_TEXTURE_UNIT + i);
+        glActiveTexture(GL_TEXTURE0 + MATERIAL_TEXTURE_UNIT + i);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArrays[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1iv(glGetUniformLocation(shader, "materialTextures"), GLsizei(units.size()), units.data());
+}
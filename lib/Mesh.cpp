@@ -1,5 +1,74 @@
 #include "Mesh.h"
 
+#include <cstring>
+#include <limits>
+
+// ==============================================================================
+// =====================       MESH GEOMETRY       ==============================
+// ==============================================================================
+
+BoundingSphere boundingSphere(const array<GLfloat, 6>& boundingBox,
+	const glm::mat4& transform)
+{
+	glm::vec3 low(boundingBox[0], boundingBox[2], boundingBox[4]);
+	glm::vec3 high(boundingBox[1], boundingBox[3], boundingBox[5]);
+	glm::vec4 center = transform * glm::vec4((low + high) * 0.5f, 1.0f);
+	// the largest scaling of the transformation scales the radius
+	GLfloat scale = max(glm::length(glm::vec3(transform[0])),
+		max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	return BoundingSphere{ glm::vec3(center), 0.5f * glm::length(high - low) * scale };
+}
+
+SubMesh appendGeometry(MeshGeometry& target, const MeshGeometry& source,
+	const glm::mat4& transform)
+{
+	const VertexData layout = VertexData::POSITION | VertexData::UV | VertexData::NORMAL;
+	const int stride = layout.stride();
+	const GLuint firstVertex = target.vertices.size() / stride;
+
+	SubMesh subMesh{ GLuint(target.indices.size()), GLuint(source.indices.size()), {} };
+	for (int dim = 0; dim < 3; dim++)
+	{
+		subMesh.boundingBox[2 * dim] = numeric_limits<GLfloat>::max();
+		subMesh.boundingBox[2 * dim + 1] = numeric_limits<GLfloat>::lowest();
+	}
+
+	// normals transform with the inverse transpose of the model matrix
+	const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+	target.vertices.reserve(target.vertices.size() + source.vertices.size());
+	for (size_t i = 0; i < source.vertices.size(); i += stride)
+	{
+		const GLfloat* vertex = &source.vertices[i];
+		glm::vec4 position = transform * glm::vec4(
+			vertex[layout.positionOffset()],
+			vertex[layout.positionOffset() + 1],
+			vertex[layout.positionOffset() + 2], 1.0f);
+		glm::vec3 normal = normalMatrix * glm::vec3(
+			vertex[layout.normalOffset()],
+			vertex[layout.normalOffset() + 1],
+			vertex[layout.normalOffset() + 2]);
+		if (glm::length(normal) > 0.0f)
+			normal = glm::normalize(normal);
+
+		for (int dim = 0; dim < 3; dim++)
+		{
+			subMesh.boundingBox[2 * dim] = min(subMesh.boundingBox[2 * dim], position[dim]);
+			subMesh.boundingBox[2 * dim + 1] = max(subMesh.boundingBox[2 * dim + 1], position[dim]);
+		}
+
+		target.vertices.insert(target.vertices.end(), { position.x, position.y, position.z,
+			vertex[layout.uvOffset()], vertex[layout.uvOffset() + 1],
+			normal.x, normal.y, normal.z });
+	}
+
+	target.indices.reserve(target.indices.size() + source.indices.size());
+	for (GLuint index : source.indices)
+		target.indices.push_back(firstVertex + index);
+
+	return subMesh;
+}
+
 // ==============================================================================
 // =====================          MESH CLASS       ==============================
 // ==============================================================================
@@ -8,6 +77,9 @@ Mesh::Mesh(const std::vector<GLfloat>& vertices,
 	const std::vector<GLuint>& indices, VertexData vertexData)
 {
 	GLuint numVertices = vertices.size();
+	// nothing to upload or draw; the GL objects stay 0
+	if (vertices.empty() || indices.empty())
+		return;
 	m_numIndices = indices.size();
 
 	// create a Vertex Array Object on the GPU and store its number
@@ -20,7 +92,7 @@ Mesh::Mesh(const std::vector<GLfloat>& vertices,
 	// activate VBO
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
 	// copy vertices to the GPU
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * numVertices, &vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * numVertices, vertices.data(), GL_STATIC_DRAW);
 
 	if (vertexData.has(VertexData::POSITION)) {
 		// map position to (location = 0) in vertex shader
@@ -54,7 +126,29 @@ Mesh::Mesh(const std::vector<GLfloat>& vertices,
 	// activate EBO
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
 	// copy elements' indices to the GPU
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * m_numIndices, &indices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * m_numIndices, indices.data(), GL_STATIC_DRAW);
+
+	// split positions out of the interleaved data into their own stream
+	if (vertexData.has(VertexData::POSITION) && vertexData.stride() > 3)
+	{
+		vector<GLfloat> positions;
+		positions.reserve(3 * numVertices / vertexData.stride());
+		for (GLuint i = 0; i < numVertices; i += vertexData.stride())
+			positions.insert(positions.end(), {
+				vertices[i + vertexData.positionOffset()],
+				vertices[i + vertexData.positionOffset() + 1],
+				vertices[i + vertexData.positionOffset() + 2] });
+
+		glGenVertexArrays(1, &m_positionVAO);
+		glBindVertexArray(m_positionVAO);
+		glGenBuffers(1, &m_positionVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, m_positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(positions[0]) * positions.size(), positions.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		// share the index buffer with the main VAO
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+	}
 
 	// Not strictly necessary but good practice 
 	glBindVertexArray(0);
@@ -62,6 +156,10 @@ Mesh::Mesh(const std::vector<GLfloat>& vertices,
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+Mesh::Mesh(const MeshGeometry& geometry, VertexData vertexData) :
+	Mesh(geometry.vertices, geometry.indices, vertexData)
+{}
+
 Mesh::~Mesh()
 {
 	// free GPU memory
@@ -71,21 +169,31 @@ Mesh::~Mesh()
 		glDeleteBuffers(1, &m_VBO);
 	if (m_VAO != 0)
 		glDeleteVertexArrays(1, &m_VAO);
+	if (m_positionVBO != 0)
+		glDeleteBuffers(1, &m_positionVBO);
+	if (m_positionVAO != 0)
+		glDeleteVertexArrays(1, &m_positionVAO);
 }
 
 Mesh::Mesh(Mesh&& other) noexcept :
 	m_VAO(other.m_VAO),
 	m_VBO(other.m_VBO),
 	m_EBO(other.m_EBO),
+	m_positionVAO(other.m_positionVAO),
+	m_positionVBO(other.m_positionVBO),
 	m_numIndices(other.m_numIndices)
 {
 	other.m_VAO = 0;
 	other.m_VBO = 0;
 	other.m_EBO = 0;
+	other.m_positionVAO = 0;
+	other.m_positionVBO = 0;
 }
 
 void Mesh::render() const
 {
+	if (m_numIndices == 0)
+		return;
 	// bind VAO (also activates VBO and EBO)
 	glBindVertexArray(m_VAO);
 	// 0 is the offset from the beginning of the index array
@@ -93,3 +201,196 @@ void Mesh::render() const
 	// deactivate VAO
 	glBindVertexArray(0);
 }
+
+void Mesh::renderPositions() const
+{
+	if (m_numIndices == 0)
+		return;
+	// a position-only mesh can use its main VAO
+	glBindVertexArray(m_positionVAO != 0 ? m_positionVAO : m_VAO);
+	glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+}
+
+void Mesh::render(GLuint firstIndex, GLuint numIndices) const
+{
+	if (numIndices == 0)
+		return;
+	glBindVertexArray(m_VAO);
+	// the offset is given in bytes from the beginning of the index array
+	glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT,
+		(void*)(sizeof(GLuint) * firstIndex));
+	glBindVertexArray(0);
+}
+
+// ==============================================================================
+// =====================      GEOMETRY POOL        ==============================
+// ==============================================================================
+
+GeometryPool::~GeometryPool()
+{
+	if (m_EBO != 0)
+		glDeleteBuffers(1, &m_EBO);
+	if (m_VBO != 0)
+		glDeleteBuffers(1, &m_VBO);
+	if (m_VAO != 0)
+		glDeleteVertexArrays(1, &m_VAO);
+}
+
+PooledMesh GeometryPool::add(const MeshGeometry& geometry)
+{
+	auto it = m_meshes.find(&geometry);
+	if (it != m_meshes.end())
+		return it->second;
+
+	const int stride = VertexData(VertexData::POSITION | VertexData::UV | VertexData::NORMAL).stride();
+	PooledMesh pooled{ GLuint(m_geometry.indices.size()), GLuint(geometry.indices.size()),
+		GLint(m_geometry.vertices.size() / stride) };
+	m_geometry.vertices.insert(m_geometry.vertices.end(), geometry.vertices.begin(), geometry.vertices.end());
+	m_geometry.indices.insert(m_geometry.indices.end(), geometry.indices.begin(), geometry.indices.end());
+	m_meshes.emplace(&geometry, pooled);
+	return pooled;
+}
+
+void GeometryPool::upload()
+{
+	const VertexData vertexData(VertexData::POSITION | VertexData::UV | VertexData::NORMAL);
+	const GLsizei stride = sizeof(GLfloat) * vertexData.stride();
+
+	glGenVertexArrays(1, &m_VAO);
+	glBindVertexArray(m_VAO);
+
+	glGenBuffers(1, &m_VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * m_geometry.vertices.size(),
+		m_geometry.vertices.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+		(void*)(sizeof(GLfloat) * vertexData.positionOffset()));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+		(void*)(sizeof(GLfloat) * vertexData.uvOffset()));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
+		(void*)(sizeof(GLfloat) * vertexData.normalOffset()));
+
+	glGenBuffers(1, &m_EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * m_geometry.indices.size(),
+		m_geometry.indices.data(), GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	m_geometry = MeshGeometry();
+}
+
+// ==============================================================================
+// =====================     GEOMETRY REGISTRY     ==============================
+// ==============================================================================
+
+SharedMesh::SharedMesh(const MeshGeometry& geometry, VertexData meshVertexData) :
+	vertexData(meshVertexData),
+	mesh(geometry, vertexData)
+{}
+
+namespace
+{
+	size_t geometryBytes(const MeshGeometry& geometry)
+	{
+		return sizeof(GLfloat) * geometry.vertices.size() +
+			sizeof(GLuint) * geometry.indices.size();
+	}
+
+	uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+	{
+		const auto* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// Compare bit patterns like the hash does; comparing floats would tell
+	// -0.0 from +0.0 apart in the hash but not in the comparison, and NaN never equals itself
+	template <typename T>
+	bool sameBytes(const vector<T>& a, const vector<T>& b)
+	{
+		return a.size() == b.size() &&
+			(a.empty() || memcmp(a.data(), b.data(), sizeof(T) * a.size()) == 0);
+	}
+}
+
+uint64_t hashGeometry(const MeshGeometry& geometry)
+{
+	uint64_t hash = 14695981039346656037ull;
+	// hash sizes too, so that the vertex/index split matters
+	const uint64_t sizes[2] = { geometry.vertices.size(), geometry.indices.size() };
+	hash = hashBytes(hash, sizes, sizeof(sizes));
+	hash = hashBytes(hash, geometry.vertices.data(), sizeof(GLfloat) * geometry.vertices.size());
+	hash = hashBytes(hash, geometry.indices.data(), sizeof(GLuint) * geometry.indices.size());
+	return hash;
+}
+
+GeometryRegistry& GeometryRegistry::shared()
+{
+	static GeometryRegistry registry;
+	return registry;
+}
+
+MeshHandle GeometryRegistry::acquire(const MeshGeometry& geometry, VertexData vertexData)
+{
+	const uint64_t hash = hashGeometry(geometry);
+
+	lock_guard<mutex> lock(m_mutex);
+	auto [first, last] = m_meshes.equal_range(hash);
+	for (auto it = first; it != last; )
+	{
+		MeshHandle existing = it->second.mesh.lock();
+		if (!existing)
+		{
+			// the Mesh was freed, forget about it
+			it = m_meshes.erase(it);
+			continue;
+		}
+		// compare the data itself in case of a hash collision; without a CPU copy
+		// the Mesh is not shared, rather than reading it back from the GPU
+		const optional<MeshGeometry>& uploaded = it->second.geometry;
+		if (uploaded && existing->vertexData.value() == vertexData.value() &&
+			sameBytes(uploaded->vertices, geometry.vertices) && sameBytes(uploaded->indices, geometry.indices))
+		{
+			m_bytesSaved += geometryBytes(geometry);
+			return existing;
+		}
+		++it;
+	}
+
+	auto mesh = make_shared<const SharedMesh>(geometry, vertexData);
+	m_meshes.emplace(hash, Entry{ mesh, geometry });
+	return mesh;
+}
+
+void GeometryRegistry::releaseGeometry()
+{
+	lock_guard<mutex> lock(m_mutex);
+	for (auto& [hash, entry] : m_meshes)
+		entry.geometry.reset();
+}
+
+size_t GeometryRegistry::bytesSaved() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_bytesSaved;
+}
+
+size_t GeometryRegistry::numMeshes() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	size_t count = 0;
+	for (const auto& [hash, entry] : m_meshes)
+		count += !entry.mesh.expired();
+	return count;
+}
@@ -9,7 +9,11 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <unordered_map>
+
 #include "Config.h"
+#include "FlightRecorder.h"
+#include "Profiler.h"
 #include "Utils.h"
 
 // ==============================================================================
@@ -42,6 +46,8 @@ Texture& Texture::operator=(Texture&& other) & noexcept
 
 void Texture::loadTexture(const string& fileName)
 {
+	PROFILE_ZONE("Texture::loadTexture");
+	FlightEvent event("upload", "texture " + fileName);
 	// image properties
 	GLint width, height, bitDepth;
 
@@ -92,25 +98,30 @@ void Texture::deleteTexture()
 // =======================          MODEL CLASS     =============================
 // ==============================================================================
 
-Model::Model(const string& modelName) :
+Model::Model(const string& modelName, bool batchMeshes) :
 	m_name(modelName)
 {
+	PROFILE_ZONE("Model::Model");
 	resetBoundingBox();
 	loadModel();
+	if (batchMeshes)
+		batchMeshesByMaterial();
+	uploadMeshes();
 }
 
 void Model::resetBoundingBox()
 {
 	m_boundingBox[0] = numeric_limits<GLfloat>::max();
-	m_boundingBox[1] = numeric_limits<GLfloat>::min();
+	m_boundingBox[1] = numeric_limits<GLfloat>::lowest();
 	m_boundingBox[2] = numeric_limits<GLfloat>::max();
-	m_boundingBox[3] = numeric_limits<GLfloat>::min();
+	m_boundingBox[3] = numeric_limits<GLfloat>::lowest();
 	m_boundingBox[4] = numeric_limits<GLfloat>::max();
-	m_boundingBox[5] = numeric_limits<GLfloat>::min();
+	m_boundingBox[5] = numeric_limits<GLfloat>::lowest();
 }
 
 void Model::loadModel()
 {
+	PROFILE_ZONE("Model::loadModel");
 	Assimp::Importer importer;
 	// flag to remove normals during import
 	importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, aiComponent_NORMALS);
@@ -189,15 +200,56 @@ void Model::loadMesh(aiMesh* mesh, const aiScene* scene)
 		for (GLuint j = 0; j < 3; j++)
 			indices[3 * i + j] = mesh->mFaces[i].mIndices[j];
 
-	// create a Mesh from vertices and indices
-	m_meshes.emplace_back(vertices, indices, 
-		VertexData::POSITION | VertexData::UV | VertexData::NORMAL);
+	// keep the geometry until all meshes are loaded (and possibly batched)
+	MeshGeometry geometry;
+	m_subMeshes.push_back({ appendGeometry(geometry, MeshGeometry{ move(vertices), move(indices) }) });
+	m_geometry.push_back(move(geometry));
 	// save a texture index that this Mesh uses
 	m_meshToMaterial.push_back(mesh->mMaterialIndex);
 }
 
-Texture Model::loadTexture(aiMaterial* material) const
+void Model::batchMeshesByMaterial()
+{
+	vector<MeshGeometry> batchedGeometry;
+	vector<vector<SubMesh>> batchedSubMeshes;
+	vector<GLuint> batchedMeshToMaterial;
+	// material index -> batch index
+	unordered_map<GLuint, size_t> materialToBatch;
+
+	for (size_t i = 0; i < m_geometry.size(); i++)
+	{
+		auto [it, isNew] = materialToBatch.try_emplace(m_meshToMaterial[i], batchedGeometry.size());
+		if (isNew)
+		{
+			batchedGeometry.emplace_back();
+			batchedSubMeshes.emplace_back();
+			batchedMeshToMaterial.push_back(m_meshToMaterial[i]);
+		}
+		batchedSubMeshes[it->second].push_back(
+			appendGeometry(batchedGeometry[it->second], m_geometry[i]));
+	}
+
+	debugOutput(m_name + ": batched " + to_string(m_geometry.size()) + " meshes into " +
+		to_string(batchedGeometry.size()));
+
+	m_geometry = move(batchedGeometry);
+	m_subMeshes = move(batchedSubMeshes);
+	m_meshToMaterial = move(batchedMeshToMaterial);
+}
+
+void Model::uploadMeshes()
+{
+	PROFILE_ZONE("Model::uploadMeshes");
+	FlightEvent event("upload", "meshes of " + m_name);
+	m_meshes.reserve(m_geometry.size());
+	for (const auto& geometry : m_geometry)
+		m_meshes.push_back(GeometryRegistry::shared().acquire(geometry,
+			VertexData::POSITION | VertexData::UV | VertexData::NORMAL));
+}
+
+Texture Model::loadTexture(aiMaterial* material, bool& textured) const
 {
+	textured = true;
 	if (material->GetTextureCount(aiTextureType_DIFFUSE))
 	{
 		aiString path;
@@ -214,6 +266,7 @@ Texture Model::loadTexture(aiMaterial* material) const
 	
 	debugOutput(m_name + "/" + string(material->GetName().data) +
 			": using default texture.");
+	textured = false;
 	return Texture(TEXTURES_DIR + "default.png");
 }
 
@@ -224,7 +277,8 @@ void Model::loadMaterials(const aiScene* scene)
 	for (GLuint i = 0; i < scene->mNumMaterials; i++)
 	{
 		aiMaterial* material = scene->mMaterials[i];
-		Texture texture = loadTexture(material);
+		bool textured;
+		Texture texture = loadTexture(material, textured);
 
 		aiColor3D color;
 		material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
@@ -235,30 +289,59 @@ void Model::loadMaterials(const aiScene* scene)
 		m_materials[i] = Material{ 
 			move(texture),
 			glm::vec3{color.r,color.g,color.b},
-			shininess };
+			shininess,
+			textured };
 	}
 }
 
-void Model::render(GLuint shader) const
+void Model::recordDraws(const UniformSlots& drawData, size_t& slot, const MaterialTable& materials,
+	const glm::mat4& modelMatrix, const glm::mat3& normalMatrix, bool textured,
+	CommandBuffer& commands) const
 {
 	for (size_t i = 0; i < m_meshes.size(); i++)
-	{
-		m_materials[m_meshToMaterial[i]].activate(shader);
-		//m_materials[m_meshToMaterial[i]]->activate();
-		m_meshes[i].render();
-	}
+		if (material(i).m_textured == textured)
+		{
+			DrawData data = makeDrawData(modelMatrix, normalMatrix, materials.index(material(i)));
+			commands.setDrawData(drawData.write(slot++, &data, sizeof(data)));
+			commands.draw(m_meshes[i]->mesh);
+		}
+}
+
+bool Model::hasMeshes(bool textured) const
+{
+	for (size_t i = 0; i < m_meshes.size(); i++)
+		if (material(i).m_textured == textured)
+			return true;
+	return false;
+}
+
+size_t Model::numMeshes(bool textured) const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < m_meshes.size(); i++)
+		if (material(i).m_textured == textured)
+			count++;
+	return count;
+}
+
+void Model::renderDepth() const
+{
+	for (const auto& mesh : m_meshes)
+		mesh->mesh.renderPositions();
 }
 
 // ==============================================================================
-// ==============          MATERIAL CLASS     ===================================
+// ==============          DRAW DATA          ===================================
 // ==============================================================================
 
-void Material::activate(GLuint shader) const
+DrawData makeDrawData(const glm::mat4& modelMatrix, const glm::mat3& normalMatrix, GLuint materialIndex)
 {
-	m_texture.activate();
-	glUniform1f(glGetUniformLocation(shader, "material.shininess"), m_shininess);
-	glUniform3f(glGetUniformLocation(shader, "material.diffuseColor"),
-		m_diffuseColor.x, m_diffuseColor.y, m_diffuseColor.z);
+	DrawData data{};
+	data.model = modelMatrix;
+	for (int i = 0; i < 3; i++)
+		data.normalMatrix[i] = glm::vec4(normalMatrix[i], 0.0f);
+	data.materialIndex = materialIndex;
+	return data;
 }
 
 // ==============================================================================
@@ -275,14 +358,78 @@ ModelInstance::ModelInstance(const Model& model,
 		glm::vec3(posX, posY, posZ));
 	m_modelMatrix = glm::scale(m_modelMatrix,
 		glm::vec3(scale, scale, scale));
+	// for translation and uniform scale, the inverse transpose is just 1/scale
+	m_normalMatrix = glm::mat3(1.0f / scale);
+	m_boundingSphere = ::boundingSphere(model.boundingBox(), m_modelMatrix);
+}
+
+void ModelInstance::recordDraws(const UniformSlots& drawData, size_t& slot, const MaterialTable& materials,
+	bool textured, CommandBuffer& commands) const
+{
+	m_model.recordDraws(drawData, slot, materials, m_modelMatrix, m_normalMatrix, textured, commands);
+}
+
+void ModelInstance::renderDepth(GLint modelLocation) const
+{
+	glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(m_modelMatrix));
+	m_model.renderDepth();
+}
+
+// ==============================================================================
+// ==============          STATIC BATCH CLASS     ===============================
+// ==============================================================================
+
+StaticBatch::StaticBatch(const Model& model, const vector<glm::mat4>& modelMatrices) :
+	m_model(model)
+{
+	m_meshes.reserve(model.numMeshes());
+	m_geometry.resize(model.numMeshes());
+	m_subMeshes.resize(model.numMeshes());
+	for (size_t i = 0; i < model.numMeshes(); i++)
+	{
+		// bake each instance transform into a world-space copy of the geometry
+		for (const auto& modelMatrix : modelMatrices)
+			m_subMeshes[i].push_back(appendGeometry(m_geometry[i], model.geometry(i), modelMatrix));
+
+		m_meshes.push_back(GeometryRegistry::shared().acquire(m_geometry[i],
+			VertexData::POSITION | VertexData::UV | VertexData::NORMAL));
+	}
+
+	// bounding box of all instances
+	array<GLfloat, 6> boundingBox;
+	for (int dim = 0; dim < 3; dim++)
+	{
+		boundingBox[2 * dim] = numeric_limits<GLfloat>::max();
+		boundingBox[2 * dim + 1] = numeric_limits<GLfloat>::lowest();
+	}
+	for (const auto& subMeshes : m_subMeshes)
+		for (const auto& subMesh : subMeshes)
+			for (int dim = 0; dim < 3; dim++)
+			{
+				boundingBox[2 * dim] = min(boundingBox[2 * dim], subMesh.boundingBox[2 * dim]);
+				boundingBox[2 * dim + 1] = max(boundingBox[2 * dim + 1], subMesh.boundingBox[2 * dim + 1]);
+			}
+	m_boundingSphere = ::boundingSphere(boundingBox);
 }
 
-void ModelInstance::render(GLuint shader) const
+void StaticBatch::recordDraws(const UniformSlots& drawData, size_t& slot, const MaterialTable& materials,
+	bool textured, CommandBuffer& commands) const
 {
-	// send model matrix to the GPU
-	glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE,
-		glm::value_ptr(m_modelMatrix));
-	// render the model
-	m_model.render(shader);
+	for (size_t i = 0; i < m_meshes.size(); i++)
+		if (m_model.material(i).m_textured == textured)
+		{
+			// geometry is already in world space
+			DrawData data = makeDrawData(glm::mat4(1.0f), glm::mat3(1.0f),
+				materials.index(m_model.material(i)));
+			commands.setDrawData(drawData.write(slot++, &data, sizeof(data)));
+			commands.draw(m_meshes[i]->mesh);
+		}
 }
 
+void StaticBatch::renderDepth(GLint modelLocation) const
+{
+	glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+
+	for (const auto& mesh : m_meshes)
+		mesh->mesh.renderPositions();
+}
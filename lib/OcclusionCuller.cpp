@@ -0,0 +1,292 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RENDGL_USE_SSE
+#endif
+
+#include "JobSystem.h"
+
+namespace
+{
+    // vertices closer to the eye than this are treated as crossing the near plane
+    constexpr GLfloat MIN_W = 1e-5f;
+    // an occluder triangle is clipped into at most two triangles
+    constexpr size_t MAX_CLIPPED_VERTICES = 6;
+
+    // Coefficients of an edge function A * x + B * y + C, positive left of the edge a -> b
+    struct Edge
+    {
+        GLfloat a, b, c;
+    };
+
+    template <typename Vertex>
+    Edge makeEdge(const Vertex& from, const Vertex& to)
+    {
+        GLfloat a = from.y - to.y;
+        GLfloat b = to.x - from.x;
+        return { a, b, -(a * from.x + b * from.y) };
+    }
+}
+
+OcclusionCuller::OcclusionCuller(int width, int height) :
+    m_width((width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE),
+    m_height((height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE),
+    m_tilesX(m_width / TILE_SIZE),
+    m_tilesY(m_height / TILE_SIZE),
+    m_viewProjection(1.0f),
+    m_depth(size_t(m_width) * m_height, 0.0f),
+    m_tileDepth(size_t(m_tilesX) * m_tilesY, 0.0f)
+{
+    if (width <= 0 || height <= 0 || width % 4 != 0)
+        throw std::runtime_error("OcclusionCuller: width must be a positive multiple of 4");
+}
+
+void OcclusionCuller::addOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices)
+{
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        for (size_t j = i; j < i + 3; j++)
+        {
+            if (indices[j] >= positions.size())
+                throw std::runtime_error("OcclusionCuller: occluder index out of range");
+            m_triangles.push_back(positions[indices[j]]);
+        }
+    }
+}
+
+void OcclusionCuller::clearOccluders()
+{
+    m_triangles.clear();
+    m_screenVertices.clear();
+    m_numClipped.clear();
+}
+
+void OcclusionCuller::render(const glm::mat4& viewProjection)
+{
+    m_viewProjection = viewProjection;
+
+    const size_t numTriangles = numOccluderTriangles();
+    m_screenVertices.resize(numTriangles * MAX_CLIPPED_VERTICES);
+    m_numClipped.resize(numTriangles);
+    parallelFor(numTriangles, 1024, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            clipTriangle(i);
+    });
+
+    // every thread owns whole rows of tiles, so no pixel is written twice at the same time
+    parallelFor(m_tilesY, 2, [&](size_t first, size_t last) {
+        rasterizeTileRows(int(first), int(last));
+        updateTiles(int(first), int(last));
+    });
+}
+
+void OcclusionCuller::clipTriangle(size_t triangle)
+{
+    glm::vec4 clip[3];
+    // signed distance to the near plane z = -w, positive in front of it
+    GLfloat distance[3];
+    for (int i = 0; i < 3; i++)
+    {
+        clip[i] = m_viewProjection * glm::vec4(m_triangles[triangle * 3 + i], 1.0f);
+        distance[i] = clip[i].z + clip[i].w;
+    }
+
+    // the part of the triangle beyond the near plane: nothing, a triangle or a quad
+    glm::vec4 polygon[4];
+    int numVertices = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const int next = (i + 1) % 3;
+        if (distance[i] >= 0.0f)
+            polygon[numVertices++] = clip[i];
+        if ((distance[i] >= 0.0f) != (distance[next] >= 0.0f))
+            polygon[numVertices++] = clip[i] + (clip[next] - clip[i]) * (distance[i] / (distance[i] - distance[next]));
+    }
+    // only a projection without a near plane in front of the eye leaves vertices at w <= 0
+    for (int i = 0; i < numVertices; i++)
+        if (polygon[i].w <= MIN_W)
+            numVertices = 0;
+
+    ScreenVertex* screen = &m_screenVertices[triangle * MAX_CLIPPED_VERTICES];
+    uint8_t numClipped = 0;
+    for (int i = 1; i + 1 < numVertices; i++, numClipped++)
+    {
+        *screen++ = toScreen(polygon[0]);
+        *screen++ = toScreen(polygon[i]);
+        *screen++ = toScreen(polygon[i + 1]);
+    }
+    m_numClipped[triangle] = numClipped;
+}
+
+OcclusionCuller::ScreenVertex OcclusionCuller::toScreen(const glm::vec4& clip) const
+{
+    ScreenVertex vertex;
+    vertex.invW = 1.0f / clip.w;
+    vertex.x = (clip.x * vertex.invW * 0.5f + 0.5f) * m_width;
+    vertex.y = (clip.y * vertex.invW * 0.5f + 0.5f) * m_height;
+    return vertex;
+}
+
+void OcclusionCuller::rasterizeTileRows(int firstTileRow, int lastTileRow)
+{
+    const int rowBegin = firstTileRow * TILE_SIZE;
+    const int rowEnd = lastTileRow * TILE_SIZE;
+    std::fill(m_depth.begin() + size_t(rowBegin) * m_width, m_depth.begin() + size_t(rowEnd) * m_width, 0.0f);
+
+    for (size_t triangle = 0; triangle < m_numClipped.size(); triangle++)
+    {
+        const ScreenVertex* v = &m_screenVertices[triangle * MAX_CLIPPED_VERTICES];
+        for (uint8_t i = 0; i < m_numClipped[triangle]; i++, v += 3)
+            rasterizeTriangle(v[0], v[1], v[2], rowBegin, rowEnd);
+    }
+}
+
+void OcclusionCuller::rasterizeTriangle(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2,
+    int rowBegin, int rowEnd)
+{
+    // occluders are drawn from both sides
+    GLfloat area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (std::abs(area) < 1e-8f)
+        return;
+    const ScreenVertex& a = v0;
+    const ScreenVertex& b = area > 0.0f ? v1 : v2;
+    const ScreenVertex& c = area > 0.0f ? v2 : v1;
+    area = std::abs(area);
+
+    // pixels whose centers may lie in the triangle
+    int xMin = std::max(int(std::ceil(std::min({ a.x, b.x, c.x }) - 0.5f)), 0);
+    int xMax = std::min(int(std::floor(std::max({ a.x, b.x, c.x }) - 0.5f)), m_width - 1);
+    int yMin = std::max(int(std::ceil(std::min({ a.y, b.y, c.y }) - 0.5f)), rowBegin);
+    int yMax = std::min(int(std::floor(std::max({ a.y, b.y, c.y }) - 0.5f)), rowEnd - 1);
+    if (xMin > xMax || yMin > yMax)
+        return;
+
+    const Edge e0 = makeEdge(b, c), e1 = makeEdge(c, a), e2 = makeEdge(a, b);
+    // 1/w is linear in screen space; the weights of the vertices are the edge functions
+    // of the opposite edges divided by the area
+    const GLfloat zA = (e0.a * a.invW + e1.a * b.invW + e2.a * c.invW) / area;
+    const GLfloat zB = (e0.b * a.invW + e1.b * b.invW + e2.b * c.invW) / area;
+    const GLfloat zC = (e0.c * a.invW + e1.c * b.invW + e2.c * c.invW) / area;
+
+    // rows are processed in blocks of 4 pixels; the width is a multiple of 4
+    const int xStart = xMin & ~3;
+    for (int y = yMin; y <= yMax; y++)
+    {
+        const GLfloat py = y + 0.5f;
+        GLfloat* row = &m_depth[size_t(y) * m_width];
+        int x = xStart;
+#ifdef RENDGL_USE_SSE
+        const __m128 step = _mm_set1_ps(4.0f);
+        __m128 px = _mm_setr_ps(x + 0.5f, x + 1.5f, x + 2.5f, x + 3.5f);
+        const __m128 row0 = _mm_set1_ps(e0.b * py + e0.c);
+        const __m128 row1 = _mm_set1_ps(e1.b * py + e1.c);
+        const __m128 row2 = _mm_set1_ps(e2.b * py + e2.c);
+        const __m128 rowZ = _mm_set1_ps(zB * py + zC);
+        const __m128 zero = _mm_setzero_ps();
+        for (; x <= xMax; x += 4, px = _mm_add_ps(px, step))
+        {
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e0.a), px), row0);
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e1.a), px), row1);
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e2.a), px), row2);
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero),
+                _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), px), rowZ);
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearest = _mm_max_ps(old, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+        }
+#else
+        for (; x <= xMax; x++)
+        {
+            const GLfloat px = x + 0.5f;
+            if (e0.a * px + e0.b * py + e0.c < 0.0f ||
+                e1.a * px + e1.b * py + e1.c < 0.0f ||
+                e2.a * px + e2.b * py + e2.c < 0.0f)
+                continue;
+            row[x] = std::max(row[x], zA * px + zB * py + zC);
+        }
+#endif
+    }
+}
+
+void OcclusionCuller::updateTiles(int firstTileRow, int lastTileRow)
+{
+    for (int tileY = firstTileRow; tileY < lastTileRow; tileY++)
+    {
+        for (int tileX = 0; tileX < m_tilesX; tileX++)
+        {
+            GLfloat farthest = depth(tileX * TILE_SIZE, tileY * TILE_SIZE);
+            for (int y = tileY * TILE_SIZE; y < (tileY + 1) * TILE_SIZE; y++)
+                for (int x = tileX * TILE_SIZE; x < (tileX + 1) * TILE_SIZE; x++)
+                    farthest = std::min(farthest, depth(x, y));
+            m_tileDepth[size_t(tileY) * m_tilesX + tileX] = farthest;
+        }
+    }
+}
+
+bool OcclusionCuller::isOccluded(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+{
+    GLfloat xLow = GLfloat(m_width), xHigh = 0.0f;
+    GLfloat yLow = GLfloat(m_height), yHigh = 0.0f;
+    GLfloat nearest = 0.0f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 position((corner & 1) ? boxMax.x : boxMin.x,
+            (corner & 2) ? boxMax.y : boxMin.y,
+            (corner & 4) ? boxMax.z : boxMin.z);
+        glm::vec4 clip = m_viewProjection * glm::vec4(position, 1.0f);
+        // the box reaches the camera, so nothing can be in front of it
+        if (clip.w <= MIN_W || clip.z < -clip.w)
+            return false;
+
+        GLfloat invW = 1.0f / clip.w;
+        GLfloat x = (clip.x * invW * 0.5f + 0.5f) * m_width;
+        GLfloat y = (clip.y * invW * 0.5f + 0.5f) * m_height;
+        xLow = std::min(xLow, x);
+        xHigh = std::max(xHigh, x);
+        yLow = std::min(yLow, y);
+        yHigh = std::max(yHigh, y);
+        nearest = std::max(nearest, invW);
+    }
+
+    // every pixel the box touches
+    int xMin = std::max(int(std::floor(xLow)), 0);
+    int xMax = std::min(int(std::floor(xHigh)), m_width - 1);
+    int yMin = std::max(int(std::floor(yLow)), 0);
+    int yMax = std::min(int(std::floor(yHigh)), m_height - 1);
+    // boxes off the screen are left to frustum culling
+    if (xMin > xMax || yMin > yMax)
+        return false;
+
+    for (int tileY = yMin / TILE_SIZE; tileY <= yMax / TILE_SIZE; tileY++)
+    {
+        for (int tileX = xMin / TILE_SIZE; tileX <= xMax / TILE_SIZE; tileX++)
+        {
+            // the whole tile is in front of the box
+            if (m_tileDepth[size_t(tileY) * m_tilesX + tileX] > nearest)
+                continue;
+
+            int x0 = std::max(xMin, tileX * TILE_SIZE), x1 = std::min(xMax, (tileX + 1) * TILE_SIZE - 1);
+            int y0 = std::max(yMin, tileY * TILE_SIZE), y1 = std::min(yMax, (tileY + 1) * TILE_SIZE - 1);
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++)
+                    if (depth(x, y) <= nearest)
+                        return false;
+        }
+    }
+    return true;
+}
+
+bool OcclusionCuller::isOccluded(const BoundingSphere& sphere) const
+{
+    glm::vec3 extent(sphere.radius);
+    return isOccluded(sphere.center - extent, sphere.center + extent);
+}
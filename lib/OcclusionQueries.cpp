@@ -0,0 +1,89 @@
+#include "OcclusionQueries.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace
+{
+    const std::vector<GLfloat> BOX_VERTICES = {
+        -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,   1.0f, 1.0f, -1.0f,   -1.0f, 1.0f, -1.0f,
+        -1.0f, -1.0f, 1.0f,    1.0f, -1.0f, 1.0f,    1.0f, 1.0f, 1.0f,    -1.0f, 1.0f, 1.0f,
+    };
+    // counter-clockwise when seen from outside
+    const std::vector<GLuint> BOX_INDICES = {
+        0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,
+        0, 1, 5, 0, 5, 4,   3, 7, 6, 3, 6, 2,
+        0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5,
+    };
+}
+
+OcclusionQueries::OcclusionQueries(size_t numObjects, int numFrames) :
+    m_numFrames(size_t(numFrames)),
+    m_queries(numObjects * numFrames, 0),
+    m_pending(numObjects * numFrames, 0),
+    m_visible(numObjects, 1),
+    m_lastQuery(numObjects, 0),
+    m_box(BOX_VERTICES, BOX_INDICES, VertexData::POSITION)
+{
+    if (!m_queries.empty())
+        glGenQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+OcclusionQueries::~OcclusionQueries()
+{
+    if (!m_queries.empty())
+        glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+void OcclusionQueries::readResults()
+{
+    for (size_t object = 0; object < size(); object++)
+    {
+        // newest first; the oldest query is the one this frame reuses
+        for (size_t age = 1; age <= m_numFrames && age <= m_frame; age++)
+        {
+            size_t index = object * m_numFrames + (m_frame - age) % m_numFrames;
+            if (!m_pending[index])
+                continue;
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(m_queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+
+            GLuint anySamplesPassed;
+            glGetQueryObjectuiv(m_queries[index], GL_QUERY_RESULT, &anySamplesPassed);
+            m_visible[object] = anySamplesPassed != 0;
+            // older results are out of date
+            for (size_t frame = 0; frame < m_numFrames; frame++)
+                m_pending[object * m_numFrames + frame] = 0;
+            break;
+        }
+    }
+}
+
+void OcclusionQueries::query(size_t object, const glm::vec3& boxMin, const glm::vec3& boxMax, GLint modelLocation)
+{
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), 0.5f * (boxMin + boxMax));
+    model = glm::scale(model, 0.5f * (boxMax - boxMin));
+    glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+
+    GLuint query = queryAt(object, m_frame);
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+    m_box.renderPositions();
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    m_pending[object * m_numFrames + m_frame % m_numFrames] = 1;
+    m_lastQuery[object] = query;
+}
+
+void OcclusionQueries::markVisible(size_t object)
+{
+    m_visible[object] = 1;
+    m_lastQuery[object] = 0;
+    for (size_t frame = 0; frame < m_numFrames; frame++)
+        m_pending[object * m_numFrames + frame] = 0;
+}
+
+void OcclusionQueries::endFrame()
+{
+    m_frame++;
+}
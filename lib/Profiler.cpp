@@ -0,0 +1,199 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+    // Fields are relaxed atomics, so that writeChromeTrace may read a zone
+    // while its thread overwrites it; such zones are detected and dropped.
+    struct Zone
+    {
+        std::atomic<const char*> name{ nullptr };
+        std::atomic<uint64_t> start{ 0 };
+        std::atomic<uint64_t> end{ 0 };
+    };
+}
+
+// Ring of the zones of a thread or track. Only one thread writes; the ring outlives
+// the thread, so that its zones still appear in the trace.
+struct Profiler::Track
+{
+    explicit Track(int id) : id(id) {}
+
+    const int id;
+    // guarded by the registry mutex
+    std::string name;
+    // allocated on the first zone, so that threads that are never profiled cost nothing
+    std::unique_ptr<Zone[]> zones;
+    // zones whose writing began and zones that are complete
+    std::atomic<uint64_t> started{ 0 };
+    std::atomic<uint64_t> written{ 0 };
+};
+
+namespace
+{
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<Profiler::Track>> registry;
+    thread_local Profiler::Track* t_zones = nullptr;
+
+    // names made at run time; nodes of the set do not move
+    std::mutex namesMutex;
+    std::unordered_set<std::string> names;
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    // zones that started before the last start() are not written
+    std::atomic<uint64_t> recordingStart{ 0 };
+
+    Profiler::Track* newTrack()
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(std::make_unique<Profiler::Track>(int(registry.size()) + 1));
+        return registry.back().get();
+    }
+
+    Profiler::Track& localZones()
+    {
+        if (!t_zones)
+            t_zones = newTrack();
+        return *t_zones;
+    }
+
+    void writeEscaped(std::ostream& output, const char* text)
+    {
+        for (; *text; text++)
+        {
+            if (*text == '"' || *text == '\\')
+                output << '\\';
+            output << *text;
+        }
+    }
+}
+
+void Profiler::start()
+{
+    recordingStart.store(now(), std::memory_order_relaxed);
+    s_recording.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::stop()
+{
+    s_recording.store(false, std::memory_order_relaxed);
+}
+
+void Profiler::setThreadName(const std::string& name)
+{
+    Track& zones = localZones();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    zones.name = name;
+}
+
+Profiler::Track* Profiler::addTrack(const std::string& name)
+{
+    Track* track = newTrack();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    track->name = name;
+    return track;
+}
+
+const char* Profiler::internName(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(namesMutex);
+    return names.insert(name).first->c_str();
+}
+
+uint64_t Profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::record(const char* name, uint64_t start, uint64_t end)
+{
+    record(&localZones(), name, start, end);
+}
+
+void Profiler::record(Track* track, const char* name, uint64_t start, uint64_t end)
+{
+    Track& zones = *track;
+    if (!zones.zones)
+        zones.zones = std::make_unique<Zone[]>(ZONES_PER_THREAD);
+
+    // announce the index before overwriting its slot, see writeChromeTrace
+    const uint64_t index = zones.written.load(std::memory_order_relaxed);
+    zones.started.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Zone& zone = zones.zones[index % ZONES_PER_THREAD];
+    zone.name.store(name, std::memory_order_relaxed);
+    zone.start.store(start, std::memory_order_relaxed);
+    zone.end.store(end, std::memory_order_relaxed);
+    zones.written.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::writeChromeTrace(const std::string& fileName)
+{
+    std::ofstream output(fileName);
+    if (!output.is_open())
+        throw std::runtime_error("Profiler: failed to open " + fileName);
+
+    struct CopiedZone
+    {
+        const char* name;
+        uint64_t start, end;
+    };
+    std::vector<CopiedZone> copied;
+    const uint64_t firstStart = recordingStart.load(std::memory_order_relaxed);
+    // Chrome traces count in microseconds
+    auto microseconds = [](uint64_t nanoseconds) { return double(nanoseconds) / 1000.0; };
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    output << std::fixed << std::setprecision(3);
+    output << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& thread : registry)
+    {
+        output << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+               << thread->id << ",\"args\":{\"name\":\"";
+        writeEscaped(output, thread->name.empty() ? ("Thread " + std::to_string(thread->id)).c_str()
+                                                  : thread->name.c_str());
+        output << "\"}}";
+        first = false;
+
+        const uint64_t written = thread->written.load(std::memory_order_acquire);
+        if (written == 0)
+            continue;
+        const uint64_t oldest = written > ZONES_PER_THREAD ? written - ZONES_PER_THREAD : 0;
+        copied.clear();
+        for (uint64_t index = oldest; index < written; index++)
+        {
+            const Zone& zone = thread->zones[index % ZONES_PER_THREAD];
+            copied.push_back({ zone.name.load(std::memory_order_relaxed),
+                zone.start.load(std::memory_order_relaxed), zone.end.load(std::memory_order_relaxed) });
+        }
+        // the thread may have overwritten the oldest zones while they were copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t started = thread->started.load(std::memory_order_relaxed);
+        const uint64_t firstValid = started > ZONES_PER_THREAD ? started - ZONES_PER_THREAD : 0;
+
+        for (uint64_t index = std::max(oldest, firstValid); index < written; index++)
+        {
+            const CopiedZone& zone = copied[index - oldest];
+            if (zone.start < firstStart)
+                continue;
+            output << ",\n{\"name\":\"";
+            writeEscaped(output, zone.name);
+            output << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                   << ",\"ts\":" << microseconds(zone.start)
+                   << ",\"dur\":" << microseconds(zone.end - zone.start) << "}";
+        }
+    }
+    output << "\n]}\n";
+}
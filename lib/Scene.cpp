@@ -1,5 +1,6 @@
 #include "Scene.h"
 
+#include <atomic>
 #include <fstream>
 #include <vector>
 #include <unordered_map>
@@ -8,10 +9,24 @@
 #include <json.hpp>
 
 #include "Config.h"
+#include "AllocationAudit.h"
 #include "Shader.h"
 #include "Model.h"
 #include "Light.h"
 #include "Camera.h"
+#include "CommandBuffer.h"
+#include "DrawBundle.h"
+#include "FlightRecorder.h"
+#include "GBuffer.h"
+#include "GpuProfiler.h"
+#include "IndirectRenderer.h"
+#include "JobSystem.h"
+#include "MaterialTable.h"
+#include "OcclusionCuller.h"
+#include "OcclusionQueries.h"
+#include "Profiler.h"
+#include "TripleBuffer.h"
+#include "UniformRingBuffer.h"
 #include "Utils.h"
 
 #include <cstdlib>
@@ -22,13 +37,51 @@ namespace
         return float(rand())/float(RAND_MAX);
     }
 
+    // first of the three texture units for the G-buffer textures;
+    // 1-3 are for light buffers and 7-10 for material textures
+    constexpr GLuint GBUFFER_TEXTURE_UNIT = 4;
+
+    // uniform locations of the occlusion query box shader when it is loaded from SPIR-V
+    constexpr GLint QUERY_BOX_MODEL_LOCATION = 0;
+    constexpr GLint QUERY_BOX_VIEW_PROJECTION_LOCATION = 1;
+
+    // uniform block binding point of the per-draw data
+    constexpr GLuint DRAW_DATA_BINDING = 0;
+
+    // instances per command buffer at least; fewer are not worth a job
+    constexpr size_t MIN_RECORD_CHUNK = 64;
+
+    // GPU times of the passes cost a few queries per frame and join the CPU zones in traces
+#ifdef RENDGL_PROFILER
+    const char* const DEFAULT_GPU_TIMERS = "passes";
+#else
+    const char* const DEFAULT_GPU_TIMERS = "off";
+#endif
+
+    // Scene state that update hands over to render
+    struct FrameState
+    {
+        Camera camera;
+        // events of the frame, e.g. the keys and the size of the framebuffer
+        EventContainer events;
+        LightClusters lightClusters;
+        // the spot light as switched by the events up to this frame
+        bool spotLightOn{ false };
+        // for each instance, whether it passed occlusion culling
+        vector<char> instanceVisible;
+    };
+
     class Scene3D : public Scene
     {
     public:
         Scene3D(const nlohmann::json& sceneJson);
 
-        // Get fresh events and render the scene
-        void render(const EventContainer& events) override;
+        // Move the camera, switch and bin the lights and cull the instances for the next frame
+        void update(const EventContainer& events) override;
+        // Upload and draw the newest frame state
+        void render() override;
+
+        const GpuProfiler* gpuProfiler() const override { return m_gpuProfiler.get(); }
 
     private:
         void loadModels(const nlohmann::json& sceneJson);
@@ -36,22 +89,152 @@ namespace
         void loadLight(const nlohmann::json& sceneJson);
         void loadInstances(const nlohmann::json& sceneJson);
         void loadBackgroundColor(const nlohmann::json& sceneJson);
+        void loadStaticBatches(const unordered_map<string, vector<glm::mat4>>& staticInstances);
+        // Hand all draws to the IndirectRenderer if the scene asks for GPU culling
+        void createIndirectRenderer(const nlohmann::json& sceneJson);
+        // Rasterize the Meshes of an occluder instance on the CPU each frame
+        void addOccluder(const Model& model, const glm::mat4& modelMatrix);
+        // Test the instances against the occluders and mark the hidden ones
+        void cullOccludedInstances(FrameState& frame);
+        // Give the instances of the models listed in the scene an occlusion query each
+        void createOcclusionQueries(const nlohmann::json& sceneJson);
+        // Query the boxes of those instances against the depth of the frame
+        void issueOcclusionQueries(const FrameState& frame);
+        // False if the instance was culled or its last occlusion query found it hidden
+        bool isInstanceVisible(const FrameState& frame, size_t instance) const;
+        // Query from the previous frame to draw the instance on, 0 to draw unconditionally
+        GLuint conditionQuery(size_t instance) const;
+        // Size the per-draw ring buffer for the draws of one frame
+        void createDrawData();
+        // Measure the passes on the GPU and, with "models", the draws of each model
+        void createGpuProfiler(const nlohmann::json& sceneJson);
+        // Compile the shader variants that the scene can switch between in one batch
+        void precompileShaders();
+        // Give each ShaderLibrary a cheap stand-in for its variants that are not compiled yet
+        void enableAsyncCompilation();
+        ShaderProgram::CompileMode compileMode() const
+        {
+            return m_asyncShaders ? ShaderProgram::CompileMode::Deferred : ShaderProgram::CompileMode::Immediate;
+        }
+
+        // Defines of the shader variant for the given lights and kind of material.
+        // The result is kept until the next call with other defines.
+        const ShaderDefines& variantDefines(const ShaderDefines& defines, bool textured);
+        void resetFrame() const;
+        // Pass camera, view-projection and lights to a shader
+        void prepareShader(const ShaderProgram& shader, const FrameState& frame) const;
+        // Draw the Meshes with textured or untextured materials. Static content is
+        // replayed from a bundle; the commands of the rest are recorded on the worker
+        // threads, then replayed with the shader.
+        void renderInstances(const FrameState& frame, GLuint shader, bool textured);
+        // Record the draws of a range of the dynamic instances; the draw data of each
+        // instance goes to its own slots, so ranges can be recorded in parallel
+        void recordInstances(const FrameState& frame, const UniformSlots& drawData, bool textured,
+            size_t first, size_t last, CommandBuffer& commands) const;
+        void recordStaticBatches(const UniformSlots& drawData, size_t& slot, bool textured,
+            CommandBuffer& commands) const;
+        // Record the draws of an instance or a batch, in a GPU scope of its model if models are measured
+        template <typename Drawable>
+        void recordDraws(const Drawable& drawable, const UniformSlots& drawData, size_t& slot, bool textured,
+            CommandBuffer& commands) const;
+        // Record the static instances and batches into the bundle for textured or untextured materials
+        void recordBundle(bool textured);
+        // Lights of the following draws in the per-instance lighting mode
+        void recordInstanceLights(const BoundingSphere& bounds, CommandBuffer& commands) const;
+        // Draw the instances with shader variants for the given defines,
+        // one for textured and one for untextured materials. With the depth pre-pass enabled,
+        // depth is laid down first, so the shaders only run for visible fragments.
+        void renderShaded(ShaderLibrary& shaders, const ShaderDefines& defines,
+            const FrameState& frame);
+        void renderDepthPrepass(const FrameState& frame) const;
+        // Activate a position-only shader for the camera; returns the location of the model matrix
+        GLint prepareDepthShader(const ShaderProgram& shader, const FrameState& frame) const;
+        // False while a program of the async mode is compiling; finishes it once it is done
+        bool isProgramReady(ShaderProgram* program) const;
 
-        void resetFrame(const EventContainer& events) const;
+        void renderForward(const FrameState& frame);
+        // Geometry pass to the G-buffer, then a single lighting pass over the screen
+        void renderDeferred(const FrameState& frame);
 
     private:
-        ShaderProgram m_shader;
+        // variants of the forward shading shader
+        ShaderLibrary m_shaders;
+        // deferred shading is optional; its shaders and G-buffer are only created if used
+        bool m_deferred;
+        unique_ptr<ShaderLibrary> m_geometryPassShaders;
+        unique_ptr<ShaderLibrary> m_lightingPassShaders;
+        unique_ptr<GBuffer> m_gBuffer;
+        // depth-only pass before shading; its shader is only created if used.
+        // It is compiled from GLSL like the shading passes: their depth must match it
+        // bit for bit, which invariant gl_Position only promises within one compiler.
+        bool m_depthPrepass;
+        unique_ptr<ShaderProgram> m_depthPrepassShader;
+        // the same position-only shader for the occlusion query boxes, which are not
+        // compared for equality, so it may come from SPIR-V (see loadShaderProgram)
+        unique_ptr<ShaderProgram> m_queryBoxShader;
+        // don't wait for the compiler: shade with stand-in programs and skip
+        // the position-only passes until their programs are ready
+        bool m_asyncShaders;
 
+        // camera of the simulation; render uses the copy in the FrameState
         Camera m_camera;
         unordered_map<string, Model> m_models;
+        // materials and textures of all Models
+        MaterialTable m_materials;
         vector<ModelInstance> m_instances;
+        vector<StaticBatch> m_staticBatches;
+        // merge meshes and static instances at load time
+        bool m_staticBatching;
+        // per-draw uniforms of the frames in flight
+        unique_ptr<UniformRingBuffer> m_drawData;
+        // instances whose draws may change from frame to frame, e.g. when culled;
+        // with draw bundles, the others are only recorded once
+        vector<size_t> m_dynamicInstances;
+        vector<size_t> m_staticInstances;
+        // for untextured and textured materials, the first draw data slot of each dynamic instance,
+        // followed by the first slot of the static batches and the number of slots
+        array<vector<size_t>, 2> m_firstSlot;
+        // one for each range of dynamic instances and one for the static batches, replayed in order
+        vector<CommandBuffer> m_commandBuffers;
+        // replay static content instead of recording it every frame
+        bool m_drawBundles;
+        array<DrawBundle, 2> m_bundles;
+        // selection of the lights that the bundles were recorded with
+        array<unsigned, 2> m_bundleLightsVersion;
+        // GPU culling and indirect submission; only created if used and supported
+        unique_ptr<IndirectRenderer> m_indirectRenderer;
+        // CPU occlusion culling of the instances; only created if used
+        unique_ptr<OcclusionCuller> m_occlusionCuller;
+        // frame states from update to render
+        TripleBuffer<FrameState> m_frames;
+        // set once update has published a frame state
+        atomic<bool> m_hasFrame{ false };
+        // hardware occlusion queries of selected instances; only created if used
+        unique_ptr<OcclusionQueries> m_occlusionQueries;
+        // for each instance, the index of its query or -1
+        vector<int> m_instanceQuery;
+        // instance and world-space box (min, max) of each query
+        vector<size_t> m_queriedInstances;
+        vector<array<glm::vec3, 2>> m_queryBoxes;
+        // let the GPU skip hidden instances instead of reading the results back
+        bool m_conditionalRender;
         LightManager m_lights;
         glm::vec3 m_backgroundColor;
+        // for untextured and textured materials, the defines of the last variant and their input
+        array<ShaderDefines, 2> m_variantDefines;
+        array<ShaderDefines, 2> m_variantInput;
+        // GPU timer queries; only created if used and supported
+        unique_ptr<GpuProfiler> m_gpuProfiler;
+        // name of the GPU scope of each model, if the draws of models are measured
+        unordered_map<const Model*, const char*> m_modelScopes;
+        // frames of the GpuProfiler that were passed to the FlightRecorder
+        uint64_t m_gpuFramesRecorded{ 0 };
     };
 }
 
 std::unique_ptr<Scene> Scene::loadScene(const std::string& fileName)
 {
+    PROFILE_ZONE("Scene::loadScene");
     std::ifstream inputFile(fileName);
     if (!inputFile.is_open())
         throw std::runtime_error("Failed to open " + fileName);
@@ -67,29 +250,604 @@ std::unique_ptr<Scene> Scene::loadScene(const std::string& fileName)
 
 Scene::~Scene() = default;
 
-void Scene3D::render(const EventContainer& events)
+void Scene3D::update(const EventContainer& events)
 {
-    m_shader.activateShader();
-
-    resetFrame(events);
+    PROFILE_ZONE("Scene3D::update");
+    FlightPhase phase("Scene::update");
+    AllocationScope allocations("Scene::update");
     m_camera.processEvents(events);
     m_lights.processEvents(events);
-    
-    m_camera.talkToShader(m_shader.id());
-    m_lights.talkToShader(m_shader.id());
 
-    for (auto& it : m_instances)
-        it.render(m_shader.id());
+    // the writer owns this state until it is published
+    FrameState& frame = m_frames.writeBuffer();
+    frame.camera = m_camera;
+    frame.events = events;
+    frame.spotLightOn = m_lights.spotLightOn();
+    m_lights.buildClusters(frame.lightClusters, m_camera, events.aspectRatio());
+    frame.instanceVisible.assign(m_instances.size(), 1);
+    if (m_occlusionCuller)
+        cullOccludedInstances(frame);
+
+    m_frames.publish();
+    m_hasFrame = true;
+}
+
+void Scene3D::render()
+{
+    if (!m_hasFrame)
+        return;
+    PROFILE_ZONE("Scene3D::render");
+    FlightPhase phase("Scene::render");
+    AllocationScope allocations("Scene::render");
+    if (m_gpuProfiler)
+    {
+        m_gpuProfiler->beginFrame();
+        // the "Frame" scope of the newest frame that the GPU finished
+        if (m_gpuProfiler->numFramesRead() != m_gpuFramesRecorded)
+        {
+            m_gpuFramesRecorded = m_gpuProfiler->numFramesRead();
+            const GpuScopeTime& gpuFrame = m_gpuProfiler->lastFrame().front();
+            FlightRecorder::shared().addPhaseTime("GPU", gpuFrame.end - gpuFrame.start);
+        }
+    }
+    {
+        GpuScope gpuFrame(m_gpuProfiler.get(), "Frame");
+        const FrameState& frame = m_frames.read();
+        m_lights.uploadClusters(frame.lightClusters);
+
+        if (m_indirectRenderer)
+        {
+            GpuScope gpuCulling(m_gpuProfiler.get(), "GPU culling");
+            m_indirectRenderer->cull(frame.camera.frustumPlanes(frame.events.aspectRatio()));
+        }
+        if (m_occlusionQueries && !m_conditionalRender)
+            m_occlusionQueries->readResults();
+        m_drawData->beginFrame();
+        if (m_deferred)
+            renderDeferred(frame);
+        else
+            renderForward(frame);
+        m_drawData->endFrame();
+        if (m_occlusionQueries)
+            m_occlusionQueries->endFrame();
+    }
+    if (m_gpuProfiler)
+        m_gpuProfiler->endFrame();
+}
+
+void Scene3D::renderForward(const FrameState& frame)
+{
+    resetFrame();
+    renderShaded(m_shaders, m_lights.shaderDefines(frame.spotLightOn), frame);
+}
+
+void Scene3D::renderDeferred(const FrameState& frame)
+{
+    // geometry pass: store surface properties of the visible fragments
+    m_gBuffer->resize(frame.events.bufferWidth(), frame.events.bufferHeight());
+    m_gBuffer->bindFramebuffer();
+    {
+        GpuScope gpuGeometry(m_gpuProfiler.get(), "Geometry pass");
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderShaded(*m_geometryPassShaders, {}, frame);
+    }
+
+    // lighting pass: shade each pixel once, whatever the depth complexity
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    resetFrame();
+    GpuScope gpuLighting(m_gpuProfiler.get(), "Lighting pass");
+    glDisable(GL_DEPTH_TEST);
+    const ShaderProgram& lightingPassShader = m_lightingPassShaders->variant(m_lights.shaderDefines(frame.spotLightOn));
+    prepareShader(lightingPassShader, frame);
+    const GLuint shader = lightingPassShader.id();
+    m_gBuffer->bindTextures(GBUFFER_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shader, "gAlbedo"), GBUFFER_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shader, "gNormalShininess"), GBUFFER_TEXTURE_UNIT + 1);
+    glUniform1i(glGetUniformLocation(shader, "gDepth"), GBUFFER_TEXTURE_UNIT + 2);
+    glm::mat4 viewProjection = frame.camera.viewProjectionMatrix(frame.events.aspectRatio());
+    glUniformMatrix4fv(glGetUniformLocation(shader, "inverseViewProjection"), 1, GL_FALSE,
+        glm::value_ptr(glm::inverse(viewProjection)));
+    m_gBuffer->drawFullscreenTriangle();
+    glEnable(GL_DEPTH_TEST);
+}
+
+void Scene3D::renderShaded(ShaderLibrary& shaders, const ShaderDefines& defines,
+    const FrameState& frame)
+{
+    const bool depthPrepass = m_depthPrepass && isProgramReady(m_depthPrepassShader.get());
+    if (depthPrepass)
+    {
+        renderDepthPrepass(frame);
+        // depth is final: pass only the fragments that wrote it, don't write it again
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    for (bool textured : { false, true })
+    {
+        GpuScope gpuPass(m_gpuProfiler.get(), textured ? "Textured materials" : "Untextured materials");
+        const ShaderProgram& shader = shaders.variant(variantDefines(defines, textured));
+        prepareShader(shader, frame);
+        renderInstances(frame, shader.id(), textured);
+    }
+
+    if (depthPrepass)
+    {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    // the depth buffer now holds everything drawn this frame;
+    // without queries, the instances keep their last visibility
+    if (m_occlusionQueries && isProgramReady(m_queryBoxShader.get()))
+        issueOcclusionQueries(frame);
+}
+
+bool Scene3D::isProgramReady(ShaderProgram* program) const
+{
+    if (!program)
+        return false;
+    if (program->isPending())
+    {
+        if (!program->isReady())
+            return false;
+        program->finish();
+    }
+    return true;
+}
+
+GLint Scene3D::prepareDepthShader(const ShaderProgram& shader, const FrameState& frame) const
+{
+    shader.activateShader();
+    GLint modelLocation = shader.isSpirv() ? QUERY_BOX_MODEL_LOCATION :
+        glGetUniformLocation(shader.id(), "model");
+    GLint viewProjectionLocation = shader.isSpirv() ? QUERY_BOX_VIEW_PROJECTION_LOCATION :
+        glGetUniformLocation(shader.id(), "viewProjection");
+    glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE,
+        glm::value_ptr(frame.camera.viewProjectionMatrix(frame.events.aspectRatio())));
+    return modelLocation;
+}
+
+void Scene3D::renderDepthPrepass(const FrameState& frame) const
+{
+    PROFILE_ZONE("Scene3D::renderDepthPrepass");
+    GpuScope gpuPass(m_gpuProfiler.get(), "Depth prepass");
+    GLint modelLocation = prepareDepthShader(*m_depthPrepassShader, frame);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    if (m_indirectRenderer)
+    {
+        // the draws that survived GPU culling, from the IndirectRenderer's copy of the geometry
+        m_indirectRenderer->renderDepth();
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        return;
+    }
+    for (size_t i = 0; i < m_instances.size(); i++)
+        if (isInstanceVisible(frame, i))
+        {
+            GLuint condition = conditionQuery(i);
+            if (condition != 0)
+                glBeginConditionalRender(condition, GL_QUERY_NO_WAIT);
+            m_instances[i].renderDepth(modelLocation);
+            if (condition != 0)
+                glEndConditionalRender();
+        }
+    for (auto& it : m_staticBatches)
+        it.renderDepth(modelLocation);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void Scene3D::cullOccludedInstances(FrameState& frame)
+{
+    m_occlusionCuller->render(frame.camera.viewProjectionMatrix(frame.events.aspectRatio()));
+    parallelFor(m_instances.size(), 1024, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            frame.instanceVisible[i] = !m_occlusionCuller->isOccluded(m_instances[i].boundingSphere());
+    });
+}
+
+bool Scene3D::isInstanceVisible(const FrameState& frame, size_t instance) const
+{
+    if (!frame.instanceVisible[instance])
+        return false;
+    // with conditional rendering, the GPU decides
+    int query = m_instanceQuery[instance];
+    return query < 0 || m_conditionalRender || m_occlusionQueries->isVisible(query);
+}
+
+GLuint Scene3D::conditionQuery(size_t instance) const
+{
+    int query = m_instanceQuery[instance];
+    return query >= 0 && m_conditionalRender ? m_occlusionQueries->lastQuery(query) : 0;
+}
+
+void Scene3D::issueOcclusionQueries(const FrameState& frame)
+{
+    PROFILE_ZONE("Scene3D::issueOcclusionQueries");
+    GpuScope gpuPass(m_gpuProfiler.get(), "Occlusion queries");
+    GLint modelLocation = prepareDepthShader(*m_queryBoxShader, frame);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    // visible instances touch their own box
+    glDepthFunc(GL_LEQUAL);
+
+    // a box that reaches the near plane may be clipped away although the instance is visible
+    const glm::vec3 eye = frame.camera.position();
+    const glm::vec3 margin(2.0f * frame.camera.nearPlane());
+    for (size_t query = 0; query < m_queriedInstances.size(); query++)
+    {
+        const auto& box = m_queryBoxes[query];
+        const glm::vec3 low = box[0] - margin, high = box[1] + margin;
+        if (eye.x > low.x && eye.y > low.y && eye.z > low.z && eye.x < high.x && eye.y < high.y && eye.z < high.z)
+            m_occlusionQueries->markVisible(query);
+        else
+            m_occlusionQueries->query(query, box[0], box[1], modelLocation);
+    }
+
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void Scene3D::renderInstances(const FrameState& frame, GLuint shader, bool textured)
+{
+    if (m_indirectRenderer)
+    {
+        m_indirectRenderer->render(textured);
+        return;
+    }
+
+    if (m_drawBundles)
+    {
+        if (!m_bundles[textured].isRecorded() || m_bundleLightsVersion[textured] != m_lights.selectionVersion())
+            recordBundle(textured);
+        m_bundles[textured].replay(DRAW_DATA_BINDING, m_lights, shader, m_gpuProfiler.get());
+    }
+
+    const vector<size_t>& firstSlot = m_firstSlot[textured];
+    const UniformSlots drawData = m_drawData->reserve(firstSlot.back(), sizeof(DrawData));
+    const size_t numRanges = m_commandBuffers.size() - 1;
+    const size_t numDynamic = m_dynamicInstances.size();
+    parallelFor(m_commandBuffers.size(), 1, [&](size_t first, size_t last) {
+        PROFILE_ZONE("Scene3D::recordInstances");
+        for (size_t range = first; range < last; range++)
+        {
+            CommandBuffer& commands = m_commandBuffers[range];
+            commands.clear();
+            if (range < numRanges)
+                recordInstances(frame, drawData, textured, range * numDynamic / numRanges,
+                    (range + 1) * numDynamic / numRanges, commands);
+            else if (!m_drawBundles)
+            {
+                size_t slot = firstSlot[numDynamic];
+                recordStaticBatches(drawData, slot, textured, commands);
+            }
+        }
+    });
+    m_drawData->flush();
+
+    PROFILE_ZONE("Scene3D::replayCommands");
+    GLCommandBackend backend(m_drawData->id(), DRAW_DATA_BINDING, m_lights, shader, m_gpuProfiler.get());
+    CommandReplayer replayer(backend);
+    for (const CommandBuffer& commands : m_commandBuffers)
+        replayer.execute(commands);
+    replayer.finish();
+}
+
+void Scene3D::recordInstances(const FrameState& frame, const UniformSlots& drawData, bool textured,
+    size_t first, size_t last, CommandBuffer& commands) const
+{
+    for (size_t dynamic = first; dynamic < last; dynamic++)
+    {
+        const size_t i = m_dynamicInstances[dynamic];
+        if (isInstanceVisible(frame, i) && m_instances[i].model().hasMeshes(textured))
+        {
+            size_t slot = m_firstSlot[textured][dynamic];
+            recordInstanceLights(m_instances[i].boundingSphere(), commands);
+            commands.setCondition(conditionQuery(i));
+            recordDraws(m_instances[i], drawData, slot, textured, commands);
+        }
+    }
+}
+
+void Scene3D::recordStaticBatches(const UniformSlots& drawData, size_t& slot, bool textured,
+    CommandBuffer& commands) const
+{
+    // the static batches are drawn unconditionally
+    commands.setCondition(0);
+    for (auto& it : m_staticBatches)
+        if (it.model().hasMeshes(textured))
+        {
+            recordInstanceLights(it.boundingSphere(), commands);
+            recordDraws(it, drawData, slot, textured, commands);
+        }
+}
+
+template <typename Drawable>
+void Scene3D::recordDraws(const Drawable& drawable, const UniformSlots& drawData, size_t& slot, bool textured,
+    CommandBuffer& commands) const
+{
+    auto scope = m_modelScopes.find(&drawable.model());
+    if (scope != m_modelScopes.end())
+        commands.beginGpuScope(scope->second);
+    drawable.recordDraws(drawData, slot, m_materials, textured, commands);
+    if (scope != m_modelScopes.end())
+        commands.endGpuScope();
+}
+
+void Scene3D::recordBundle(bool textured)
+{
+    PROFILE_ZONE("Scene3D::recordBundle");
+    size_t numSlots = 0;
+    for (size_t i : m_staticInstances)
+        numSlots += m_instances[i].model().numMeshes(textured);
+    for (auto& it : m_staticBatches)
+        numSlots += it.model().numMeshes(textured);
+
+    DrawBundle& bundle = m_bundles[textured];
+    const UniformSlots drawData = bundle.begin(numSlots, sizeof(DrawData));
+    CommandBuffer& commands = bundle.commands();
+    size_t slot = 0;
+    for (size_t i : m_staticInstances)
+        if (m_instances[i].model().hasMeshes(textured))
+        {
+            recordInstanceLights(m_instances[i].boundingSphere(), commands);
+            recordDraws(m_instances[i], drawData, slot, textured, commands);
+        }
+    recordStaticBatches(drawData, slot, textured, commands);
+    bundle.end();
+    m_bundleLightsVersion[textured] = m_lights.selectionVersion();
+    debugOutput(string("Draw bundle: ") + (textured ? "textured, " : "untextured, ") +
+        to_string(bundle.numCommands()) + " commands");
+}
+
+void Scene3D::recordInstanceLights(const BoundingSphere& bounds, CommandBuffer& commands) const
+{
+    if (m_lights.lightingMode() != LightingMode::PerInstance)
+        return;
+    array<GLint, MAX_INSTANCE_LIGHTS> selection;
+    int numSelected = m_lights.selectInstanceLights(bounds, selection);
+    commands.setInstanceLights(selection.data(), numSelected);
 }
 
 Scene3D::Scene3D(const nlohmann::json& sceneJson) :
-    m_shader(SHADERS_DIR + "exampleSceneVertex.glsl", SHADERS_DIR + "exampleSceneFragment.glsl")
+    m_shaders(SHADERS_DIR + "exampleSceneVertex.glsl", SHADERS_DIR + "exampleSceneFragment.glsl"),
+    m_deferred(sceneJson.value("renderer", "forward") == "deferred"),
+    m_depthPrepass(sceneJson.value("depthPrepass", false)),
+    m_asyncShaders(sceneJson.value("asyncShaders", false)),
+    m_staticBatching(sceneJson.value("staticBatching", false)),
+    m_drawBundles(sceneJson.value("drawBundles", false)),
+    m_conditionalRender(sceneJson.value("conditionalRender", false))
 {
+    if (sceneJson.value("occlusionCulling", false))
+        m_occlusionCuller = make_unique<OcclusionCuller>();
+    if (m_deferred)
+    {
+        m_geometryPassShaders = make_unique<ShaderLibrary>(
+            SHADERS_DIR + "exampleSceneVertex.glsl", SHADERS_DIR + "deferredGeometryFragment.glsl");
+        m_lightingPassShaders = make_unique<ShaderLibrary>(
+            SHADERS_DIR + "fullscreenVertex.glsl", SHADERS_DIR + "deferredLightingFragment.glsl");
+        m_gBuffer = make_unique<GBuffer>();
+    }
+
     loadModels(sceneJson);
     loadInstances(sceneJson);
     loadCamera(sceneJson);
     loadLight(sceneJson);
     loadBackgroundColor(sceneJson);
+    createIndirectRenderer(sceneJson);
+    // the CPU copies of the geometry were only needed to set up the scene;
+    // the IndirectRenderer draws from the copy in its GeometryPool
+    for (auto& [name, model] : m_models)
+    {
+        model.releaseGeometry();
+        if (m_indirectRenderer)
+            model.releaseMeshes();
+    }
+    for (auto& batch : m_staticBatches)
+    {
+        batch.releaseGeometry();
+        if (m_indirectRenderer)
+            batch.releaseMeshes();
+    }
+    GeometryRegistry::shared().releaseGeometry();
+    if (m_depthPrepass)
+        m_depthPrepassShader = make_unique<ShaderProgram>(readShaderSource(
+            SHADERS_DIR + "depthPrepassVertex.glsl", SHADERS_DIR + "depthPrepassFragment.glsl"),
+            m_indirectRenderer ? ShaderDefines{ { "GPU_DRIVEN", "1" } } : ShaderDefines{}, compileMode());
+    createOcclusionQueries(sceneJson);
+    createDrawData();
+    createGpuProfiler(sceneJson);
+
+    // draw with simple shaders instead of waiting for the compiler
+    if (m_asyncShaders)
+        enableAsyncCompilation();
+    precompileShaders();
+}
+
+void Scene3D::enableAsyncCompilation()
+{
+    m_shaders.enableAsyncCompilation(
+        SHADERS_DIR + "exampleSceneVertex.glsl", SHADERS_DIR + "fallbackFragment.glsl",
+        variantDefines({}, true));
+    if (!m_deferred)
+        return;
+    // untextured materials and lights without point and spot lights compile quickly
+    m_geometryPassShaders->enableAsyncCompilation(
+        SHADERS_DIR + "exampleSceneVertex.glsl", SHADERS_DIR + "deferredGeometryFragment.glsl",
+        variantDefines({}, false));
+    ShaderDefines lightingDefines = m_lights.shaderDefines();
+    lightingDefines["POINT_LIGHTS"] = "0";
+    lightingDefines["SPOT_LIGHT"] = "0";
+    m_lightingPassShaders->enableAsyncCompilation(
+        SHADERS_DIR + "fullscreenVertex.glsl", SHADERS_DIR + "deferredLightingFragment.glsl",
+        lightingDefines);
+}
+
+void Scene3D::precompileShaders()
+{
+    // every program a frame can ask for: lights switched on or off in either pass,
+    // any material textured or not
+    const vector<ShaderDefines> lightDefines = m_lights.shaderDefineVariants();
+
+    vector<ShaderDefines> materialDefines;
+    for (const auto& defines : m_deferred ? vector<ShaderDefines>{ {} } : lightDefines)
+        for (bool textured : { false, true })
+            materialDefines.push_back(variantDefines(defines, textured));
+
+    if (m_deferred)
+    {
+        m_geometryPassShaders->precompile(materialDefines);
+        m_lightingPassShaders->precompile(lightDefines);
+    }
+    else
+        m_shaders.precompile(materialDefines);
+}
+
+void Scene3D::createIndirectRenderer(const nlohmann::json& sceneJson)
+{
+    if (!sceneJson.value("gpuCulling", false))
+        return;
+    // per-instance lights are chosen on the CPU for each draw
+    if (m_lights.lightingMode() == LightingMode::PerInstance)
+    {
+        debugOutput("GPU culling is not available with per-instance lighting");
+        return;
+    }
+    if (!IndirectRenderer::isSupported())
+    {
+        debugOutput("GPU culling needs GL 4.3; drawing from the CPU");
+        return;
+    }
+
+    // one draw per source mesh, so that each can be culled by its own bounds
+    m_indirectRenderer = make_unique<IndirectRenderer>();
+    for (auto& it : m_instances)
+        for (size_t i = 0; i < it.model().numMeshes(); i++)
+        {
+            const Material& material = it.model().material(i);
+            DrawData drawData = makeDrawData(it.modelMatrix(), it.normalMatrix(), m_materials.index(material));
+            for (const SubMesh& subMesh : it.model().subMeshes(i))
+                m_indirectRenderer->addDraw(it.model().geometry(i), subMesh, material.m_textured, drawData,
+                    boundingSphere(subMesh.boundingBox, it.modelMatrix()));
+        }
+    for (auto& it : m_staticBatches)
+        for (size_t i = 0; i < it.numMeshes(); i++)
+        {
+            const Material& material = it.model().material(i);
+            DrawData drawData = makeDrawData(glm::mat4(1.0f), glm::mat3(1.0f), m_materials.index(material));
+            for (const SubMesh& subMesh : it.subMeshes(i))
+                m_indirectRenderer->addDraw(it.geometry(i), subMesh, material.m_textured, drawData,
+                    boundingSphere(subMesh.boundingBox));
+        }
+    m_indirectRenderer->upload();
+    debugOutput("GPU culling: " + to_string(m_indirectRenderer->numDraws()) + " draws");
+    if (m_occlusionCuller)
+    {
+        debugOutput("Occlusion culling only applies to draws from the CPU");
+        m_occlusionCuller.reset();
+    }
+}
+
+void Scene3D::createGpuProfiler(const nlohmann::json& sceneJson)
+{
+    const string gpuTimers = sceneJson.value("gpuTimers", DEFAULT_GPU_TIMERS);
+    if (gpuTimers == "off")
+        return;
+    if (!GpuProfiler::isSupported())
+    {
+        debugOutput("GPU timers need GL 3.3 or ARB_timer_query");
+        return;
+    }
+    m_gpuProfiler = make_unique<GpuProfiler>();
+
+    // scopes beyond GpuProfiler::MAX_SCOPES_PER_FRAME are not measured
+    if (gpuTimers == "models")
+        for (auto& [name, model] : m_models)
+            m_modelScopes[&model] = Profiler::internName("Model " + name);
+}
+
+void Scene3D::createOcclusionQueries(const nlohmann::json& sceneJson)
+{
+    m_instanceQuery.assign(m_instances.size(), -1);
+    if (!sceneJson.contains("occlusionQueryModels"))
+        return;
+    if (m_indirectRenderer)
+    {
+        debugOutput("Occlusion queries only apply to draws from the CPU");
+        return;
+    }
+
+    // static instances are merged into batches and always drawn
+    for (auto& name : sceneJson["occlusionQueryModels"])
+    {
+        auto model = m_models.find(name);
+        if (model == m_models.end())
+            continue;
+        for (size_t i = 0; i < m_instances.size(); i++)
+            if (&m_instances[i].model() == &model->second)
+            {
+                const auto& box = m_instances[i].model().boundingBox();
+                glm::vec3 low(m_instances[i].modelMatrix() * glm::vec4(box[0], box[2], box[4], 1.0f));
+                glm::vec3 high(m_instances[i].modelMatrix() * glm::vec4(box[1], box[3], box[5], 1.0f));
+                m_instanceQuery[i] = int(m_queriedInstances.size());
+                m_queriedInstances.push_back(i);
+                m_queryBoxes.push_back({ glm::min(low, high), glm::max(low, high) });
+            }
+    }
+    if (m_queriedInstances.empty())
+        return;
+
+    m_occlusionQueries = make_unique<OcclusionQueries>(m_queriedInstances.size());
+    m_queryBoxShader = loadShaderProgram(
+        SHADERS_DIR + "depthPrepassVertex.glsl", SHADERS_DIR + "depthPrepassFragment.glsl", compileMode());
+    debugOutput("Occlusion queries: " + to_string(m_queriedInstances.size()) + " instances, " +
+        (m_conditionalRender ? "conditional rendering" : "read back"));
+}
+
+void Scene3D::createDrawData()
+{
+    PROFILE_ZONE("Scene3D::createDrawData");
+    // the IndirectRenderer keeps its own draw data
+    if (m_indirectRenderer)
+        m_drawBundles = false;
+    else
+    {
+        // instances that may be culled are drawn differently from frame to frame
+        for (size_t i = 0; i < m_instances.size(); i++)
+            if (m_drawBundles && !m_occlusionCuller && m_instanceQuery[i] < 0)
+                m_staticInstances.push_back(i);
+            else
+                m_dynamicInstances.push_back(i);
+    }
+
+    // every Mesh that is not in a bundle is drawn once per frame,
+    // with either the textured or the untextured shader
+    size_t numDraws = 0;
+    for (bool textured : { false, true })
+    {
+        vector<size_t>& firstSlot = m_firstSlot[textured];
+        firstSlot.assign(1, 0);
+        for (size_t i : m_dynamicInstances)
+            firstSlot.push_back(firstSlot.back() + m_instances[i].model().numMeshes(textured));
+        size_t batchSlots = 0;
+        if (!m_drawBundles && !m_indirectRenderer)
+            for (auto& it : m_staticBatches)
+                batchSlots += it.model().numMeshes(textured);
+        firstSlot.push_back(firstSlot.back() + batchSlots);
+        numDraws += firstSlot.back();
+    }
+    m_drawData = make_unique<UniformRingBuffer>(
+        numDraws * (sizeof(DrawData) + UniformRingBuffer::offsetAlignment()));
+
+    // enough ranges for the workers to balance their load
+    const size_t numRanges = min(4 * (JobSystem::shared().numWorkers() + 1),
+        (m_dynamicInstances.size() + MIN_RECORD_CHUNK - 1) / MIN_RECORD_CHUNK);
+    m_commandBuffers.resize(numRanges + 1);
+    debugOutput(string("Draw data: ") + (m_drawData->isPersistent() ? "persistent" : "unsynchronized") +
+        " mapping, " + to_string(numDraws) + " draws per frame" +
+        (m_drawBundles ? ", " + to_string(m_staticInstances.size()) + " instances in bundles" : ""));
 }
 
 void Scene3D::loadBackgroundColor(const nlohmann::json& sceneJson)
@@ -103,28 +861,64 @@ void Scene3D::loadBackgroundColor(const nlohmann::json& sceneJson)
 
 void Scene3D::loadModels(const nlohmann::json& sceneJson)
 {
+    PROFILE_ZONE("Scene3D::loadModels");
     for (auto& model : sceneJson["models"])
         try
         {
-            m_models[model] = Model(model);
+            m_models[model] = Model(model, m_staticBatching);
             debugOutput(m_models[model].boundingBoxAsString());
         }
         catch (const exception& e)
         {
             debugOutput(e.what());
         }
+
+    debugOutput("GeometryRegistry: " + to_string(GeometryRegistry::shared().numMeshes()) +
+        " unique meshes, " + to_string(GeometryRegistry::shared().bytesSaved()) + " bytes saved");
+
+    for (auto& [name, model] : m_models)
+        m_materials.add(model);
+    m_materials.upload();
+    debugOutput("MaterialTable: " + to_string(m_materials.size()) + " materials");
 }
 
 void Scene3D::loadInstances(const nlohmann::json& sceneJson)
 {
+    PROFILE_ZONE("Scene3D::loadInstances");
+    // model name -> model matrices of its static instances
+    unordered_map<string, vector<glm::mat4>> staticInstances;
+
     for (auto& instance : sceneJson["instances"])
         if (m_models.find(instance["model"]) != m_models.end())
-            m_instances.emplace_back(
+        {
+            ModelInstance modelInstance(
                     m_models[instance["model"]],
                     instance["origin"][0],
                     instance["origin"][1],
                     instance["origin"][2],
                     instance["scale"]);
+            // large objects that hide others, e.g. walls and terrain
+            if (m_occlusionCuller && instance.value("occluder", false))
+                addOccluder(m_models[instance["model"]], modelInstance.modelMatrix());
+            if (m_staticBatching && instance.value("static", false))
+                staticInstances[instance["model"]].push_back(modelInstance.modelMatrix());
+            else
+                m_instances.push_back(modelInstance);
+        }
+
+    // regular grids of dynamic instances, e.g. for benchmarks
+    if (sceneJson.contains("instanceGrids"))
+        for (auto& grid : sceneJson["instanceGrids"])
+            if (m_models.find(grid["model"]) != m_models.end())
+                for (int i = 0; i < grid["count"][0]; i++)
+                    for (int j = 0; j < grid["count"][1]; j++)
+                        for (int k = 0; k < grid["count"][2]; k++)
+                            m_instances.emplace_back(
+                                m_models[grid["model"]],
+                                GLfloat(grid["origin"][0]) + i * GLfloat(grid["spacing"]),
+                                GLfloat(grid["origin"][1]) + j * GLfloat(grid["spacing"]),
+                                GLfloat(grid["origin"][2]) + k * GLfloat(grid["spacing"]),
+                                grid["scale"]);
 
     int num_stars = 1000;
     if (m_models.find("star") != m_models.end())
@@ -137,8 +931,42 @@ void Scene3D::loadInstances(const nlohmann::json& sceneJson)
             GLfloat y = sin(phi)*cos(theta) * radius;
             GLfloat z = cos(phi)*cos(theta) * radius;
             GLfloat scale = 0.01 + rand01() * 0.09;
-            m_instances.emplace_back(m_models["star"],x,y,z,scale);
+            ModelInstance star(m_models["star"],x,y,z,scale);
+            // stars never move
+            if (m_staticBatching)
+                staticInstances["star"].push_back(star.modelMatrix());
+            else
+                m_instances.push_back(star);
         }
+
+    loadStaticBatches(staticInstances);
+    if (m_occlusionCuller)
+        debugOutput("Occlusion culling: " + to_string(m_occlusionCuller->numOccluderTriangles()) +
+            " occluder triangles");
+}
+
+void Scene3D::addOccluder(const Model& model, const glm::mat4& modelMatrix)
+{
+    const int stride = VertexData(VertexData::POSITION | VertexData::UV | VertexData::NORMAL).stride();
+    for (size_t i = 0; i < model.numMeshes(); i++)
+    {
+        const MeshGeometry& geometry = model.geometry(i);
+        vector<glm::vec3> positions;
+        positions.reserve(geometry.vertices.size() / stride);
+        for (size_t v = 0; v + stride <= geometry.vertices.size(); v += stride)
+            positions.emplace_back(modelMatrix *
+                glm::vec4(geometry.vertices[v], geometry.vertices[v + 1], geometry.vertices[v + 2], 1.0f));
+        m_occlusionCuller->addOccluder(positions, geometry.indices);
+    }
+}
+
+void Scene3D::loadStaticBatches(const unordered_map<string, vector<glm::mat4>>& staticInstances)
+{
+    for (auto& [model, modelMatrices] : staticInstances)
+    {
+        m_staticBatches.emplace_back(m_models[model], modelMatrices);
+        debugOutput(model + ": batched " + to_string(modelMatrices.size()) + " static instances");
+    }
 }
 
 void Scene3D::loadCamera(const nlohmann::json& sceneJson)
@@ -157,6 +985,17 @@ void Scene3D::loadCamera(const nlohmann::json& sceneJson)
 
 void Scene3D::loadLight(const nlohmann::json& sceneJson)
 {
+    if (sceneJson.value("lighting", "clustered") == "perInstance")
+    {
+        // the deferred lighting pass has no instances, only pixels
+        if (m_deferred)
+            debugOutput("Per-instance lighting is not available with deferred shading");
+        else
+            m_lights.setLightingMode(LightingMode::PerInstance);
+    }
+    if (sceneJson.contains("lightCutoff"))
+        m_lights.setLightCutoff(sceneJson["lightCutoff"]);
+
     for (auto & light : sceneJson["lights"])
         if (light["type"] == "ambient")
         {
@@ -200,6 +1039,26 @@ void Scene3D::loadLight(const nlohmann::json& sceneJson)
                 light["intensity"]
                 ));
         }
+        else if (light["type"] == "pointLightCloud")
+        {
+            // many identical point lights at random positions inside a box
+            for (int i = 0; i < light["count"]; i++)
+                m_lights.addPointLight(PointLight(
+                    glm::vec3(
+                        light["color"][0],
+                        light["color"][1],
+                        light["color"][2]),
+                    glm::vec3(
+                        float(light["min"][0]) + rand01() * (float(light["max"][0]) - float(light["min"][0])),
+                        float(light["min"][1]) + rand01() * (float(light["max"][1]) - float(light["min"][1])),
+                        float(light["min"][2]) + rand01() * (float(light["max"][2]) - float(light["min"][2]))),
+                    glm::vec3(
+                        light["attenuation"][0],
+                        light["attenuation"][1],
+                        light["attenuation"][2]),
+                    light["intensity"]
+                    ));
+        }
         else if (light["type"] == "spot")
         {
             m_lights.setSpotLight(SpotLight(
@@ -219,13 +1078,45 @@ void Scene3D::loadLight(const nlohmann::json& sceneJson)
         }
 }
 
-void Scene3D::resetFrame(const EventContainer& events) const
+void Scene3D::resetFrame() const
 {
+    GpuScope gpuClear(m_gpuProfiler.get(), "Clear");
     glClearColor(m_backgroundColor.x, m_backgroundColor.y, m_backgroundColor.z,
         1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+const ShaderDefines& Scene3D::variantDefines(const ShaderDefines& defines, bool textured)
+{
+    // the defines of a frame are usually those of the last one
+    ShaderDefines& result = m_variantDefines[textured];
+    if (m_variantInput[textured] == defines && !result.empty())
+        return result;
+    m_variantInput[textured] = defines;
+    result = defines;
+    result["TEXTURED"] = textured ? "1" : "0";
+    for (const auto& [name, value] : m_materials.shaderDefines())
+        result[name] = value;
+    if (m_indirectRenderer)
+        result["GPU_DRIVEN"] = "1";
+    return result;
+}
+
+void Scene3D::prepareShader(const ShaderProgram& shader, const FrameState& frame) const
+{
+    shader.activateShader();
+
+    GLuint drawDataIndex = glGetUniformBlockIndex(shader.id(), "DrawData");
+    if (drawDataIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(shader.id(), drawDataIndex, DRAW_DATA_BINDING);
+
+    glm::mat4 viewProjection = frame.camera.viewProjectionMatrix(frame.events.aspectRatio());
+    glUniformMatrix4fv(glGetUniformLocation(shader.id(), "viewProjection"), 1, GL_FALSE,
+        glm::value_ptr(viewProjection));
+    glUniform2f(glGetUniformLocation(shader.id(), "screenSize"),
+        GLfloat(frame.events.bufferWidth()), GLfloat(frame.events.bufferHeight()));
 
-    glm::mat4 projection = glm::perspective(45.0f, events.aspectRatio(), 0.1f, 100.0f);
-    glUniformMatrix4fv(glGetUniformLocation(m_shader.id(), "projection"), 1, GL_FALSE,
-        glm::value_ptr(projection));
+    frame.camera.talkToShader(shader.id());
+    m_lights.talkToShader(shader.id(), frame.spotLightOn);
+    m_materials.talkToShader(shader.id());
 }
@@ -2,9 +2,16 @@
 
 #include <iostream>
 #include <fstream>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <vector>
 #include <stdio.h>
 #include <cstring>
 #include "Config.h"
+#include "FlightRecorder.h"
+#include "Profiler.h"
+#include "Utils.h"
 
 using namespace std;
 
@@ -35,48 +42,356 @@ namespace
             throw runtime_error("Shader error: " + string(eLog));
         }
     }
+
+    // Program binaries need GL 4.1 or ARB_get_program_binary,
+    // and some drivers support the extension with no binary formats
+    bool programBinariesSupported()
+    {
+#ifdef SHADER_CACHE_DIR
+        if (!GLEW_ARB_get_program_binary)
+            return false;
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        return numFormats > 0;
+#else
+        return false;
+#endif
+    }
+
+    bool isSampler(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_MULTISAMPLE:
+        case GL_SAMPLER_BUFFER: case GL_INT_SAMPLER_BUFFER: case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Locations of all active sampler uniforms, one per array element
+    std::vector<GLint> samplerLocations(GLuint programID)
+    {
+        std::vector<GLint> locations;
+        GLint numUniforms = 0;
+        glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &numUniforms);
+        for (GLint i = 0; i < numUniforms; i++)
+        {
+            GLchar name[256];
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(programID, i, sizeof(name), nullptr, &size, &type, name);
+            if (!isSampler(type))
+                continue;
+            // array names end with [0]
+            std::string baseName(name);
+            baseName = baseName.substr(0, baseName.find('['));
+            for (GLint element = 0; element < size; element++)
+                locations.push_back(glGetUniformLocation(programID, size > 1 ?
+                    (baseName + "[" + std::to_string(element) + "]").c_str() : name));
+        }
+        return locations;
+    }
+
+    bool parallelCompileSupported()
+    {
+        return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    }
+
+    // Let the driver compile on as many threads as it likes. The limit is state of
+    // the current context, so ask the context whether it is set already.
+    void enableParallelCompile()
+    {
+        if (!parallelCompileSupported())
+            return;
+        GLint maxThreads = 0;
+        glGetIntegerv(GL_MAX_SHADER_COMPILER_THREADS_KHR, &maxThreads);
+        if (GLuint(maxThreads) == 0xFFFFFFFF)
+            return;
+        if (GLEW_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        else
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    }
+
+    std::string glString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? reinterpret_cast<const char*>(value) : "";
+    }
+
+    // a binary is only valid for the driver that created it
+    std::string driverString()
+    {
+        return glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+    }
+
+    // FNV-1a
+    void hashBytes(uint64_t& hash, const std::string& bytes)
+    {
+        for (unsigned char byte : bytes)
+        {
+            hash ^= byte;
+            hash *= 1099511628211ull;
+        }
+        // separator, so that moving text between strings changes the hash
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+    }
+
+    // includes deeper than this are taken for a cycle
+    constexpr int MAX_INCLUDE_DEPTH = 8;
+
+    std::string readShaderCode(const std::string& filename, int includeDepth = 0)
+    {
+        std::string fileContent;
+        std::ifstream fileStream(filename);
+
+        if (!fileStream.is_open())
+            throw runtime_error("Failed to open " + filename);
+
+        std::string line;
+        while (getline(fileStream, line))
+        {
+            const size_t directive = line.find_first_not_of(" \t");
+            if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+            {
+                fileContent.append(line + "\n");
+                continue;
+            }
+            const size_t open = line.find('"', directive);
+            const size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if (close == std::string::npos)
+                throw runtime_error("Malformed #include in " + filename + ": " + line);
+            if (includeDepth == MAX_INCLUDE_DEPTH)
+                throw runtime_error("Shader includes nest too deep in " + filename);
+            const std::filesystem::path included =
+                std::filesystem::path(filename).parent_path() / line.substr(open + 1, close - open - 1);
+            fileContent.append(readShaderCode(included.string(), includeDepth + 1));
+        }
+
+        fileStream.close();
+        return fileContent;
+    }
+}
+
+ShaderSource readShaderSource(const std::string& vertexShaderFile,
+    const std::string& fragmentShaderFile)
+{
+    return ShaderSource{ readShaderCode(vertexShaderFile), readShaderCode(fragmentShaderFile) };
+}
+
+bool spirvSupported()
+{
+    return GLEW_VERSION_4_6 || GLEW_ARB_gl_spirv;
 }
 
-ShaderProgram::ShaderProgram(const std::string& vertexShaderFile, const std::string& fragmentShaderFile)
+bool readSpirvSource(const std::string& vertexShaderFile,
+    const std::string& fragmentShaderFile, SpirvSource& source)
 {
-    auto vertexStr = readShaderCode(vertexShaderFile);
-    auto fragmentStr = readShaderCode(fragmentShaderFile);
-    createProgram(vertexStr, fragmentStr);
+#ifdef SPIRV_DIR
+    auto readModule = [](const std::string& shaderFile, std::vector<char>& module)
+    {
+        // the build step names modules after the shader file: shader.glsl -> shader.glsl.spv
+        std::filesystem::path moduleFile = SPIRV_DIR +
+            std::filesystem::path(shaderFile).filename().string() + ".spv";
+        std::ifstream file(moduleFile, std::ios::binary);
+        if (!file.is_open())
+            return false;
+        module.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return !module.empty();
+    };
+    return readModule(vertexShaderFile, source.vertex) &&
+        readModule(fragmentShaderFile, source.fragment);
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<ShaderProgram> loadShaderProgram(const std::string& vertexShaderFile,
+    const std::string& fragmentShaderFile, ShaderProgram::CompileMode mode)
+{
+    SpirvSource spirv;
+    if (spirvSupported() && readSpirvSource(vertexShaderFile, fragmentShaderFile, spirv))
+        try
+        {
+            return std::make_unique<ShaderProgram>(spirv);
+        }
+        catch (const std::exception& e)
+        {
+            debugOutput(e.what());
+            debugOutput("Compiling " + vertexShaderFile + " and " + fragmentShaderFile + " from GLSL");
+        }
+    return std::make_unique<ShaderProgram>(readShaderSource(vertexShaderFile, fragmentShaderFile),
+        ShaderDefines{}, mode);
+}
+
+std::string specializeShaderCode(const std::string& shaderCode, const ShaderDefines& defines)
+{
+    std::string defineLines;
+    for (const auto& [name, value] : defines)
+        defineLines += "#define " + name + " " + value + "\n";
+
+    // #version must stay the first statement of the shader
+    size_t versionLine = shaderCode.find("#version");
+    if (versionLine == std::string::npos)
+        return defineLines + shaderCode;
+    size_t lineEnd = shaderCode.find('\n', versionLine);
+    if (lineEnd == std::string::npos)
+        return shaderCode + "\n" + defineLines;
+    return shaderCode.substr(0, lineEnd + 1) + defineLines + shaderCode.substr(lineEnd + 1);
+}
+
+std::string shaderDefinesKey(const ShaderDefines& defines)
+{
+    std::string key;
+    for (const auto& [name, value] : defines)
+        key += (key.empty() ? "" : ";") + name + "=" + value;
+    return key;
+}
+
+std::string programBinaryName(const ShaderSource& source, const std::string& driver)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hashBytes(hash, source.vertex);
+    hashBytes(hash, source.fragment);
+    hashBytes(hash, driver);
+
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+    return name.str();
+}
+
+// ==============================================================================
+// ==============          SHADER PROGRAM CLASS     =============================
+// ==============================================================================
+
+ShaderProgram::ShaderProgram(const std::string& vertexShaderFile, const std::string& fragmentShaderFile,
+    const ShaderDefines& defines) :
+    ShaderProgram(readShaderSource(vertexShaderFile, fragmentShaderFile), defines)
+{}
+
+ShaderProgram::ShaderProgram(const ShaderSource& source, const ShaderDefines& defines,
+    CompileMode mode)
+{
+    PROFILE_ZONE("ShaderProgram::ShaderProgram");
+    ShaderSource specialized{ specializeShaderCode(source.vertex, defines),
+        specializeShaderCode(source.fragment, defines) };
+
+#ifdef SHADER_CACHE_DIR
+    if (programBinariesSupported())
+    {
+        m_binaryFile = SHADER_CACHE_DIR + programBinaryName(specialized, driverString());
+        if (loadProgramBinary(m_binaryFile))
+            return;
+    }
+#endif
+
+    submitProgram(specialized.vertex, specialized.fragment);
+    if (mode == CompileMode::Immediate)
+        finish();
+}
+
+ShaderProgram::ShaderProgram(const SpirvSource& source) :
+    m_spirv(true)
+{
+    m_programID = glCreateProgram();
+    try
+    {
+        specializeShader(source.vertex, GL_VERTEX_SHADER);
+        specializeShader(source.fragment, GL_FRAGMENT_SHADER);
+        glLinkProgram(m_programID);
+        m_pending = true;
+        finish();
+    }
+    catch (...)
+    {
+        // the destructor does not run for a failed constructor
+        deleteShaders();
+        deleteProgram();
+        throw;
+    }
+}
+
+ShaderProgram::ShaderProgram(const std::string& computeShaderFile)
+{
+    m_programID = glCreateProgram();
+    try
+    {
+        compileShader(readShaderCode(computeShaderFile), GL_COMPUTE_SHADER);
+        glLinkProgram(m_programID);
+        m_pending = true;
+        finish();
+    }
+    catch (...)
+    {
+        deleteShaders();
+        deleteProgram();
+        throw;
+    }
 }
 
 ShaderProgram::~ShaderProgram()
 {
+    deleteShaders();
     deleteProgram();
 }
 
-std::string ShaderProgram::readShaderCode(const std::string& filename)
+bool ShaderProgram::isReady() const
 {
-    std::string fileContent;
-    std::ifstream fileStream(filename);
+    if (!m_pending)
+        return true;
 
-    if (!fileStream.is_open())
-        throw runtime_error("Failed to open " + filename);
+    // without the extension, there is no way to ask without waiting
+    if (!parallelCompileSupported())
+        return true;
 
-    std::string line;
-    while (getline(fileStream, line))
-        fileContent.append(line + "\n");
+    GLint completed = GL_FALSE;
+    glGetProgramiv(m_programID, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed;
+}
 
-    fileStream.close();
-    return fileContent;
+void ShaderProgram::finish()
+{
+    if (!m_pending)
+        return;
+    PROFILE_ZONE("ShaderProgram::finish");
+    FlightEvent event("shader", "link");
+    m_pending = false;
+
+    // only now wait for the driver: compile errors first, as they explain link errors
+    for (GLuint shader : m_shaders)
+        checkShader(shader);
+    checkProgram(m_programID, GL_LINK_STATUS);
+    validateProgram();
+    deleteShaders();
+
+    if (!m_binaryFile.empty())
+        saveProgramBinary(m_binaryFile);
 }
 
-void ShaderProgram::createProgram(const std::string &vShader, const std::string &fShader)
+void ShaderProgram::submitProgram(const std::string &vShader, const std::string &fShader)
 {
+    FlightEvent event("shader", "compile");
+    enableParallelCompile();
+
     m_programID = glCreateProgram();
+    if (!m_binaryFile.empty())
+        glProgramParameteri(m_programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
     compileShader(vShader, GL_VERTEX_SHADER);
     compileShader(fShader, GL_FRAGMENT_SHADER);
-    linkProgram();
-    validateProgram();
+    // linking does not need the compile status; the driver queues it behind compilation
+    glLinkProgram(m_programID);
+    m_pending = true;
 }
 
 void ShaderProgram::compileShader(const std::string &shaderCode, GLenum shaderType)
 {
+    PROFILE_ZONE("ShaderProgram::compileShader");
     auto shader = glCreateShader(shaderType);
 
     const char* codes[1];
@@ -88,15 +403,23 @@ void ShaderProgram::compileShader(const std::string &shaderCode, GLenum shaderTy
     glShaderSource(shader, 1, codes, codeLens);
     glCompileShader(shader);
 
-    checkShader(shader);
-
     glAttachShader(m_programID, shader);
+    m_shaders.push_back(shader);
 }
 
-void ShaderProgram::linkProgram()
+void ShaderProgram::specializeShader(const std::vector<char>& module, GLenum shaderType)
 {
-    glLinkProgram(m_programID);
-    checkProgram(m_programID, GL_LINK_STATUS);
+    auto shader = glCreateShader(shaderType);
+    m_shaders.push_back(shader);
+
+    glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB, module.data(), GLsizei(module.size()));
+    // entry point "main", no specialization constants; sets the compile status
+    if (GLEW_VERSION_4_6)
+        glSpecializeShader(shader, "main", 0, nullptr, nullptr);
+    else
+        glSpecializeShaderARB(shader, "main", 0, nullptr, nullptr);
+
+    glAttachShader(m_programID, shader);
 }
 
 void ShaderProgram::validateProgram()
@@ -106,10 +429,34 @@ void ShaderProgram::validateProgram()
 	glGenVertexArrays(1, &validationVAO);
     glBindVertexArray(validationVAO);
 
+    // All samplers start on texture unit 0, which is invalid if their types differ.
+    // Validate with each sampler on its own unit, as it will be when drawing.
+    GLint currentProgram;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+    glUseProgram(m_programID);
+    std::vector<GLint> samplers = samplerLocations(m_programID);
+    for (size_t i = 0; i < samplers.size(); i++)
+        glUniform1i(samplers[i], GLint(i));
+
     glValidateProgram(m_programID);
-    checkProgram(m_programID, GL_VALIDATE_STATUS);
 
+    for (GLint sampler : samplers)
+        glUniform1i(sampler, 0);
+    glUseProgram(currentProgram);
     glDeleteVertexArrays(1, &validationVAO);
+
+    checkProgram(m_programID, GL_VALIDATE_STATUS);
+}
+
+void ShaderProgram::deleteShaders()
+{
+    // the linked program keeps its own copy of the code
+    for (GLuint shader : m_shaders)
+    {
+        glDetachShader(m_programID, shader);
+        glDeleteShader(shader);
+    }
+    m_shaders.clear();
 }
 
 void ShaderProgram::deleteProgram()
@@ -119,4 +466,118 @@ void ShaderProgram::deleteProgram()
         glDeleteProgram(m_programID);
         m_programID = 0;
     }
-}
\ No newline at end of file
+}
+
+bool ShaderProgram::loadProgramBinary(const std::string& fileName)
+{
+    PROFILE_ZONE("ShaderProgram::loadProgramBinary");
+    FlightEvent event("shader", "load binary");
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    GLenum format;
+    file.read(reinterpret_cast<char*>(&format), sizeof(format));
+    if (!file)
+        return false;
+    // the iterators read the buffer directly and leave the stream state alone
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (binary.empty())
+        return false;
+
+    m_programID = glCreateProgram();
+    glProgramBinary(m_programID, format, binary.data(), GLsizei(binary.size()));
+
+    // a driver update or a different GPU invalidates binaries; compile instead
+    GLint linked = GL_FALSE;
+    glGetProgramiv(m_programID, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        debugOutput("Rejected program binary " + fileName + ", recompiling");
+        deleteProgram();
+        return false;
+    }
+    return true;
+}
+
+void ShaderProgram::saveProgramBinary(const std::string& fileName) const
+{
+    GLint length = 0;
+    glGetProgramiv(m_programID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    GLenum format;
+    std::vector<char> binary(length);
+    glGetProgramBinary(m_programID, length, nullptr, &format, binary.data());
+
+    // write to a temporary file first, so that a crash never leaves a truncated binary
+    std::error_code error;
+    std::filesystem::path path(fileName);
+    std::filesystem::create_directories(path.parent_path(), error);
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        if (!file.is_open())
+            return;
+        file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+        file.write(binary.data(), binary.size());
+    }
+    std::filesystem::rename(tempPath, path, error);
+}
+
+// ==============================================================================
+// ==============          SHADER LIBRARY CLASS     =============================
+// ==============================================================================
+
+ShaderLibrary::ShaderLibrary(const std::string& vertexShaderFile,
+    const std::string& fragmentShaderFile) :
+    m_source(readShaderSource(vertexShaderFile, fragmentShaderFile))
+{}
+
+void ShaderLibrary::precompile(const std::vector<ShaderDefines>& variants)
+{
+    PROFILE_ZONE("ShaderLibrary::precompile");
+    std::vector<ShaderProgram*> submitted;
+    for (const auto& defines : variants)
+        submitted.push_back(&submit(defines));
+
+    if (m_fallback)
+        return;
+    for (ShaderProgram* program : submitted)
+        program->finish();
+}
+
+void ShaderLibrary::enableAsyncCompilation(const std::string& fallbackVertexShaderFile,
+    const std::string& fallbackFragmentShaderFile, const ShaderDefines& fallbackDefines)
+{
+    m_fallback = std::make_unique<ShaderProgram>(fallbackVertexShaderFile, fallbackFragmentShaderFile,
+        fallbackDefines);
+}
+
+const ShaderProgram& ShaderLibrary::variant(const ShaderDefines& defines)
+{
+    ShaderProgram& program = submit(defines);
+    if (program.isPending())
+    {
+        if (m_fallback && !program.isReady())
+            return *m_fallback;
+        program.finish();
+    }
+    return program;
+}
+
+ShaderProgram& ShaderLibrary::submit(const ShaderDefines& defines)
+{
+    auto found = m_variantsByDefines.find(defines);
+    if (found != m_variantsByDefines.end())
+        return *found->second;
+
+    auto& program = m_variants[shaderDefinesKey(defines)];
+    if (!program)
+        program = std::make_unique<ShaderProgram>(m_source, defines,
+            ShaderProgram::CompileMode::Deferred);
+    m_variantsByDefines[defines] = program.get();
+    return *program;
+}
@@ -0,0 +1,82 @@
+#include "SimulationThread.h"
+
+#include "FrameArena.h"
+#include "Profiler.h"
+
+SimulationThread::SimulationThread(Scene& scene) :
+    m_scene(scene),
+    m_thread(&SimulationThread::loop, this)
+{}
+
+SimulationThread::~SimulationThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_changed.notify_all();
+    m_thread.join();
+}
+
+void SimulationThread::startUpdate(const EventContainer& events)
+{
+    waitForUpdate();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events = events;
+        m_pending = true;
+    }
+    m_changed.notify_all();
+
+    // nothing is published before the first update, so the first frame would be empty;
+    // an exception of the update is left to waitForUpdate
+    if (!m_started)
+    {
+        m_started = true;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return !m_pending; });
+    }
+}
+
+void SimulationThread::waitForUpdate()
+{
+    std::exception_ptr exception;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return !m_pending; });
+        std::swap(exception, m_exception);
+    }
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+void SimulationThread::loop()
+{
+    Profiler::setThreadName("Simulation");
+
+    // an update overlaps the start of the next frame, so the arena is reset per update
+    FrameArena& arena = FrameArena::local();
+    arena.setFollowsFrames(false);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_changed.wait(lock, [this]() { return m_pending || m_stopping; });
+        if (!m_pending)
+            return;
+
+        lock.unlock();
+        arena.reset();
+        try
+        {
+            m_scene.update(m_events);
+        }
+        catch (...)
+        {
+            m_exception = std::current_exception();
+        }
+        lock.lock();
+        m_pending = false;
+        m_changed.notify_all();
+    }
+}
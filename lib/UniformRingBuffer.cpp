@@ -0,0 +1,157 @@
+#include "UniformRingBuffer.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    GLsizeiptr alignUp(GLsizeiptr size, GLint alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    void waitForFence(GLsync fence)
+    {
+        // the first wait flushes, so that the fence is guaranteed to signal eventually
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (true)
+        {
+            GLenum result = glClientWaitSync(fence, flags, 1000000);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+                return;
+            if (result == GL_WAIT_FAILED)
+                throw std::runtime_error("UniformRingBuffer: waiting for a fence failed");
+            flags = 0;
+        }
+    }
+}
+
+UniformRingBuffer::UniformRingBuffer(GLsizeiptr maxFrameSize, int numFrames) :
+    m_numFrames(numFrames),
+    m_alignment(offsetAlignment()),
+    m_fences(numFrames, nullptr)
+{
+    // every region must start at an aligned offset
+    m_frameSize = alignUp(maxFrameSize > 0 ? maxFrameSize : 1, m_alignment);
+    const GLsizeiptr size = m_frameSize * m_numFrames;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    if (GLEW_ARB_buffer_storage)
+    {
+        // coherent: writes become visible without explicit flushes
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+        m_persistentData = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+    }
+    else
+        glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+UniformRingBuffer::~UniformRingBuffer()
+{
+    for (GLsync fence : m_fences)
+        if (fence)
+            glDeleteSync(fence);
+    if (m_persistentData || m_mappedData)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    if (m_buffer != 0)
+        glDeleteBuffers(1, &m_buffer);
+}
+
+GLint UniformRingBuffer::offsetAlignment()
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return alignment > 0 ? alignment : 256;
+}
+
+void UniformRingBuffer::beginFrame()
+{
+    GLsync& fence = m_fences[m_frame];
+    if (fence)
+    {
+        waitForFence(fence);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    m_head = 0;
+}
+
+GLintptr UniformRingBuffer::append(const void* data, GLsizeiptr size)
+{
+    return reserve(1, size).write(0, data, size);
+}
+
+UniformSlots UniformRingBuffer::reserve(size_t numSlots, GLsizeiptr slotSize)
+{
+    slotSize = alignUp(slotSize, m_alignment);
+    const GLsizeiptr size = slotSize * GLsizeiptr(numSlots);
+    if (m_head + size > m_frameSize)
+        throw std::runtime_error("UniformRingBuffer: frame region is full");
+
+    const GLintptr offset = m_frame * m_frameSize + m_head;
+    if (numSlots == 0)
+        return { nullptr, offset, slotSize, 0 };
+    if (!isPersistent() && !m_mappedData)
+        mapFreeRange();
+
+    char* data = isPersistent() ? m_persistentData + offset :
+        m_mappedData + (m_head - m_mappedOffset);
+
+    m_head += size;
+    return { data, offset, slotSize, numSlots };
+}
+
+// ==============================================================================
+// ==============          UNIFORM SLOTS          ===============================
+// ==============================================================================
+
+GLintptr UniformSlots::write(size_t slot, const void* source, GLsizeiptr size) const
+{
+    if (slot >= numSlots || size > slotSize)
+        throw std::runtime_error("UniformSlots: write outside of the reserved slots");
+    std::memcpy(data + slot * slotSize, source, size);
+    return offset + GLintptr(slot * slotSize);
+}
+
+void UniformRingBuffer::flush()
+{
+    if (!m_mappedData)
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    m_mappedData = nullptr;
+}
+
+void UniformRingBuffer::endFrame()
+{
+    flush();
+    m_fences[m_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_frame = (m_frame + 1) % m_numFrames;
+}
+
+void UniformRingBuffer::bindRange(GLuint binding, GLintptr offset, GLsizeiptr size) const
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, m_buffer, offset, size);
+}
+
+void UniformRingBuffer::mapFreeRange()
+{
+    // The fence guarantees that the GPU is done with this region,
+    // and draws of this frame only read the part before the head
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    m_mappedData = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER,
+        m_frame * m_frameSize + m_head, m_frameSize - m_head,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    if (!m_mappedData)
+        throw std::runtime_error("UniformRingBuffer: failed to map the buffer");
+    m_mappedOffset = m_head;
+}
@@ -6,7 +6,9 @@ EventContainer::EventContainer() :
 	m_timeTracker(),
 	m_keys(),
 	m_cursorTracker(),
-	m_aspectRatio(0.0f)
+	m_aspectRatio(0.0f),
+	m_bufferWidth(0),
+	m_bufferHeight(0)
 {}
 
 void EventContainer::reset()
@@ -14,6 +16,14 @@ void EventContainer::reset()
 	m_cursorTracker.clearPositionChange();
 }
 
+void EventContainer::setBufferSize(int width, int height)
+{
+	m_bufferWidth = width;
+	m_bufferHeight = height;
+	if (height > 0)
+		m_aspectRatio = GLfloat(width) / GLfloat(height);
+}
+
 TimeTracker::TimeTracker() : 
 	m_t(0.0f),
 	m_dt(0.0f),
@@ -2,12 +2,19 @@
 
 #include <stdexcept>
 
+#include "AllocationAudit.h"
+#include "FlightRecorder.h"
+#include "FrameArena.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
 Window::Window(int windowWidth, int windowHeight,
-    const std::string& windowName) :
+    const std::string& windowName, bool visible) :
     m_window(nullptr),
     m_width(windowWidth),
     m_height(windowHeight),
     m_name(windowName),
+    m_visible(visible),
     m_events()
 {
     initialize();
@@ -21,6 +28,10 @@ Window::~Window()
 
 void Window::initialize()
 {
+    // the window's thread talks to OpenGL
+    Profiler::setThreadName("Main");
+    JobSystem::shared().setMainThread();
+
     // ================================ GLFW ============================//
     if (!glfwInit())
     {
@@ -36,6 +47,7 @@ void Window::initialize()
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     // Allow Forward Compatibility (?)
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, m_visible ? GLFW_TRUE : GLFW_FALSE);
 
     m_window = glfwCreateWindow(m_width, m_height, m_name.c_str(), nullptr, nullptr);
     if (!m_window)
@@ -73,15 +85,21 @@ void Window::initialize()
     glEnable(GL_DEPTH_TEST);
     // ???
     glViewport(0, 0, getBufferWidth(), getBufferHeight());
-    // Store image aspect ratio for other systems to use
-    m_events.setAspectRatio(GLfloat(getBufferWidth())/GLfloat(getBufferHeight()));
+    // Store image size and aspect ratio for other systems to use
+    m_events.setBufferSize(getBufferWidth(), getBufferHeight());
 }
 
 void Window::pollEvents()
 {
+    FlightRecorder::shared().nextFrame();
+    PROFILE_ZONE("Window::pollEvents");
+    FlightPhase phase("Window::pollEvents");
+    AllocationAudit::nextFrame();
+    FrameArena::nextFrame();
     m_events.reset();
     glfwPollEvents();
     m_events.setTime(glfwGetTime());
+    JobSystem::shared().executeMainThreadJobs();
 }
 
 int Window::getBufferWidth() const 
@@ -136,5 +154,5 @@ void Window::bufferResizeCallback(GLFWwindow* window, int newWidth, int newHeigh
     // to the EventContainter of the Window class
     EventContainer* events =
         static_cast<EventContainer*>(glfwGetWindowUserPointer(window));
-    events->setAspectRatio(GLfloat(newWidth)/GLfloat(newHeight));
+    events->setBufferSize(newWidth, newHeight);
 }
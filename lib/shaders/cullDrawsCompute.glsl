@@ -0,0 +1,42 @@
+#version 430
+
+// one invocation per draw
+layout (local_size_x = 64) in;
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+// world-space bounding sphere of each draw: (center, radius)
+layout (std430, binding = 0) readonly buffer DrawBounds
+{
+    vec4 bounds[];
+};
+
+layout (std430, binding = 1) buffer DrawCommands
+{
+    DrawCommand commands[];
+};
+
+// view frustum planes (normal, distance) with unit normals pointing inwards
+uniform vec4 frustumPlanes[6];
+uniform uint numDraws;
+
+void main()
+{
+    uint draw = gl_GlobalInvocationID.x;
+    if (draw >= numDraws)
+        return;
+
+    vec4 sphere = bounds[draw];
+    bool visible = true;
+    for (int i = 0; i < 6; i++)
+        visible = visible && dot(frustumPlanes[i].xyz, sphere.xyz) + frustumPlanes[i].w >= -sphere.w;
+
+    commands[draw].instanceCount = visible ? 1u : 0u;
+}
@@ -0,0 +1,40 @@
+#version 330
+#if defined(MATERIALS_IN_STORAGE) && MATERIALS_IN_STORAGE
+#extension GL_ARB_shader_storage_buffer_object : require
+#extension GL_ARB_shading_language_420pack : require
+#endif
+
+// set by ShaderLibrary; otherwise materials have a plain diffuse color
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+
+in vec2 posUV;
+in vec3 normal;
+in vec3 pos3D;
+
+// G-buffer: albedo with the alpha of the texture, octahedral-packed normal and shininess
+layout (location = 0) out vec4 albedo;
+layout (location = 1) out vec4 normalShininess;
+
+#include "materials.glsl"
+
+// Map a unit vector onto the octahedron and unfold it into [-1,1]^2
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.z >= 0.0 ? n.xy : folded;
+}
+
+void main()
+{
+    material = materials[fragMaterialIndex];
+    // the same albedo as in the forward shader
+    albedo = vec4(material.diffuseColor, 1.0);
+#if TEXTURED
+    albedo *= sampleMaterialTexture(posUV);
+#endif
+    // a 16-bit float holds the shininess as it is, up to its largest value
+    normalShininess = vec4(encodeNormal(normalize(normal)), min(material.shininess, 65504.0), 0.0);
+}
@@ -0,0 +1,44 @@
+#version 330
+
+in vec2 screenUV;
+
+out vec4 color;
+
+// G-buffer written by the geometry pass
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormalShininess;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+
+// Surface properties of the current pixel, read from the G-buffer
+vec3 pos3D;
+vec3 normal;
+float shininess;
+
+#include "lighting.glsl"
+
+vec3 decodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void main()
+{
+    float depth = texture(gDepth, screenUV).r;
+    // nothing was drawn here, keep the background
+    if (depth == 1.0)
+        discard;
+
+    vec4 ndc = vec4(vec3(screenUV, depth) * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * ndc;
+    pos3D = world.xyz / world.w;
+
+    vec4 normalShininess = texture(gNormalShininess, screenUV);
+    normal = decodeNormal(normalShininess.xy);
+    shininess = normalShininess.z;
+
+    color = shadeSurface(texture(gAlbedo, screenUV));
+}
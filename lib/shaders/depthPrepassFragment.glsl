@@ -0,0 +1,6 @@
+#version 330
+
+// depth only: no color output
+void main()
+{
+}
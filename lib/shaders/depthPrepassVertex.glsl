@@ -0,0 +1,41 @@
+#version 330
+
+// set by the scene when the IndirectRenderer submits the draws
+#ifndef GPU_DRIVEN
+#define GPU_DRIVEN 0
+#endif
+#if GPU_DRIVEN
+#extension GL_ARB_shader_storage_buffer_object : require
+#extension GL_ARB_shading_language_420pack : require
+#endif
+
+// SPIR-V modules have no uniform names, so the locations are fixed
+// (see QUERY_BOX_MODEL_LOCATION in Scene.cpp)
+#ifdef GL_SPIRV
+#extension GL_ARB_explicit_uniform_location : require
+layout (location = 1) uniform mat4 viewProjection;
+#else
+uniform mat4 viewProjection;
+#endif
+
+#if GPU_DRIVEN
+#include "gpuDrivenDrawData.glsl"
+#elif defined(GL_SPIRV)
+layout (location = 0) uniform mat4 model;
+#else
+uniform mat4 model;
+#endif
+
+layout (location = 0) in vec3 pos;
+
+// must match exampleSceneVertex.glsl bit for bit,
+// otherwise the main pass fails the GL_LEQUAL depth test
+invariant gl_Position;
+
+void main()
+{
+#if GPU_DRIVEN
+    mat4 model = draws[drawIndex].model;
+#endif
+    gl_Position = viewProjection * (model * vec4(pos, 1.0));
+}
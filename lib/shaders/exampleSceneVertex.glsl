@@ -1,5 +1,14 @@
 #version 330
 
+// set by the scene when the IndirectRenderer submits the draws
+#ifndef GPU_DRIVEN
+#define GPU_DRIVEN 0
+#endif
+#if GPU_DRIVEN
+#extension GL_ARB_shader_storage_buffer_object : require
+#extension GL_ARB_shading_language_420pack : require
+#endif
+
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec2 tex;
 layout (location = 2) in vec3 norm;
@@ -8,17 +17,43 @@ out vec2 posUV;
 out vec3 normal;
 out vec3 pos3D;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#if GPU_DRIVEN
+#include "gpuDrivenDrawData.glsl"
+#else
+// Per-draw data, appended to a ring buffer and bound with glBindBufferRange
+layout (std140) uniform DrawData
+{
+    mat4 model;
+    // inverse transpose of the model matrix, computed on the CPU once per instance
+    mat3 normalMatrix;
+    // index in the material table
+    uint materialIndex;
+};
+#endif
+
+flat out uint fragMaterialIndex;
+
+// projection * view, computed on the CPU once per frame
+uniform mat4 viewProjection;
+
+// same position as in the depth pre-pass
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(pos, 1.0);
+#if GPU_DRIVEN
+    mat4 model = draws[drawIndex].model;
+    mat3 normalMatrix = draws[drawIndex].normalMatrix;
+    uint materialIndex = draws[drawIndex].materialIndex;
+#endif
+    vec4 worldPos = model * vec4(pos, 1.0);
+    gl_Position = viewProjection * worldPos;
 
     posUV = tex;
     
-    normal = mat3(transpose(inverse(model)))*norm;
+    normal = normalMatrix * norm;
     
-    pos3D = (model * vec4(pos, 1.0)).xyz; 
+    pos3D = worldPos.xyz; 
+
+    fragMaterialIndex = materialIndex;
 }
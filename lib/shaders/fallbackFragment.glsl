@@ -0,0 +1,42 @@
+#version 330
+#if defined(MATERIALS_IN_STORAGE) && MATERIALS_IN_STORAGE
+#extension GL_ARB_shader_storage_buffer_object : require
+#extension GL_ARB_shading_language_420pack : require
+#endif
+
+// Cheap stand-in while the real shader variant is compiling:
+// material color with ambient and directional light only
+
+in vec2 posUV;
+in vec3 normal;
+in vec3 pos3D;
+
+out vec4 color;
+
+struct AmbientLight
+{
+    vec3 color;
+    float intensity;
+};
+
+struct DirectionalLight
+{
+    vec3 color;
+    vec3 direction;
+    float intensity;
+};
+
+#include "materials.glsl"
+
+uniform AmbientLight ambientLight;
+uniform DirectionalLight directionalLight;
+
+void main()
+{
+    material = materials[fragMaterialIndex];
+    float diffuse = max(-dot(normalize(normal), directionalLight.direction), 0.0);
+    vec3 lightColor = ambientLight.color * ambientLight.intensity +
+        directionalLight.color * directionalLight.intensity * diffuse;
+
+    color = vec4(material.diffuseColor * lightColor, 1.0);
+}
@@ -0,0 +1,12 @@
+#version 330
+
+// Texture coordinates of the screen
+out vec2 screenUV;
+
+void main()
+{
+    // A single triangle that covers the whole screen, no vertex data needed
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    screenUV = position;
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
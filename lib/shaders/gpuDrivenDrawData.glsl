@@ -0,0 +1,20 @@
+// DrawData of the draws of the IndirectRenderer, for shaders compiled with GPU_DRIVEN 1,
+// pasted in with #include "gpuDrivenDrawData.glsl" (see readShaderSource).
+// The including shader enables GL_ARB_shader_storage_buffer_object and
+// GL_ARB_shading_language_420pack at its top.
+
+struct DrawData
+{
+    mat4 model;
+    mat3 normalMatrix;
+    uint materialIndex;
+};
+
+// DrawData of all draws. An instanced attribute starting at the base instance
+// of each indirect command gives the index of the draw.
+// The binding is fixed at link time, as DRAW_DATA_BINDING in IndirectRenderer.cpp.
+layout (std430, binding = 2) readonly buffer DrawDataBuffer
+{
+    DrawData draws[];
+};
+layout (location = 3) in uint drawIndex;
@@ -0,0 +1,210 @@
+// Lighting shared by the forward shader and the deferred lighting pass,
+// pasted in with #include "lighting.glsl" (see readShaderSource).
+// The including shader declares the surface to shade before the #include:
+//   vec3 pos3D;       world-space position
+//   vec3 normal;      world-space normal, not necessarily normalized
+//   float shininess;  specular exponent of the material
+
+// Feature switches, set by ShaderLibrary for each variant.
+// Without them, the shader is compiled with all features.
+#ifndef DIRECTIONAL_LIGHT
+#define DIRECTIONAL_LIGHT 1
+#endif
+#ifndef SPOT_LIGHT
+#define SPOT_LIGHT 1
+#endif
+#ifndef POINT_LIGHTS
+#define POINT_LIGHTS 1
+#endif
+// otherwise per-instance lighting
+#ifndef CLUSTERED_LIGHTING
+#define CLUSTERED_LIGHTING 1
+#endif
+#ifndef MAX_INSTANCE_LIGHTS
+#define MAX_INSTANCE_LIGHTS 8
+#endif
+
+struct AmbientLight
+{
+    vec3 color;
+    float intensity;
+};
+
+struct DirectionalLight
+{
+    vec3 color;
+    vec3 direction;
+    float intensity;
+};
+
+struct PointLight
+{
+    vec3 color;
+    vec3 position;
+    vec3 attenuation;
+    float intensity;
+    float radius;
+};
+
+struct SpotLight
+{
+    vec3 color;
+    vec3 attenuation;
+    float intensity;
+    float halfAngleCos;
+    float verticalOffset;
+    bool isOn;
+};
+
+struct Camera
+{
+    vec3 position;
+    vec3 direction;
+};
+
+uniform Camera camera;
+
+uniform AmbientLight ambientLight;
+uniform DirectionalLight directionalLight;
+uniform SpotLight spotLight;
+
+// Point lights, 3 texels per light: (position, radius), (color, intensity), (attenuation, 0)
+uniform samplerBuffer pointLightData;
+// Point lights binned into clusters: screen tiles x depth slices.
+// For each cluster, an (offset, count) range in the light index list
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterLightIndices;
+uniform ivec3 clusterGridSize;
+// depth slice = log(depth) * clusterDepthScale + clusterDepthBias
+uniform float clusterDepthScale;
+uniform float clusterDepthBias;
+uniform vec2 screenSize;
+
+// Per-instance lighting mode: indices of the most relevant lights for this draw
+uniform int numInstanceLights;
+uniform int instanceLights[MAX_INSTANCE_LIGHTS];
+
+vec3 computeAmbientLight()
+{
+    return ambientLight.color * ambientLight.intensity;
+}
+
+float computeIllumination(vec3 direction)
+{
+    // Assume light direction is normalized
+    vec3 normalizedNormal = normalize(normal);
+    float illumination = max(-1 * dot(normalizedNormal, direction), 0.0f);
+
+    // Compute specular
+    if (illumination > 0.0f)
+    {
+        vec3 dirToCamera = normalize(camera.position - pos3D);
+        vec3 reflectedLight = reflect(direction, normalizedNormal);
+        float specularAngle = dot(reflectedLight, dirToCamera);
+        if (specularAngle > 0.0f)
+            illumination += pow(specularAngle,shininess);
+    }
+
+    return illumination;
+}
+
+vec3 computeDirectionalLight()
+{
+#if DIRECTIONAL_LIGHT
+    return computeIllumination(directionalLight.direction) *
+           directionalLight.color * directionalLight.intensity;
+#else
+    return vec3(0,0,0);
+#endif
+}
+
+float computeAttenuation(vec3 coeffs, float dist)
+{
+    return (coeffs.x * dist + coeffs.y) * dist + coeffs.z;
+}
+
+PointLight fetchPointLight(int index)
+{
+    vec4 positionRadius = texelFetch(pointLightData, 3 * index);
+    vec4 colorIntensity = texelFetch(pointLightData, 3 * index + 1);
+    vec4 attenuation = texelFetch(pointLightData, 3 * index + 2);
+    return PointLight(colorIntensity.rgb, positionRadius.xyz, attenuation.xyz,
+                      colorIntensity.a, positionRadius.w);
+}
+
+int computeClusterIndex()
+{
+    // view-space depth of the fragment
+    float depth = max(dot(pos3D - camera.position, camera.direction), 1e-4);
+    ivec3 cluster = ivec3(
+        ivec2(gl_FragCoord.xy / screenSize * vec2(clusterGridSize.xy)),
+        int(log(depth) * clusterDepthScale + clusterDepthBias));
+    cluster = clamp(cluster, ivec3(0), clusterGridSize - 1);
+    return (cluster.z * clusterGridSize.y + cluster.y) * clusterGridSize.x + cluster.x;
+}
+
+vec3 computePointLight(int index)
+{
+    PointLight light = fetchPointLight(index);
+    vec3 direction = pos3D - light.position;
+    float distance = length(direction);
+    if (distance > light.radius)
+        return vec3(0.0,0.0,0.0);
+    float attenuation = computeAttenuation(light.attenuation, distance);
+    return computeIllumination(normalize(direction)) *
+        light.color * light.intensity / attenuation;
+}
+
+vec3 computePointLights()
+{
+    vec3 pointLightsColor = vec3(0.0,0.0,0.0);
+
+#if POINT_LIGHTS && CLUSTERED_LIGHTING
+    // only the lights of this fragment's cluster can contribute
+    uvec2 range = texelFetch(clusterRanges, computeClusterIndex()).xy;
+    for (uint i = 0u; i < range.y; i++)
+        pointLightsColor += computePointLight(
+            int(texelFetch(clusterLightIndices, int(range.x + i)).x));
+#elif POINT_LIGHTS
+    // constant trip count, so that the compiler can unroll the loop
+    for (int i = 0; i < MAX_INSTANCE_LIGHTS; i++)
+    {
+        if (i >= numInstanceLights)
+            break;
+        pointLightsColor += computePointLight(instanceLights[i]);
+    }
+#endif
+
+    return pointLightsColor;
+}
+
+vec3 computeSpotLight()
+{
+#if !SPOT_LIGHT
+    return vec3(0.0,0.0,0.0);
+#else
+    vec3 direction = pos3D - camera.position;
+    direction.y -= spotLight.verticalOffset;
+    float distance = length(direction);
+    vec3 normalizedDirection = normalize(direction);
+    float angleFromBeamAxis = dot(normalizedDirection, camera.direction);
+    if (angleFromBeamAxis < spotLight.halfAngleCos)
+        return vec3(0.0,0.0,0.0);
+
+    float attenuation = computeAttenuation(spotLight.attenuation, distance);
+    float smoothEdgeFactor = 1.0 - (1.0 - angleFromBeamAxis)/(1.0 - spotLight.halfAngleCos);
+
+    return computeIllumination(normalizedDirection) * spotLight.color *
+        spotLight.intensity / attenuation * smoothEdgeFactor;
+#endif
+}
+
+// Final color of the surface: its albedo lit by all lights; the albedo's alpha is kept
+vec4 shadeSurface(vec4 albedo)
+{
+    vec3 lightColor = computeAmbientLight() +
+                      computeDirectionalLight() +
+                      computePointLights() +
+                      computeSpotLight();
+    return vec4(albedo.rgb * lightColor, albedo.a);
+}
@@ -0,0 +1,60 @@
+// Materials of all loaded Models (see MaterialTable), pasted in with
+// #include "materials.glsl" (see readShaderSource).
+// With MATERIALS_IN_STORAGE 1, the including shader enables
+// GL_ARB_shader_storage_buffer_object and GL_ARB_shading_language_420pack at its top.
+
+// size of the material table and where it lives, set from MaterialTable::shaderDefines
+#ifndef MAX_MATERIALS
+#define MAX_MATERIALS 256
+#endif
+#ifndef MATERIALS_IN_STORAGE
+#define MATERIALS_IN_STORAGE 0
+#endif
+// as MATERIAL_TEXTURE_ARRAYS in MaterialTable.h
+#define MATERIAL_TEXTURE_ARRAYS 4
+
+struct Material
+{
+    vec3 diffuseColor;
+    float shininess;
+    // layer in the texture array of its size class
+    int textureLayer;
+    int textureArray;
+};
+
+#if MATERIALS_IN_STORAGE
+// the binding is fixed at link time, as MATERIALS_STORAGE_BINDING in MaterialTable.cpp
+layout (std430, binding = 3) readonly buffer MaterialsBuffer
+{
+    Material materials[];
+};
+#else
+layout (std140) uniform Materials
+{
+    Material materials[MAX_MATERIALS];
+};
+#endif
+
+// index in the material table, passed on from the draw's data
+flat in uint fragMaterialIndex;
+// the material of this fragment, set at the start of main()
+Material material;
+
+// textures of all materials, one array for each size class
+uniform sampler2DArray materialTextures[MATERIAL_TEXTURE_ARRAYS];
+
+// Sample the texture of the material. Sampler arrays take constant indices only,
+// and the derivatives are taken outside the branches, where they are well-defined.
+vec4 sampleMaterialTexture(vec2 uv)
+{
+    vec2 dx = dFdx(uv);
+    vec2 dy = dFdy(uv);
+    vec3 coords = vec3(uv, material.textureLayer);
+    switch (material.textureArray)
+    {
+    case 0: return textureGrad(materialTextures[0], coords, dx, dy);
+    case 1: return textureGrad(materialTextures[1], coords, dx, dy);
+    case 2: return textureGrad(materialTextures[2], coords, dx, dy);
+    default: return textureGrad(materialTextures[3], coords, dx, dy);
+    }
+}
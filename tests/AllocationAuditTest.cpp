@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+#include "AllocationAudit.h"
+#include "Config.h"
+#include "FlightRecorder.h"
+#include "Scene.h"
+#include "SimulationThread.h"
+#include "Window.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Built only with RENDGL_ALLOCATION_AUDIT, see tests/CMakeLists.txt
+
+TEST(AllocationAuditTest, scope_countsAllocationsOfItsThread)
+{
+    const AllocationStats before = AllocationAudit::scope("AllocationAuditTest::scope");
+    {
+        AllocationScope scope("AllocationAuditTest::scope");
+        auto value = std::make_unique<int>(42);
+        // allocations of other threads are not attributed to the scope
+        std::thread([]() { auto other = std::make_unique<double[]>(100); }).join();
+    }
+    auto outside = std::make_unique<int>(7);
+
+    const AllocationStats after = AllocationAudit::scope("AllocationAuditTest::scope");
+    // std::thread allocates its state on this thread, too
+    EXPECT_GE(after.newCalls - before.newCalls, 2u);
+    EXPECT_LT(after.newBytes - before.newBytes, 100 * sizeof(double));
+}
+
+TEST(AllocationAuditTest, nextFrame_movesCountsToLastFrame)
+{
+    AllocationAudit::nextFrame();
+    // kept alive, so that the compiler cannot leave the allocations out
+    std::vector<std::unique_ptr<int>> values;
+    for (int i = 0; i < 10; i++)
+        values.push_back(std::make_unique<int>(i));
+    EXPECT_GE(AllocationAudit::currentFrame().newCalls, 10u);
+
+    AllocationAudit::nextFrame();
+    EXPECT_GE(AllocationAudit::lastFrame().newCalls, 10u);
+    EXPECT_GE(AllocationAudit::lastFrame().newBytes, 10 * sizeof(int));
+    EXPECT_EQ(AllocationAudit::currentFrame().newCalls, 0u);
+}
+
+// Renders a bundled scene and checks that frames after a warm-up
+// do not call operator new on any thread. Allocations of the driver and GLFW
+// go through malloc; they are reported but not checked.
+class SceneAllocationTest : public testing::TestWithParam<const char*>
+{
+protected:
+    // shaders that compile in the background and lazy uploads finish in these frames
+    static constexpr int WARMUP_FRAMES = 120;
+    static constexpr int MEASURED_FRAMES = 60;
+
+    void renderFrames(bool threaded)
+    {
+        // a slow frame on a loaded machine must not start a dump in the measured frames
+        FlightRecorder::shared().setSpikeThreshold(0);
+        Window window(640, 360, "allocation_tests", false);
+        window.setVSync(false);
+        auto scene = Scene::loadScene(SCENES_DIR + std::string(GetParam()));
+        SimulationThread simulation(*scene);
+
+        auto frame = [&]() {
+            window.pollEvents();
+            if (threaded)
+            {
+                simulation.startUpdate(window.events());
+                scene->render();
+            }
+            else
+                scene->render(window.events());
+            window.swapBuffers();
+        };
+
+        for (int i = 0; i < WARMUP_FRAMES; i++)
+            frame();
+        glFinish();
+        simulation.waitForUpdate();
+
+        const AllocationStats update = AllocationAudit::scope("Scene::update");
+        const AllocationStats render = AllocationAudit::scope("Scene::render");
+        uint64_t mallocCalls = 0;
+        for (int i = 0; i < MEASURED_FRAMES; i++)
+        {
+            frame();
+            // pollEvents of the next frame ends this one; the first has the warm-up before it
+            if (i > 0)
+            {
+                EXPECT_EQ(AllocationAudit::lastFrame().newCalls, 0u) << "frame " << i;
+                mallocCalls += AllocationAudit::lastFrame().mallocCalls;
+            }
+        }
+        simulation.waitForUpdate();
+
+        EXPECT_EQ(AllocationAudit::scope("Scene::update").newCalls, update.newCalls);
+        EXPECT_EQ(AllocationAudit::scope("Scene::render").newCalls, render.newCalls);
+        RecordProperty("mallocCallsPerFrame", std::to_string(mallocCalls / (MEASURED_FRAMES - 1)));
+    }
+};
+
+TEST_P(SceneAllocationTest, steadyState_doesNotAllocate)
+{
+    renderFrames(false);
+}
+
+TEST_P(SceneAllocationTest, steadyStateThreaded_doesNotAllocate)
+{
+    renderFrames(true);
+}
+
+INSTANTIATE_TEST_SUITE_P(BundledScenes, SceneAllocationTest,
+    testing::Values("exampleScene.json", "manyLights.json", "welcomeToOpenGL_hero.json",
+        "vertexBenchmark.json", "gpuCullingBenchmark.json", "occlusionBenchmark.json"));
@@ -90,3 +90,56 @@ TEST(CameraTest, verticalRotationIsLimited)
 }
 
 
+
+TEST(CameraTest, viewProjectionMapsPointsToNdc)
+{
+    auto [camera, events] = setup();
+    events.setKeyState(GLFW_KEY_W, true);
+    camera.processEvents(events);
+
+    // the camera is at (1,0,0) and looks along +x; right is +z, up is +y
+    glm::mat4 viewProjection = camera.viewProjectionMatrix(1.5f);
+    auto ndc = [&viewProjection](glm::vec3 point) {
+        glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+        return glm::vec3(clip) / clip.w;
+    };
+
+    // on the view axis, depth d maps to (f+n)/(f-n) - 2fn/((f-n)d), with n = 0.1 and f = 100
+    glm::vec3 nearPoint = ndc(glm::vec3(1.1f, 0.0f, 0.0f));
+    ASSERT_NEAR(nearPoint.x, 0.0f, 1e-5f);
+    ASSERT_NEAR(nearPoint.y, 0.0f, 1e-5f);
+    ASSERT_NEAR(nearPoint.z, -1.0f, 1e-4f);
+    ASSERT_NEAR(ndc(glm::vec3(101.0f, 0.0f, 0.0f)).z, 1.0f, 1e-4f);
+    ASSERT_NEAR(ndc(glm::vec3(2.0f, 0.0f, 0.0f)).z, 80.1f / 99.9f, 1e-4f);
+
+    // 0.75 to the right and 0.5 up at depth 2: x/y in NDC is (0.75/0.5)/aspect = 1
+    glm::vec3 offAxis = ndc(glm::vec3(3.0f, 0.5f, 0.75f));
+    ASSERT_GT(offAxis.x, 0.0f);
+    ASSERT_GT(offAxis.y, 0.0f);
+    ASSERT_NEAR(offAxis.x, offAxis.y, 1e-5f);
+    ASSERT_NEAR(offAxis.z, 90.1f / 99.9f, 1e-4f);
+}
+
+TEST(CameraTest, frustumPlanesContainPointsInView)
+{
+    auto [camera, events] = setup();
+    auto planes = camera.frustumPlanes(1.5f);
+
+    auto inside = [&planes](glm::vec3 point) {
+        for (const auto& plane : planes)
+            if (glm::dot(glm::vec3(plane), point) + plane.w < 0.0f)
+                return false;
+        return true;
+    };
+
+    // the camera looks along +x from the origin
+    ASSERT_TRUE(inside(glm::vec3(10.0f, 0.0f, 0.0f)));
+    ASSERT_TRUE(inside(glm::vec3(10.0f, 1.0f, -2.0f)));
+    ASSERT_FALSE(inside(glm::vec3(-10.0f, 0.0f, 0.0f)));
+    ASSERT_FALSE(inside(glm::vec3(200.0f, 0.0f, 0.0f)));
+    ASSERT_FALSE(inside(glm::vec3(10.0f, 0.0f, 50.0f)));
+
+    // unit normals: the value is the signed distance to the near plane
+    ASSERT_NEAR(glm::dot(glm::vec3(planes[4]), glm::vec3(10.0f, 0.0f, 0.0f)) + planes[4].w,
+        10.0f - camera.nearPlane(), 1e-3f);
+}
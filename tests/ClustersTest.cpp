@@ -0,0 +1,114 @@
+#include "gtest/gtest.h"
+#include "Clusters.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+    const GLfloat nearPlane = 0.1f;
+    const GLfloat farPlane = 100.0f;
+
+    // camera at the origin looking along -z
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f,
+        nearPlane, farPlane);
+
+    bool contains(const LightClusters& clusters, size_t cluster, GLuint light)
+    {
+        const auto& range = clusters.clusters()[cluster];
+        const auto& indices = clusters.lightIndices();
+        return std::find(indices.begin() + range.offset,
+            indices.begin() + range.offset + range.count, light) !=
+            indices.begin() + range.offset + range.count;
+    }
+
+    // cluster that contains a world-space point
+    size_t clusterOf(const LightClusters& clusters, glm::vec3 point)
+    {
+        glm::vec4 clip = projection * view * glm::vec4(point, 1.0f);
+        GLfloat x = clip.x / clip.w, y = clip.y / clip.w;
+        int tileX = std::clamp(int((x + 1.0f) * 0.5f * clusters.tilesX()), 0, clusters.tilesX() - 1);
+        int tileY = std::clamp(int((y + 1.0f) * 0.5f * clusters.tilesY()), 0, clusters.tilesY() - 1);
+        return clusters.clusterIndex(tileX, tileY, clusters.slice(-point.z));
+    }
+
+    float rand01() {
+        return float(rand()) / float(RAND_MAX);
+    }
+}
+
+TEST(LightClustersTest, lightInFront_isInItsCluster)
+{
+    LightClusters clusters;
+    const glm::vec3 position(0.0f, 0.0f, -5.0f);
+
+    clusters.build({ LightSphere{ position, 0.5f } }, view, projection, nearPlane, farPlane);
+
+    ASSERT_TRUE(contains(clusters, clusterOf(clusters, position), 0));
+    ASSERT_FALSE(contains(clusters, clusters.clusterIndex(0, 0, 0), 0));
+    ASSERT_FALSE(contains(clusters, clusters.clusterIndex(0, 0, clusters.slices() - 1), 0));
+}
+
+TEST(LightClustersTest, lightBehindCamera_isInNoCluster)
+{
+    LightClusters clusters;
+
+    clusters.build({ LightSphere{ glm::vec3(0.0f, 0.0f, 5.0f), 1.0f } },
+        view, projection, nearPlane, farPlane);
+
+    ASSERT_TRUE(clusters.lightIndices().empty());
+}
+
+TEST(LightClustersTest, depthSlices_areMonotonic)
+{
+    LightClusters clusters;
+    clusters.build({}, view, projection, nearPlane, farPlane);
+
+    ASSERT_EQ(clusters.slice(nearPlane), 0);
+    ASSERT_EQ(clusters.slice(farPlane * 0.999f), clusters.slices() - 1);
+    for (GLfloat depth = 0.2f; depth < farPlane; depth *= 1.5f)
+        ASSERT_LE(clusters.slice(depth), clusters.slice(depth * 1.5f));
+}
+
+TEST(LightClustersTest, manyLights_everyLightIsInItsCentersCluster)
+{
+    srand(42);
+    std::vector<LightSphere> lights;
+    for (int i = 0; i < 1003; i++)
+        lights.push_back(LightSphere{
+            glm::vec3(rand01() * 20.0f - 10.0f, rand01() * 10.0f - 5.0f, -1.0f - rand01() * 50.0f),
+            0.1f + rand01() });
+    LightClusters clusters;
+
+    clusters.build(lights, view, projection, nearPlane, farPlane);
+
+    for (GLuint i = 0; i < lights.size(); i++)
+    {
+        glm::vec4 clip = projection * view * glm::vec4(lights[i].position, 1.0f);
+        if (std::abs(clip.x) > clip.w || std::abs(clip.y) > clip.w)
+            continue;
+        ASSERT_TRUE(contains(clusters, clusterOf(clusters, lights[i].position), i)) << "light " << i;
+    }
+}
+
+TEST(LightClustersTest, unboundedLights_areInEveryCluster)
+{
+    // PointLight::radius of a light without attenuation; five lights, so that
+    // both the four-wide and the single-light path bin one of them
+    const GLfloat unbounded = std::numeric_limits<GLfloat>::max();
+    std::vector<LightSphere> lights;
+    for (GLfloat z : { -5.0f, -50.0f, 5.0f, -500.0f, 0.0f })
+        lights.push_back(LightSphere{ glm::vec3(3.0f, -2.0f, z), unbounded });
+    LightClusters clusters;
+
+    clusters.build(lights, view, projection, nearPlane, farPlane);
+
+    for (size_t cluster = 0; cluster < clusters.numClusters(); cluster++)
+        for (GLuint i = 0; i < lights.size(); i++)
+            ASSERT_TRUE(contains(clusters, cluster, i)) << "light " << i << ", cluster " << cluster;
+}
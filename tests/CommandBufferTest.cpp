@@ -0,0 +1,176 @@
+#include "gtest/gtest.h"
+#include "CommandBuffer.h"
+#include "JobSystem.h"
+#include "Mesh.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+    // logs the calls of the replay as text
+    class LogBackend : public CommandBackend
+    {
+    public:
+        void bindDrawData(GLintptr offset) override { log.push_back("data " + std::to_string(offset)); }
+        void setInstanceLights(const GLint* lights, int numLights) override
+        {
+            std::string entry = "lights";
+            for (int i = 0; i < numLights; i++)
+                entry += " " + std::to_string(lights[i]);
+            log.push_back(entry);
+        }
+        void beginCondition(GLuint query) override { log.push_back("begin " + std::to_string(query)); }
+        void endCondition() override { log.push_back("end"); }
+        void draw(const Mesh& mesh) override { drawn.push_back(&mesh); log.push_back("draw"); }
+        void beginGpuScope(const char* name) override { log.push_back(std::string("scope ") + name); }
+        void endGpuScope() override { log.push_back("end scope"); }
+
+        std::vector<std::string> log;
+        std::vector<const Mesh*> drawn;
+    };
+
+    // Meshes need a GL context, but the commands only pass their addresses around
+    alignas(Mesh) unsigned char meshStorage[2][sizeof(Mesh)];
+    const Mesh& fakeMesh(int i) { return *reinterpret_cast<const Mesh*>(meshStorage[i]); }
+}
+
+TEST(CommandBufferTest, replay_executesCommandsInOrder)
+{
+    CommandBuffer commands;
+    const GLint lights[] = { 3, 1 };
+    commands.setInstanceLights(lights, 2);
+    commands.setDrawData(256);
+    commands.draw(fakeMesh(0));
+    commands.setDrawData(512);
+    commands.draw(fakeMesh(1));
+    EXPECT_EQ(commands.numCommands(), 5u);
+
+    LogBackend backend;
+    CommandReplayer replayer(backend);
+    replayer.execute(commands);
+    replayer.finish();
+
+    EXPECT_EQ(backend.log, (std::vector<std::string>{ "lights 3 1", "data 256", "draw", "data 512", "draw" }));
+    EXPECT_EQ(backend.drawn, (std::vector<const Mesh*>{ &fakeMesh(0), &fakeMesh(1) }));
+}
+
+TEST(CommandBufferTest, replay_filtersRedundantStateAcrossBuffers)
+{
+    const GLint lights[] = { 2 };
+    CommandBuffer first, second;
+    first.setInstanceLights(lights, 1);
+    first.setDrawData(0);
+    first.draw(fakeMesh(0));
+    first.setDrawData(0);
+    first.draw(fakeMesh(0));
+    // recorded independently, the next buffer selects the same lights again
+    second.setInstanceLights(lights, 1);
+    second.setDrawData(256);
+    second.draw(fakeMesh(1));
+
+    LogBackend backend;
+    CommandReplayer replayer(backend);
+    replayer.execute(first);
+    replayer.execute(second);
+    replayer.finish();
+
+    EXPECT_EQ(backend.log, (std::vector<std::string>{ "lights 2", "data 0", "draw", "draw", "data 256", "draw" }));
+    EXPECT_EQ(replayer.numFiltered(), 2u);
+}
+
+TEST(CommandBufferTest, replay_opensAndClosesConditions)
+{
+    CommandBuffer commands;
+    commands.setCondition(7);
+    commands.draw(fakeMesh(0));
+    commands.setCondition(7);
+    commands.draw(fakeMesh(0));
+    commands.setCondition(8);
+    commands.draw(fakeMesh(1));
+    commands.setCondition(0);
+    commands.draw(fakeMesh(1));
+    commands.setCondition(9);
+    commands.draw(fakeMesh(0));
+
+    LogBackend backend;
+    CommandReplayer replayer(backend);
+    replayer.execute(commands);
+    replayer.finish();
+
+    EXPECT_EQ(backend.log, (std::vector<std::string>{ "begin 7", "draw", "draw", "end", "begin 8", "draw",
+        "end", "draw", "begin 9", "draw", "end" }));
+}
+
+TEST(CommandBufferTest, replay_nestsGpuScopesAroundDraws)
+{
+    CommandBuffer commands;
+    commands.beginGpuScope("instances");
+    commands.beginGpuScope("model");
+    commands.draw(fakeMesh(0));
+    commands.endGpuScope();
+    commands.draw(fakeMesh(1));
+    commands.endGpuScope();
+
+    LogBackend backend;
+    CommandReplayer replayer(backend);
+    replayer.execute(commands);
+    replayer.finish();
+
+    EXPECT_EQ(backend.log, (std::vector<std::string>{ "scope instances", "scope model", "draw", "end scope",
+        "draw", "end scope" }));
+}
+
+TEST(CommandBufferTest, clear_removesAllCommands)
+{
+    CommandBuffer commands;
+    for (int i = 0; i < 100; i++)
+    {
+        commands.setDrawData(i);
+        commands.draw(fakeMesh(0));
+    }
+    EXPECT_GT(commands.size(), 0u);
+    commands.clear();
+    EXPECT_TRUE(commands.empty());
+    EXPECT_EQ(commands.numCommands(), 0u);
+
+    LogBackend backend;
+    CommandReplayer replayer(backend);
+    replayer.execute(commands);
+    EXPECT_TRUE(backend.log.empty());
+}
+
+TEST(CommandBufferTest, recordInParallel_replaysLikeSerialRecording)
+{
+    const size_t numDraws = 10000, numBuffers = 16;
+    auto record = [&](CommandBuffer& commands, size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+        {
+            const GLint light = GLint(i / 10);
+            commands.setInstanceLights(&light, 1);
+            commands.setDrawData(GLintptr(i) * 256);
+            commands.draw(fakeMesh(i % 2));
+        }
+    };
+
+    CommandBuffer serial;
+    record(serial, 0, numDraws);
+    LogBackend expected;
+    CommandReplayer serialReplayer(expected);
+    serialReplayer.execute(serial);
+    serialReplayer.finish();
+
+    JobSystem jobs(3);
+    std::vector<CommandBuffer> buffers(numBuffers);
+    jobs.parallelFor(numBuffers, 1, [&](size_t first, size_t last) {
+        for (size_t buffer = first; buffer < last; buffer++)
+            record(buffers[buffer], buffer * numDraws / numBuffers, (buffer + 1) * numDraws / numBuffers);
+    });
+    LogBackend parallel;
+    CommandReplayer replayer(parallel);
+    for (const CommandBuffer& commands : buffers)
+        replayer.execute(commands);
+    replayer.finish();
+
+    EXPECT_EQ(parallel.log, expected.log);
+    EXPECT_EQ(parallel.drawn, expected.drawn);
+}
@@ -0,0 +1,103 @@
+#include "gtest/gtest.h"
+#include "FlightRecorder.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <json.hpp>
+
+namespace
+{
+    nlohmann::json readTrace(const std::string& fileName)
+    {
+        std::ifstream file(fileName);
+        nlohmann::json trace;
+        file >> trace;
+        return trace;
+    }
+
+    // complete events on the frames track
+    std::vector<nlohmann::json> frames(const nlohmann::json& trace)
+    {
+        std::vector<nlohmann::json> found;
+        for (const auto& event : trace["traceEvents"])
+            if (event["ph"] == "X" && event["tid"] == 1)
+                found.push_back(event);
+        return found;
+    }
+}
+
+TEST(FlightRecorderTest, writeSnapshot_keepsLastFramesWithPhases)
+{
+    FlightRecorder recorder(4, 8);
+    recorder.setSpikeThreshold(0);
+    for (int i = 0; i < 11; i++)
+    {
+        recorder.nextFrame();
+        recorder.addPhaseTime("FlightRecorderTest::phase", 2000000);
+    }
+
+    const std::string fileName = (std::filesystem::temp_directory_path() / "FlightRecorderTest.json").string();
+    recorder.writeSnapshot(fileName);
+    const auto found = frames(readTrace(fileName));
+
+    EXPECT_EQ(recorder.numFrames(), 10u);
+    ASSERT_EQ(found.size(), 4u);
+    EXPECT_EQ(found.front()["name"], "Frame 6");
+    EXPECT_EQ(found.back()["name"], "Frame 9");
+    EXPECT_DOUBLE_EQ(found.back()["args"]["FlightRecorderTest::phase"].get<double>(), 2.0);
+}
+
+TEST(FlightRecorderTest, writeSnapshot_containsEvents)
+{
+    FlightRecorder recorder(4, 2);
+    for (const char* text : { "first", "second", "third \"quoted\"" })
+        recorder.addEvent("upload", text, 1000, 500);
+
+    const std::string fileName = (std::filesystem::temp_directory_path() / "FlightRecorderTest.json").string();
+    recorder.writeSnapshot(fileName);
+    const nlohmann::json trace = readTrace(fileName);
+
+    std::vector<std::string> events;
+    for (const auto& event : trace["traceEvents"])
+        if (event["ph"] == "X" && event["tid"] == 2)
+        {
+            EXPECT_EQ(event["cat"], "upload");
+            events.push_back(event["name"]);
+        }
+    EXPECT_EQ(events, (std::vector<std::string>{ "second", "third \"quoted\"" }));
+}
+
+TEST(FlightRecorderTest, nextFrame_spikeWritesDumpAfterLaterFrames)
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "FlightRecorderTest";
+    std::filesystem::create_directories(directory);
+    FlightRecorder recorder(16, 8);
+    recorder.setSpikeThreshold(5.0);
+    recorder.setFramesAfterSpike(2);
+    recorder.setDumpDirectory(directory.string());
+
+    recorder.nextFrame();
+    recorder.nextFrame();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    recorder.nextFrame();
+    recorder.nextFrame();
+    recorder.waitForDump();
+    EXPECT_EQ(recorder.numDumps(), 0u);
+
+    recorder.nextFrame();
+    // the dump reports the threshold that the spike crossed
+    recorder.setSpikeThreshold(100.0);
+    recorder.waitForDump();
+    ASSERT_EQ(recorder.numDumps(), 1u);
+
+    const nlohmann::json trace = readTrace((directory / "flightRecorder_1.json").string());
+    EXPECT_EQ(trace["otherData"]["spikeFrame"], 1);
+    EXPECT_DOUBLE_EQ(trace["otherData"]["spikeThresholdMs"].get<double>(), 5.0);
+    const auto found = frames(trace);
+    ASSERT_EQ(found.size(), 4u);
+    EXPECT_GE(found[1]["args"]["frameMs"].get<double>(), 5.0);
+}
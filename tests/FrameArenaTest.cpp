@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+#include "FrameArena.h"
+
+#include <cstdint>
+#include <thread>
+
+TEST(FrameArenaTest, allocate_returnsAlignedDisjointMemory)
+{
+    FrameArena arena(1024);
+    char* a = static_cast<char*>(arena.allocate(3, 1));
+    double* b = arena.allocate<double>(4);
+    void* c = arena.allocate(16, 64);
+
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % alignof(double), 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(c) % 64, 0u);
+    EXPECT_GE(reinterpret_cast<char*>(b), a + 3);
+    EXPECT_GE(static_cast<char*>(c), reinterpret_cast<char*>(b + 4));
+    EXPECT_GE(arena.used(), 3u + 4 * sizeof(double) + 16);
+}
+
+TEST(FrameArenaTest, allocate_largerThanBlock_addsBlock)
+{
+    FrameArena arena(256);
+    arena.allocate(100);
+    arena.allocate(1000);
+    EXPECT_EQ(arena.numBlockAllocations(), 2u);
+    EXPECT_GE(arena.capacity(), 1100u);
+}
+
+TEST(FrameArenaTest, reset_mergesBlocksToHighWaterMark)
+{
+    FrameArena arena(256);
+    auto frame = [&arena]() {
+        for (int i = 0; i < 20; i++)
+            arena.allocate(100);
+        arena.reset();
+    };
+
+    frame();
+    EXPECT_GE(arena.highWaterMark(), 2000u);
+    EXPECT_EQ(arena.used(), 0u);
+
+    // the merged block holds a whole frame, so the heap is no longer touched
+    frame();
+    const size_t highWaterMark = arena.highWaterMark();
+    const size_t numBlockAllocations = arena.numBlockAllocations();
+    for (int i = 0; i < 10; i++)
+        frame();
+    EXPECT_EQ(arena.numBlockAllocations(), numBlockAllocations);
+    EXPECT_EQ(arena.highWaterMark(), highWaterMark);
+}
+
+TEST(FrameArenaTest, frameVector_allocatesFromArena)
+{
+    FrameArena arena;
+    FrameVector<int> values(arena);
+    for (int i = 0; i < 1000; i++)
+        values.push_back(i);
+
+    EXPECT_EQ(values[999], 999);
+    EXPECT_GE(arena.used(), 1000 * sizeof(int));
+    EXPECT_EQ(arena.numBlockAllocations(), 1u);
+}
+
+TEST(FrameArenaTest, local_isResetByNextFrame)
+{
+    FrameArena& arena = FrameArena::local();
+    arena.allocate(100);
+    EXPECT_GE(FrameArena::local().used(), 100u);
+    EXPECT_EQ(&FrameArena::local(), &arena);
+
+    FrameArena::nextFrame();
+    EXPECT_EQ(FrameArena::local().used(), 0u);
+}
+
+TEST(FrameArenaTest, local_isPerThread)
+{
+    FrameArena* main = &FrameArena::local();
+    FrameArena* other = nullptr;
+    std::thread thread([&other]() {
+        other = &FrameArena::local();
+        // a thread that resets its arena itself keeps the memory across frames
+        other->setFollowsFrames(false);
+        other->allocate(100);
+        FrameArena::nextFrame();
+        EXPECT_GE(FrameArena::local().used(), 100u);
+    });
+    thread.join();
+    EXPECT_NE(main, other);
+}
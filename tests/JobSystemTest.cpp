@@ -0,0 +1,177 @@
+#include "gtest/gtest.h"
+#include "JobSystem.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST(JobSystemTest, runJobs_allJobsFinishBeforeWaitReturns)
+{
+    JobSystem jobs(3);
+    JobGroup group;
+    std::atomic<int> counter{ 0 };
+
+    for (int i = 0; i < 100; i++)
+        jobs.run(group, [&counter]() { counter++; });
+    jobs.wait(group);
+
+    ASSERT_TRUE(group.isDone());
+    ASSERT_EQ(counter.load(), 100);
+}
+
+TEST(JobSystemTest, parallelFor_visitsEveryIndexOnce)
+{
+    JobSystem jobs(3);
+    std::vector<int> visits(10000, 0);
+
+    jobs.parallelFor(visits.size(), 16, [&visits](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            visits[i]++;
+    });
+
+    for (int count : visits)
+        ASSERT_EQ(count, 1);
+}
+
+TEST(JobSystemTest, nestedParallelFor_doesNotDeadlock)
+{
+    JobSystem jobs(2);
+    std::atomic<size_t> sum{ 0 };
+
+    jobs.parallelFor(8, 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            jobs.parallelFor(100, 1, [&](size_t innerFirst, size_t innerLast) {
+                sum += innerLast - innerFirst;
+            });
+    });
+
+    ASSERT_EQ(sum.load(), 800u);
+}
+
+TEST(JobSystemTest, noWorkers_runsJobsOnWaitingThread)
+{
+    JobSystem jobs(0);
+    JobGroup group;
+    std::thread::id jobThread;
+
+    jobs.run(group, [&jobThread]() { jobThread = std::this_thread::get_id(); });
+    jobs.wait(group);
+
+    ASSERT_EQ(jobThread, std::this_thread::get_id());
+}
+
+TEST(JobSystemTest, throwingJob_waitRethrows)
+{
+    JobSystem jobs(2);
+    JobGroup group;
+
+    jobs.run(group, []() { throw std::runtime_error("job failed"); });
+    jobs.run(group, []() {});
+
+    ASSERT_THROW(jobs.wait(group), std::runtime_error);
+    ASSERT_TRUE(group.isDone());
+}
+
+TEST(JobSystemTest, mainThreadJobs_runOnMainThread)
+{
+    JobSystem jobs(2);
+    JobGroup group;
+    std::thread::id jobThread;
+
+    jobs.runOnMainThread(group, [&jobThread]() { jobThread = std::this_thread::get_id(); });
+    ASSERT_FALSE(group.isDone());
+    jobs.executeMainThreadJobs();
+
+    ASSERT_TRUE(group.isDone());
+    ASSERT_EQ(jobThread, std::this_thread::get_id());
+}
+
+TEST(JobSystemTest, setMainThread_mainThreadJobsRunOnNewMainThread)
+{
+    JobSystem jobs(2);
+    JobGroup group;
+    std::thread::id jobThread, renderThread;
+
+    // e.g. the window is created on another thread than the one that created the JobSystem
+    std::thread([&]() {
+        jobs.setMainThread();
+        renderThread = std::this_thread::get_id();
+        jobs.runOnMainThread(group, [&jobThread]() { jobThread = std::this_thread::get_id(); });
+        jobs.wait(group);
+    }).join();
+
+    ASSERT_FALSE(jobs.isMainThread());
+    ASSERT_THROW(jobs.executeMainThreadJobs(), std::runtime_error);
+    ASSERT_EQ(jobThread, renderThread);
+}
+
+TEST(JobSystemTest, longJob_waitWakesWhenGroupIsDone)
+{
+    JobSystem jobs(1);
+    JobGroup group;
+    std::atomic<bool> started{ false }, finished{ false };
+
+    // long enough for the waiting thread to go to sleep
+    jobs.run(group, [&started, &finished]() {
+        started = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        finished = true;
+    });
+    // the job runs on the worker, so wait has nothing to help with
+    while (!started.load())
+        std::this_thread::yield();
+    jobs.wait(group);
+
+    ASSERT_TRUE(finished.load());
+}
+
+TEST(TaskGraphTest, tasksRunAfterTheirDependencies)
+{
+    JobSystem jobs(3);
+    TaskGraph graph;
+    std::vector<int> order;
+    std::mutex mutex;
+    auto record = [&](int task) {
+        return [&, task]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(task);
+        };
+    };
+
+    // 0 -> 1, 2 -> 3
+    auto load = graph.add(record(0));
+    auto cull = graph.add(record(1), { load });
+    auto bin = graph.add(record(2), { load });
+    graph.add(record(3), { cull, bin });
+    graph.run(jobs);
+
+    ASSERT_EQ(order.size(), 4u);
+    ASSERT_EQ(order.front(), 0);
+    ASSERT_EQ(order.back(), 3);
+}
+
+TEST(TaskGraphTest, mainThreadTask_runsOnThreadThatRunsTheGraph)
+{
+    JobSystem jobs(2);
+    TaskGraph graph;
+    std::thread::id uploadThread;
+    std::atomic<bool> loaded{ false };
+
+    auto load = graph.add([&]() { loaded = true; });
+    graph.addOnMainThread([&]() {
+        ASSERT_TRUE(loaded.load());
+        uploadThread = std::this_thread::get_id();
+    }, { load });
+    graph.run(jobs);
+
+    ASSERT_EQ(uploadThread, std::this_thread::get_id());
+}
+
+TEST(TaskGraphTest, dependencyOnLaterTask_throws)
+{
+    TaskGraph graph;
+
+    ASSERT_THROW(graph.add([]() {}, { 0 }), std::runtime_error);
+}
@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+#include "Light.h"
+#include "Window.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace {
+    PointLight lightAt(glm::vec3 position, GLfloat intensity = 1.0f)
+    {
+        return PointLight(glm::vec3(1.0f), position, glm::vec3(1.0f, 0.0f, 1.0f), intensity);
+    }
+
+    std::vector<LightSphere> spheres(const std::vector<PointLight>& lights)
+    {
+        std::vector<LightSphere> result;
+        for (const auto& light : lights)
+            result.push_back(LightSphere{ light.position(), light.radius() });
+        return result;
+    }
+}
+
+TEST(PointLightTest, radius_intensityAtRadiusIsCutoff)
+{
+    PointLight light(glm::vec3(1.0f), glm::vec3(0.0f), glm::vec3(0.5f, 0.2f, 1.0f), 3.0f);
+
+    ASSERT_NEAR(light.intensityAt(light.radius(0.01f)), 0.01f, 1e-5f);
+    ASSERT_NEAR(light.intensityAt(light.radius(0.1f)), 0.1f, 1e-5f);
+}
+
+TEST(PointLightTest, radius_weakLight_zero)
+{
+    PointLight light(glm::vec3(1.0f), glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 1.0f), 0.001f);
+
+    ASSERT_FLOAT_EQ(light.radius(0.01f), 0.0f);
+}
+
+TEST(SelectPointLightsTest, lightsOutOfReach_areSkipped)
+{
+    std::vector<PointLight> lights{ lightAt(glm::vec3(1.0f, 0.0f, 0.0f)),
+                                    lightAt(glm::vec3(100.0f, 0.0f, 0.0f)) };
+    std::array<GLint, MAX_INSTANCE_LIGHTS> selection;
+
+    int numSelected = selectPointLights(lights, spheres(lights),
+        BoundingSphere{ glm::vec3(0.0f), 0.5f }, selection);
+
+    ASSERT_EQ(numSelected, 1);
+    ASSERT_EQ(selection[0], 0);
+}
+
+TEST(SelectPointLightsTest, tooManyLights_strongestAreSelected)
+{
+    std::vector<PointLight> lights;
+    for (int i = 0; i < 2 * MAX_INSTANCE_LIGHTS; i++)
+        lights.push_back(lightAt(glm::vec3(0.0f), GLfloat(i + 1)));
+    std::array<GLint, MAX_INSTANCE_LIGHTS> selection;
+
+    int numSelected = selectPointLights(lights, spheres(lights),
+        BoundingSphere{ glm::vec3(1.0f), 0.5f }, selection);
+
+    ASSERT_EQ(numSelected, MAX_INSTANCE_LIGHTS);
+    for (int i = 0; i < MAX_INSTANCE_LIGHTS; i++)
+        ASSERT_EQ(selection[i], 2 * MAX_INSTANCE_LIGHTS - 1 - i);
+}
+
+TEST(LightManagerTest, shaderDefineVariants_containSwitchedSpotLight)
+{
+    // the light buffers are GL objects
+    std::unique_ptr<Window> window;
+    try { window = std::make_unique<Window>(64, 64, "light_tests", false); }
+    catch (const std::runtime_error&) { GTEST_SKIP() << "no OpenGL context"; }
+
+    LightManager lights;
+    lights.setSpotLight(SpotLight(glm::vec3(1.0f), glm::vec3(1.0f, 0.0f, 1.0f), 1.0f, 0.9f, 0.0f, false));
+    const auto variants = lights.shaderDefineVariants();
+    auto isVariant = [&variants](const ShaderDefines& defines) {
+        return std::find(variants.begin(), variants.end(), defines) != variants.end();
+    };
+    ASSERT_TRUE(isVariant(lights.shaderDefines()));
+
+    EventContainer events;
+    events.setKeyState(GLFW_KEY_F, true);
+    lights.processEvents(events);
+    ASSERT_TRUE(lights.spotLightOn());
+    ASSERT_EQ(lights.shaderDefines().at("SPOT_LIGHT"), "1");
+    ASSERT_TRUE(isVariant(lights.shaderDefines()));
+    // a frame switched before the event still gets its own defines
+    ASSERT_EQ(lights.shaderDefines(false).at("SPOT_LIGHT"), "0");
+}
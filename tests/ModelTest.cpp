@@ -1,5 +1,9 @@
 #include "gtest/gtest.h"
 #include "Model.h"
+#include "Window.h"
+
+#include <memory>
+#include <stdexcept>
 
 TEST(VertexDataTest, position)
 {
@@ -43,3 +47,112 @@ TEST(VertexDataTest, positionAndNormalAndUV)
     ASSERT_EQ(data.normalOffset(), 5);
 }
 
+
+TEST(MeshGeometryTest, appendGeometry_offsetsIndices)
+{
+    const MeshGeometry triangle{
+        { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+          1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+          0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f },
+        { 0, 1, 2 } };
+    MeshGeometry merged;
+
+    auto first = appendGeometry(merged, triangle);
+    auto second = appendGeometry(merged, triangle);
+
+    ASSERT_EQ(merged.vertices.size(), 48);
+    ASSERT_EQ(merged.indices.size(), 6);
+    ASSERT_EQ(merged.indices[3], 3);
+    ASSERT_EQ(merged.indices[5], 5);
+    ASSERT_EQ(first.firstIndex, 0);
+    ASSERT_EQ(second.firstIndex, 3);
+    ASSERT_EQ(second.numIndices, 3);
+}
+
+TEST(MeshGeometryTest, appendGeometry_transformsPositionsAndBoundingBox)
+{
+    const MeshGeometry triangle{
+        { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+          1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+          0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f },
+        { 0, 1, 2 } };
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 2.0f, 3.0f));
+    transform = glm::scale(transform, glm::vec3(2.0f));
+    MeshGeometry merged;
+
+    auto subMesh = appendGeometry(merged, triangle, transform);
+
+    // second vertex: position, uv and normal
+    ASSERT_FLOAT_EQ(merged.vertices[8], 3.0f);
+    ASSERT_FLOAT_EQ(merged.vertices[9], 2.0f);
+    ASSERT_FLOAT_EQ(merged.vertices[10], 3.0f);
+    ASSERT_FLOAT_EQ(merged.vertices[11], 1.0f);
+    ASSERT_FLOAT_EQ(merged.vertices[15], 1.0f);
+
+    ASSERT_FLOAT_EQ(subMesh.boundingBox[0], 1.0f);
+    ASSERT_FLOAT_EQ(subMesh.boundingBox[1], 3.0f);
+    ASSERT_FLOAT_EQ(subMesh.boundingBox[2], 2.0f);
+    ASSERT_FLOAT_EQ(subMesh.boundingBox[3], 4.0f);
+    ASSERT_FLOAT_EQ(subMesh.boundingBox[4], 3.0f);
+    ASSERT_FLOAT_EQ(subMesh.boundingBox[5], 3.0f);
+}
+
+TEST(MeshGeometryTest, hashGeometry_identicalData_sameHash)
+{
+    const MeshGeometry first{ { 0.0f, 1.0f, 2.0f }, { 0, 1, 2 } };
+    const MeshGeometry second{ { 0.0f, 1.0f, 2.0f }, { 0, 1, 2 } };
+
+    ASSERT_EQ(hashGeometry(first), hashGeometry(second));
+}
+
+TEST(MeshGeometryTest, hashGeometry_differentData_differentHash)
+{
+    const MeshGeometry first{ { 0.0f, 1.0f, 2.0f }, { 0, 1, 2 } };
+    const MeshGeometry second{ { 0.0f, 1.0f, 2.5f }, { 0, 1, 2 } };
+    const MeshGeometry third{ { 0.0f, 1.0f, 2.0f }, { 0, 2, 1 } };
+
+    ASSERT_NE(hashGeometry(first), hashGeometry(second));
+    ASSERT_NE(hashGeometry(first), hashGeometry(third));
+}
+
+TEST(MeshGeometryTest, hashGeometry_comparesBitPatterns)
+{
+    // equal as floats, but not the same data
+    const MeshGeometry positiveZero{ { 0.0f, 1.0f, 2.0f }, { 0, 1, 2 } };
+    const MeshGeometry negativeZero{ { -0.0f, 1.0f, 2.0f }, { 0, 1, 2 } };
+
+    ASSERT_NE(hashGeometry(positiveZero), hashGeometry(negativeZero));
+}
+
+TEST(MeshTest, emptyGeometry_uploadsAndDrawsNothing)
+{
+    // no GL context here, so any GL call would fail
+    const Mesh mesh(MeshGeometry(), VertexData::POSITION | VertexData::UV | VertexData::NORMAL);
+    mesh.render();
+    mesh.render(0, 0);
+    mesh.renderPositions();
+}
+
+TEST(GeometryRegistryTest, identicalGeometry_sharedUntilReleased)
+{
+    std::unique_ptr<Window> window;
+    try { window = std::make_unique<Window>(64, 64, "model_tests", false); }
+    catch (const std::runtime_error&) { GTEST_SKIP() << "no OpenGL context"; }
+
+    // a registry of its own, so that meshes of other tests do not count
+    GeometryRegistry registry;
+    MeshGeometry geometry;
+    geometry.vertices = { 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+    geometry.indices = { 0, 1, 2 };
+    MeshGeometry other = geometry;
+    other.vertices[0] = 0.5f;
+
+    MeshHandle first = registry.acquire(geometry, VertexData::POSITION);
+    ASSERT_EQ(registry.acquire(MeshGeometry(geometry), VertexData::POSITION), first);
+    ASSERT_NE(registry.acquire(other, VertexData::POSITION), first);
+    ASSERT_EQ(registry.bytesSaved(), sizeof(GLfloat) * 9 + sizeof(GLuint) * 3);
+
+    // without the CPU copy, nothing is read back to compare with
+    registry.releaseGeometry();
+    ASSERT_NE(registry.acquire(geometry, VertexData::POSITION), first);
+}
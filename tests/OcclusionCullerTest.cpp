@@ -0,0 +1,106 @@
+#include "gtest/gtest.h"
+#include "OcclusionCuller.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+    // camera at the origin looking along -z
+    const glm::mat4 viewProjection =
+        glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f) *
+        glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // 4 x 4 wall facing the camera, centered on the view axis
+    void addWall(OcclusionCuller& culler, GLfloat z)
+    {
+        culler.addOccluder({
+            glm::vec3(-2.0f, -2.0f, z), glm::vec3(2.0f, -2.0f, z),
+            glm::vec3(2.0f, 2.0f, z), glm::vec3(-2.0f, 2.0f, z) },
+            { 0, 1, 2, 0, 2, 3 });
+    }
+}
+
+TEST(OcclusionCullerTest, wall_coversCenterOfScreen)
+{
+    OcclusionCuller culler;
+    addWall(culler, -5.0f);
+
+    culler.render(viewProjection);
+
+    ASSERT_NEAR(culler.depth(culler.width() / 2, culler.height() / 2), 0.2f, 1e-4f);
+    ASSERT_EQ(culler.depth(0, 0), 0.0f);
+}
+
+TEST(OcclusionCullerTest, boxBehindWall_isOccluded)
+{
+    OcclusionCuller culler;
+    addWall(culler, -5.0f);
+
+    culler.render(viewProjection);
+
+    ASSERT_TRUE(culler.isOccluded(glm::vec3(-1.0f, -1.0f, -12.0f), glm::vec3(1.0f, 1.0f, -10.0f)));
+    ASSERT_TRUE(culler.isOccluded(BoundingSphere{ glm::vec3(0.0f, 0.0f, -20.0f), 2.0f }));
+}
+
+TEST(OcclusionCullerTest, boxInFrontOfWall_isNotOccluded)
+{
+    OcclusionCuller culler;
+    addWall(culler, -5.0f);
+
+    culler.render(viewProjection);
+
+    ASSERT_FALSE(culler.isOccluded(glm::vec3(-0.5f, -0.5f, -3.0f), glm::vec3(0.5f, 0.5f, -2.0f)));
+    // the box pierces the wall
+    ASSERT_FALSE(culler.isOccluded(glm::vec3(-0.5f, -0.5f, -6.0f), glm::vec3(0.5f, 0.5f, -4.0f)));
+}
+
+TEST(OcclusionCullerTest, boxBesideWall_isNotOccluded)
+{
+    OcclusionCuller culler;
+    addWall(culler, -5.0f);
+
+    culler.render(viewProjection);
+
+    // visible past the right edge of the wall
+    ASSERT_FALSE(culler.isOccluded(glm::vec3(3.0f, -0.5f, -11.0f), glm::vec3(5.0f, 0.5f, -10.0f)));
+    // partly behind the wall
+    ASSERT_FALSE(culler.isOccluded(glm::vec3(1.0f, -1.0f, -12.0f), glm::vec3(6.0f, 1.0f, -10.0f)));
+}
+
+TEST(OcclusionCullerTest, noOccluders_nothingIsOccluded)
+{
+    OcclusionCuller culler;
+
+    culler.render(viewProjection);
+
+    ASSERT_FALSE(culler.isOccluded(glm::vec3(-1.0f, -1.0f, -12.0f), glm::vec3(1.0f, 1.0f, -10.0f)));
+}
+
+TEST(OcclusionCullerTest, boxAroundCamera_isNotOccluded)
+{
+    OcclusionCuller culler;
+    addWall(culler, -5.0f);
+
+    culler.render(viewProjection);
+
+    ASSERT_FALSE(culler.isOccluded(glm::vec3(-1.0f), glm::vec3(1.0f)));
+}
+
+TEST(OcclusionCullerTest, floorCrossingNearPlane_isClipped)
+{
+    OcclusionCuller culler;
+    addWall(culler, -5.0f);
+    // a floor from behind the camera to the distance
+    culler.addOccluder({
+        glm::vec3(-50.0f, -1.0f, 10.0f), glm::vec3(50.0f, -1.0f, 10.0f), glm::vec3(0.0f, -1.0f, -50.0f) },
+        { 0, 1, 2 });
+
+    culler.render(viewProjection);
+
+    ASSERT_EQ(culler.numOccluderTriangles(), 3u);
+    ASSERT_TRUE(culler.isOccluded(glm::vec3(-1.0f, -1.0f, -12.0f), glm::vec3(1.0f, 1.0f, -10.0f)));
+    // below the floor, which is clipped at the near plane and still rasterized
+    ASSERT_TRUE(culler.isOccluded(glm::vec3(12.0f, -3.0f, -20.0f), glm::vec3(14.0f, -2.0f, -18.0f)));
+    // standing on the floor
+    ASSERT_FALSE(culler.isOccluded(glm::vec3(12.0f, -0.5f, -20.0f), glm::vec3(14.0f, 0.5f, -18.0f)));
+}
@@ -0,0 +1,101 @@
+#include "gtest/gtest.h"
+#include "GpuProfiler.h"
+#include "Profiler.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <json.hpp>
+
+namespace
+{
+    nlohmann::json writeAndReadTrace()
+    {
+        const std::string fileName = (std::filesystem::temp_directory_path() / "ProfilerTest.json").string();
+        Profiler::writeChromeTrace(fileName);
+        std::ifstream file(fileName);
+        nlohmann::json trace;
+        file >> trace;
+        return trace;
+    }
+
+    // complete events of the given name
+    std::vector<nlohmann::json> zones(const nlohmann::json& trace, const std::string& name)
+    {
+        std::vector<nlohmann::json> found;
+        for (const auto& event : trace["traceEvents"])
+            if (event["ph"] == "X" && event["name"] == name)
+                found.push_back(event);
+        return found;
+    }
+}
+
+TEST(ProfilerTest, writeChromeTrace_containsZonesOfAllThreads)
+{
+    Profiler::start();
+    {
+        ProfileZone zone("ProfilerTest::main");
+    }
+    std::thread([]() {
+        Profiler::setThreadName("ProfilerTest thread");
+        ProfileZone zone("ProfilerTest::thread");
+    }).join();
+    Profiler::stop();
+
+    const nlohmann::json trace = writeAndReadTrace();
+    auto mainZones = zones(trace, "ProfilerTest::main");
+    auto threadZones = zones(trace, "ProfilerTest::thread");
+    ASSERT_EQ(mainZones.size(), 1u);
+    ASSERT_EQ(threadZones.size(), 1u);
+    EXPECT_NE(mainZones[0]["tid"], threadZones[0]["tid"]);
+    EXPECT_GE(threadZones[0]["ts"].get<double>(), mainZones[0]["ts"].get<double>());
+    EXPECT_GE(mainZones[0]["dur"].get<double>(), 0.0);
+
+    bool named = false;
+    for (const auto& event : trace["traceEvents"])
+        if (event["ph"] == "M" && event["tid"] == threadZones[0]["tid"])
+            named = event["args"]["name"] == "ProfilerTest thread";
+    EXPECT_TRUE(named);
+}
+
+TEST(ProfilerTest, ring_keepsLastZonesOfThread)
+{
+    Profiler::start();
+    const uint64_t start = Profiler::now();
+    const size_t numZones = Profiler::ZONES_PER_THREAD + 10;
+    std::thread([start, numZones]() {
+        for (size_t i = 0; i < numZones; i++)
+            Profiler::record("ProfilerTest::ring", start + i * 1000, start + i * 1000 + 500);
+    }).join();
+    Profiler::stop();
+
+    auto ringZones = zones(writeAndReadTrace(), "ProfilerTest::ring");
+    ASSERT_EQ(ringZones.size(), Profiler::ZONES_PER_THREAD);
+    EXPECT_NEAR(ringZones.front()["ts"].get<double>(), (start + 10 * 1000) / 1000.0, 0.01);
+}
+
+TEST(ProfilerTest, start_dropsEarlierZones)
+{
+    Profiler::start();
+    Profiler::record("ProfilerTest::early", 0, 1);
+    // a zone that began while nothing was recorded is not recorded at its end
+    Profiler::stop();
+    {
+        ProfileZone zone("ProfilerTest::unrecorded");
+        Profiler::start();
+    }
+    Profiler::stop();
+
+    const nlohmann::json trace = writeAndReadTrace();
+    EXPECT_TRUE(zones(trace, "ProfilerTest::early").empty());
+    EXPECT_TRUE(zones(trace, "ProfilerTest::unrecorded").empty());
+}
+
+TEST(GpuProfilerTest, noFrames_throwsBeforeCreatingQueries)
+{
+    // no OpenGL is needed: nothing is sized or created from an invalid count
+    ASSERT_THROW(GpuProfiler(0), std::runtime_error);
+    ASSERT_THROW(GpuProfiler(-1), std::runtime_error);
+}
@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+#include "Config.h"
+#include "Shader.h"
+#include "Window.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+TEST(ShaderTest, specializeShaderCode_definesFollowVersion)
+{
+    std::string code = "#version 330\nvoid main() {}\n";
+    ShaderDefines defines{ { "TEXTURED", "0" }, { "SPOT_LIGHT", "1" } };
+
+    // defines are sorted by name
+    ASSERT_EQ(specializeShaderCode(code, defines),
+        "#version 330\n#define SPOT_LIGHT 1\n#define TEXTURED 0\nvoid main() {}\n");
+}
+
+TEST(ShaderTest, specializeShaderCode_noDefinesKeepsCode)
+{
+    std::string code = "#version 330\nvoid main() {}\n";
+    ASSERT_EQ(specializeShaderCode(code, {}), code);
+}
+
+TEST(ShaderTest, specializeShaderCode_noVersion)
+{
+    ASSERT_EQ(specializeShaderCode("void main() {}\n", { { "A", "1" } }),
+        "#define A 1\nvoid main() {}\n");
+}
+
+TEST(ShaderTest, shaderDefinesKey_independentOfInsertionOrder)
+{
+    ShaderDefines first;
+    first["B"] = "1";
+    first["A"] = "0";
+    ShaderDefines second;
+    second["A"] = "0";
+    second["B"] = "1";
+
+    ASSERT_EQ(shaderDefinesKey(first), "A=0;B=1");
+    ASSERT_EQ(shaderDefinesKey(first), shaderDefinesKey(second));
+    ASSERT_NE(shaderDefinesKey(first), shaderDefinesKey({ { "A", "1" }, { "B", "1" } }));
+}
+
+TEST(ShaderTest, programBinaryName_dependsOnCodeAndDriver)
+{
+    ShaderSource source{ "#version 330\nvoid main() {}\n", "#version 330\nvoid main() {}\n" };
+    ShaderSource specialized{ specializeShaderCode(source.vertex, { { "A", "1" } }), source.fragment };
+
+    std::string name = programBinaryName(source, "vendor\nrenderer\n3.3");
+    ASSERT_EQ(name, programBinaryName(source, "vendor\nrenderer\n3.3"));
+    ASSERT_NE(name, programBinaryName(source, "vendor\nrenderer\n4.6"));
+    ASSERT_NE(name, programBinaryName(specialized, "vendor\nrenderer\n3.3"));
+}
+
+TEST(ShaderTest, programBinaryName_codeMovedBetweenStagesChangesName)
+{
+    ShaderSource first{ "ab", "c" };
+    ShaderSource second{ "a", "bc" };
+    ASSERT_NE(programBinaryName(first, ""), programBinaryName(second, ""));
+}
+
+TEST(ShaderTest, programBinary_savedOnceAndLoaded)
+{
+    std::unique_ptr<Window> window;
+    try { window = std::make_unique<Window>(64, 64, "shader_tests", false); }
+    catch (const std::runtime_error&) { GTEST_SKIP() << "no OpenGL context"; }
+#ifdef SHADER_CACHE_DIR
+    GLint numFormats = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats == 0)
+        GTEST_SKIP() << "no program binary formats";
+
+    // code of its own, so that no binary of an earlier run is found
+    const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    ShaderSource source{
+        "#version 330\n// " + std::to_string(now) + "\nvoid main() { gl_Position = vec4(0.0); }\n",
+        "#version 330\nout vec4 color;\nvoid main() { color = vec4(1.0); }\n" };
+    auto glString = [](GLenum name) { return std::string(reinterpret_cast<const char*>(glGetString(name))); };
+    const std::filesystem::path binaryFile = SHADER_CACHE_DIR + programBinaryName(source,
+        glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION));
+
+    // the first program is compiled and saved
+    ShaderProgram compiled(source);
+    ASSERT_TRUE(std::filesystem::exists(binaryFile));
+    const auto saved = std::filesystem::last_write_time(binaryFile);
+
+    // the second one is loaded: a compiled program would be saved again
+    ShaderProgram loaded(source);
+    ASSERT_FALSE(loaded.isPending());
+    GLint linked = GL_FALSE;
+    glGetProgramiv(loaded.id(), GL_LINK_STATUS, &linked);
+    ASSERT_EQ(linked, GL_TRUE);
+    ASSERT_EQ(std::filesystem::last_write_time(binaryFile), saved);
+    std::filesystem::remove(binaryFile);
+#else
+    GTEST_SKIP() << "program binaries are not cached in this build";
+#endif
+}
+
+TEST(ShaderTest, readShaderSource_pastesIncludedFiles)
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "ShaderTest";
+    std::filesystem::create_directories(directory / "common");
+    auto write = [&directory](const std::string& name, const std::string& code) {
+        std::ofstream(directory / name) << code;
+    };
+    write("common/light.glsl", "float light() { return 1.0; }\n");
+    write("vertex.glsl", "#version 330\nvoid main() {}\n");
+    write("fragment.glsl", "#version 330\n  #include \"common/light.glsl\"\nvoid main() {}\n");
+
+    ShaderSource source = readShaderSource((directory / "vertex.glsl").string(),
+        (directory / "fragment.glsl").string());
+    ASSERT_EQ(source.vertex, "#version 330\nvoid main() {}\n");
+    ASSERT_EQ(source.fragment, "#version 330\nfloat light() { return 1.0; }\nvoid main() {}\n");
+}
+
+TEST(ShaderTest, readShaderSource_includeCycleThrows)
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "ShaderTest";
+    std::filesystem::create_directories(directory);
+    std::ofstream(directory / "cycle.glsl") << "#include \"cycle.glsl\"\n";
+
+    const std::string file = (directory / "cycle.glsl").string();
+    ASSERT_THROW(readShaderSource(file, file), std::runtime_error);
+}
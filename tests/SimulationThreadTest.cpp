@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+#include "SimulationThread.h"
+
+#include <stdexcept>
+#include <thread>
+
+namespace {
+    // records the threads and time steps of its updates
+    class FakeScene : public Scene
+    {
+    public:
+        void update(const EventContainer& events) override
+        {
+            if (events.keyState(0))
+                throw std::runtime_error("update failed");
+            updateThread = std::this_thread::get_id();
+            totalTime += events.timeStep();
+            numUpdates++;
+        }
+        void render() override { numRenders++; }
+
+        std::thread::id updateThread;
+        GLfloat totalTime{ 0.0f };
+        int numUpdates{ 0 };
+        int numRenders{ 0 };
+    };
+}
+
+TEST(SimulationThreadTest, startUpdate_updatesOnAnotherThread)
+{
+    FakeScene scene;
+    SimulationThread simulation(scene);
+    EventContainer events;
+    events.setTime(1.0f);
+    events.setTime(1.5f);
+
+    for (int frame = 0; frame < 3; frame++)
+    {
+        simulation.startUpdate(events);
+        scene.render();
+    }
+    simulation.waitForUpdate();
+
+    ASSERT_EQ(scene.numUpdates, 3);
+    ASSERT_EQ(scene.numRenders, 3);
+    ASSERT_FLOAT_EQ(scene.totalTime, 1.5f);
+    ASSERT_NE(scene.updateThread, std::this_thread::get_id());
+}
+
+TEST(SimulationThreadTest, firstStartUpdate_waitsForTheUpdate)
+{
+    FakeScene scene;
+    SimulationThread simulation(scene);
+
+    // the first frame renders the state of the first update
+    simulation.startUpdate(EventContainer());
+    ASSERT_EQ(scene.numUpdates, 1);
+    simulation.waitForUpdate();
+}
+
+TEST(SimulationThreadTest, throwingUpdate_waitRethrows)
+{
+    FakeScene scene;
+    SimulationThread simulation(scene);
+    EventContainer events;
+    events.setKeyState(0, true);
+
+    simulation.startUpdate(events);
+
+    ASSERT_THROW(simulation.waitForUpdate(), std::runtime_error);
+    ASSERT_NO_THROW(simulation.waitForUpdate());
+}
+
+TEST(SceneTest, renderWithEvents_updatesThenRenders)
+{
+    FakeScene scene;
+
+    static_cast<Scene&>(scene).render(EventContainer());
+
+    ASSERT_EQ(scene.numUpdates, 1);
+    ASSERT_EQ(scene.numRenders, 1);
+    ASSERT_EQ(scene.updateThread, std::this_thread::get_id());
+}
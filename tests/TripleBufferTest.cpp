@@ -0,0 +1,61 @@
+#include "gtest/gtest.h"
+#include "TripleBuffer.h"
+
+#include <thread>
+
+TEST(TripleBufferTest, publish_readReturnsNewestValue)
+{
+    TripleBuffer<int> buffer;
+
+    buffer.writeBuffer() = 1;
+    buffer.publish();
+    buffer.writeBuffer() = 2;
+    buffer.publish();
+
+    ASSERT_TRUE(buffer.hasFresh());
+    ASSERT_EQ(buffer.read(), 2);
+    ASSERT_FALSE(buffer.hasFresh());
+}
+
+TEST(TripleBufferTest, noNewValue_readReturnsSameValue)
+{
+    TripleBuffer<int> buffer;
+    buffer.writeBuffer() = 1;
+    buffer.publish();
+    const int& first = buffer.read();
+
+    // the writer works on another buffer while the reader holds the value
+    buffer.writeBuffer() = 2;
+
+    ASSERT_EQ(first, 1);
+    ASSERT_EQ(&buffer.read(), &first);
+}
+
+TEST(TripleBufferTest, concurrentWriter_readerSeesConsistentIncreasingValues)
+{
+    struct Pair { int a, b; };
+    TripleBuffer<Pair> buffer;
+    const int numValues = 100000;
+
+    std::thread writer([&]() {
+        for (int i = 1; i <= numValues; i++)
+        {
+            Pair& pair = buffer.writeBuffer();
+            pair.a = i;
+            pair.b = -i;
+            buffer.publish();
+        }
+    });
+    // EXPECT and break: returning from the test with the writer still joinable would terminate
+    int last = 0;
+    while (last < numValues)
+    {
+        const Pair& pair = buffer.read();
+        EXPECT_EQ(pair.a, -pair.b);
+        EXPECT_GE(pair.a, last);
+        if (pair.a != -pair.b || pair.a < last)
+            break;
+        last = pair.a;
+    }
+    writer.join();
+}